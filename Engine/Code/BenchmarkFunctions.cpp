@@ -0,0 +1,299 @@
+#include "engine.h"
+#include "BenchmarkFunctions.h"
+
+#include <algorithm>
+
+namespace Benchmark
+{
+    BenchmarkConfig ParseCommandLine(int argc, char** argv)
+    {
+        BenchmarkConfig config;
+
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+
+            if (arg == "--headless")
+            {
+                config.headless = true;
+            }
+            else if (arg == "--frames" && hasValue)
+            {
+                config.frameCount = (u32)atoi(argv[++i]);
+            }
+            else if (arg == "--warmup" && hasValue)
+            {
+                config.warmupFrames = (u32)atoi(argv[++i]);
+            }
+            else if (arg == "--report" && hasValue)
+            {
+                config.reportPath = argv[++i];
+            }
+            else if (arg == "--no-program-cache")
+            {
+                config.useProgramCache = false;
+            }
+            else if (arg == "--gpu-culling")
+            {
+                config.useGpuCulling = true;
+            }
+            else if (arg == "--validate-culling")
+            {
+                config.validateCulling = true;
+            }
+            else if (arg == "--lights" && hasValue)
+            {
+                config.extraLights = (u32)atoi(argv[++i]);
+            }
+            else if (arg == "--light-volumes")
+            {
+                config.useLightVolumes = true;
+            }
+            else if (arg == "--compact-gbuffer")
+            {
+                config.useCompactGBuffer = true;
+            }
+            else if (arg == "--water-divisor" && hasValue)
+            {
+                u32 divisor = (u32)atoi(argv[++i]);
+                if (divisor == 1 || divisor == 2 || divisor == 4)
+                    config.waterResolutionDivisor = divisor;
+                else
+                    ELOG("--water-divisor must be 1, 2 or 4, got %s", argv[i]);
+            }
+            else if (arg == "--water-interval" && hasValue)
+            {
+                config.waterUpdateInterval = glm::max((u32)atoi(argv[++i]), 1u);
+            }
+            else if (arg == "--no-texture-cache")
+            {
+                config.useTextureCache = false;
+            }
+            else if (arg == "--no-texture-streaming")
+            {
+                config.useTextureStreaming = false;
+            }
+            else if (arg == "--filtering" && hasValue)
+            {
+                std::string filtering = argv[++i];
+                if (filtering == "bilinear") config.textureFiltering = TextureFiltering_Bilinear;
+                else if (filtering == "trilinear") config.textureFiltering = TextureFiltering_Trilinear;
+                else if (filtering == "anisotropic") config.textureFiltering = TextureFiltering_Anisotropic;
+                else ELOG("--filtering must be bilinear, trilinear or anisotropic, got %s", filtering.c_str());
+            }
+            else if (arg == "--material-arrays" && hasValue)
+            {
+                u32 arrays = (u32)atoi(argv[++i]);
+                if (arrays >= 1 && arrays <= MATERIAL_TABLE_MAX_ARRAYS)
+                    config.materialArrays = arrays;
+                else
+                    ELOG("--material-arrays must be between 1 and %u, got %s", MATERIAL_TABLE_MAX_ARRAYS, argv[i]);
+            }
+            else if (arg == "--validate-materials")
+            {
+                config.validateMaterials = true;
+            }
+            else
+            {
+                ELOG("Unknown command line argument %s", arg.c_str());
+            }
+        }
+
+        return config;
+    }
+
+    void ApplyCameraPath(App* app, u32 frame, u32 frameCount)
+    {
+        const vec3 target = vec3(0.0f, -1.0f, 0.0f);
+        const float radius = 8.0f;
+
+        float t = frameCount > 0 ? (float)frame / (float)frameCount : 0.0f;
+        float angle = t * TAU;
+
+        vec3 position;
+        position.x = target.x + cos(angle) * radius;
+        position.z = target.z + sin(angle) * radius;
+        position.y = 2.0f + sin(angle * 2.0f) * 1.0f;
+
+        vec3 direction = glm::normalize(target - position);
+
+        app->sceneCam.cameraPos = position;
+        app->sceneCam.yaw = glm::degrees(atan2(direction.z, direction.x));
+        app->sceneCam.pitch = glm::degrees(asin(direction.y));
+        app->sceneCam.Update();
+    }
+
+    void RecordFrame(BenchmarkRun& run, const Profiler& profiler)
+    {
+        BenchmarkFrame frame = {};
+        frame.frameCpuMs = profiler.lastFrame.frameCpuMs;
+        frame.drawCalls = profiler.lastFrame.drawCalls;
+        frame.bindsSkipped = profiler.lastFrame.bindsSkipped;
+        frame.overflowClusters = profiler.lastFrame.overflowClusters;
+        for (u32 i = 0; i < ProfilerPass_Count; ++i)
+        {
+            frame.passes[i] = profiler.lastFrame.passes[i];
+        }
+        run.frames.push_back(frame);
+    }
+
+    static bool EndsWith(const std::string& str, const char* suffix)
+    {
+        size_t len = strlen(suffix);
+        return str.size() >= len && str.compare(str.size() - len, len, suffix) == 0;
+    }
+
+    static f64 Percentile(std::vector<f64> values, f64 percentile)
+    {
+        if (values.empty()) return 0.0;
+        std::sort(values.begin(), values.end());
+        size_t index = (size_t)(percentile * (values.size() - 1));
+        return values[index];
+    }
+
+    static void WriteJsonStats(FILE* file, const char* name, std::vector<f64>& values)
+    {
+        f64 sum = 0.0;
+        f64 minValue = values.empty() ? 0.0 : values[0];
+        f64 maxValue = minValue;
+        for (f64 value : values)
+        {
+            sum += value;
+            minValue = glm::min(minValue, value);
+            maxValue = glm::max(maxValue, value);
+        }
+        f64 avg = values.empty() ? 0.0 : sum / values.size();
+
+        fprintf(file, "\"%s\": { \"avg\": %.4f, \"min\": %.4f, \"max\": %.4f, \"p99\": %.4f }",
+            name, avg, minValue, maxValue, Percentile(values, 0.99));
+    }
+
+    // Every G-buffer target is written once by the geometry pass and read once by the lighting pass
+    static void WriteJsonGBuffer(FILE* file, const char* name, const BenchmarkRun& run, u32 width, u32 height)
+    {
+        const f64 pixelsMB = (f64)width * height / (1024.0 * 1024.0);
+        const f64 memoryMB = run.gBufferBytesPerPixel * pixelsMB;
+        const f64 savedMB = ((f64)run.gBufferFullBytesPerPixel - run.gBufferBytesPerPixel) * pixelsMB;
+
+        fprintf(file, "\"%s\": { \"memoryMB\": %.2f, \"savedMemoryMB\": %.2f, \"trafficMBPerFrame\": %.2f, \"savedTrafficMBPerFrame\": %.2f }",
+            name, memoryMB, savedMB, 2.0 * memoryMB, 2.0 * savedMB);
+    }
+
+    static const char* TextureFilteringNames[TextureFiltering_Count] = { "bilinear", "trilinear", "anisotropic" };
+
+    bool WriteReport(const BenchmarkRun& run)
+    {
+        FILE* file = fopen(run.config.reportPath.c_str(), "wb");
+        if (!file)
+        {
+            ELOG("Could not open benchmark report %s", run.config.reportPath.c_str());
+            return false;
+        }
+
+        if (EndsWith(run.config.reportPath, ".json"))
+        {
+            fprintf(file, "{\n  \"frames\": %u,\n  \"warmupFrames\": %u,\n", (u32)run.frames.size(), run.config.warmupFrames);
+            fprintf(file, "  \"programCache\": %s,\n  \"initMs\": %.4f,\n  \"programLoadMs\": %.4f,\n  ",
+                run.config.useProgramCache ? "true" : "false", run.initMs, run.programLoadMs);
+            fprintf(file, "\"gpuCulling\": %s,\n  \"extraLights\": %u,\n  \"lightVolumes\": %s,\n  ",
+                run.config.useGpuCulling ? "true" : "false", run.config.extraLights, run.config.useLightVolumes ? "true" : "false");
+            if (run.cullingValidated)
+                fprintf(file, "\"cullingMismatches\": %u,\n  ", run.cullingMismatches);
+            if (run.materialsValidated)
+                fprintf(file, "\"materials\": { \"arrays\": %u, \"placed\": %u, \"reduced\": %u, \"unplaced\": %u, \"errors\": %u },\n  ",
+                    run.config.materialArrays, run.materialReport.placed, run.materialReport.reduced, run.materialReport.unplaced, run.materialReport.errors);
+
+            fprintf(file, "\"gBuffer\": { \"compact\": %s, \"bytesPerPixel\": %u, \"fullBytesPerPixel\": %u, ",
+                run.config.useCompactGBuffer ? "true" : "false", run.gBufferBytesPerPixel, run.gBufferFullBytesPerPixel);
+            WriteJsonGBuffer(file, "1080p", run, 1920, 1080);
+            fprintf(file, ", ");
+            WriteJsonGBuffer(file, "2160p", run, 3840, 2160);
+            fprintf(file, " },\n  ");
+            fprintf(file, "\"water\": { \"divisor\": %u, \"interval\": %u },\n  ", run.config.waterResolutionDivisor, run.config.waterUpdateInterval);
+            fprintf(file, "\"textures\": { \"cache\": %s, \"streaming\": %s, \"memoryMB\": %.2f, \"filtering\": \"%s\" },\n  ",
+                run.config.useTextureCache ? "true" : "false", run.config.useTextureStreaming ? "true" : "false", run.textureMemoryBytes / (1024.0 * 1024.0),
+                TextureFilteringNames[run.config.textureFiltering]);
+
+            std::vector<f64> values;
+            for (const BenchmarkFrame& frame : run.frames) values.push_back(frame.frameCpuMs);
+            WriteJsonStats(file, "frameCpuMs", values);
+
+            values.clear();
+            for (const BenchmarkFrame& frame : run.frames) values.push_back(frame.drawCalls);
+            fprintf(file, ",\n  ");
+            WriteJsonStats(file, "drawCalls", values);
+
+            values.clear();
+            for (const BenchmarkFrame& frame : run.frames) values.push_back(frame.bindsSkipped);
+            fprintf(file, ",\n  ");
+            WriteJsonStats(file, "bindsSkipped", values);
+
+            values.clear();
+            for (const BenchmarkFrame& frame : run.frames) values.push_back(frame.overflowClusters);
+            fprintf(file, ",\n  ");
+            WriteJsonStats(file, "overflowClusters", values);
+
+            fprintf(file, ",\n  \"passes\": {\n");
+            for (u32 i = 0; i < ProfilerPass_Count; ++i)
+            {
+                std::vector<f64> cpuValues;
+                std::vector<f64> gpuValues;
+                for (const BenchmarkFrame& frame : run.frames)
+                {
+                    if (!frame.passes[i].used) continue;
+                    cpuValues.push_back(frame.passes[i].cpuMs);
+                    gpuValues.push_back(frame.passes[i].gpuMs);
+                }
+
+                fprintf(file, "    \"%s\": { ", ProfilerManager::GetPassName((ProfilerPass)i));
+                WriteJsonStats(file, "cpuMs", cpuValues);
+                fprintf(file, ", ");
+                WriteJsonStats(file, "gpuMs", gpuValues);
+                fprintf(file, " }%s\n", i + 1 < ProfilerPass_Count ? "," : "");
+            }
+            fprintf(file, "  }\n}\n");
+        }
+        else
+        {
+            fprintf(file, "# programCache=%d initMs=%.4f programLoadMs=%.4f gpuCulling=%d extraLights=%u lightVolumes=%d",
+                run.config.useProgramCache ? 1 : 0, run.initMs, run.programLoadMs, run.config.useGpuCulling ? 1 : 0, run.config.extraLights,
+                run.config.useLightVolumes ? 1 : 0);
+            fprintf(file, " compactGBuffer=%d gBufferBytesPerPixel=%u gBufferFullBytesPerPixel=%u",
+                run.config.useCompactGBuffer ? 1 : 0, run.gBufferBytesPerPixel, run.gBufferFullBytesPerPixel);
+            fprintf(file, " waterDivisor=%u waterInterval=%u", run.config.waterResolutionDivisor, run.config.waterUpdateInterval);
+            fprintf(file, " textureCache=%d textureStreaming=%d textureMemoryBytes=%llu filtering=%s", run.config.useTextureCache ? 1 : 0,
+                run.config.useTextureStreaming ? 1 : 0, run.textureMemoryBytes,
+                TextureFilteringNames[run.config.textureFiltering]);
+            if (run.cullingValidated)
+                fprintf(file, " cullingMismatches=%u", run.cullingMismatches);
+            if (run.materialsValidated)
+                fprintf(file, " materialArrays=%u materialsPlaced=%u materialsReduced=%u materialsUnplaced=%u materialErrors=%u",
+                    run.config.materialArrays, run.materialReport.placed, run.materialReport.reduced, run.materialReport.unplaced, run.materialReport.errors);
+            fprintf(file, "\n");
+            fprintf(file, "frame,frameCpuMs,drawCalls,bindsSkipped,overflowClusters");
+            for (u32 i = 0; i < ProfilerPass_Count; ++i)
+            {
+                const char* name = ProfilerManager::GetPassName((ProfilerPass)i);
+                fprintf(file, ",%sCpuMs,%sGpuMs", name, name);
+            }
+            fprintf(file, "\n");
+
+            for (u32 f = 0; f < run.frames.size(); ++f)
+            {
+                const BenchmarkFrame& frame = run.frames[f];
+                fprintf(file, "%u,%.4f,%u,%u,%u", f, frame.frameCpuMs, frame.drawCalls, frame.bindsSkipped, frame.overflowClusters);
+                for (u32 i = 0; i < ProfilerPass_Count; ++i)
+                {
+                    fprintf(file, ",%.4f,%.4f", frame.passes[i].cpuMs, frame.passes[i].gpuMs);
+                }
+                fprintf(file, "\n");
+            }
+        }
+
+        fclose(file);
+
+        ILOG("Benchmark report written to %s (%u frames)", run.config.reportPath.c_str(), (u32)run.frames.size());
+        return true;
+    }
+}
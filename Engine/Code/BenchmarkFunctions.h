@@ -0,0 +1,83 @@
+#ifndef BENCHMARK_FUNC
+#define BENCHMARK_FUNC
+
+#include "Globals.h"
+#include "ProfilerFunctions.h"
+#include "MaterialTableFunctions.h"
+
+struct App;
+
+struct BenchmarkConfig
+{
+    bool        headless = false;
+    u32         frameCount = 600;
+    u32         warmupFrames = 30;
+    std::string reportPath = "benchmark.csv";
+    bool        useProgramCache = true;
+    bool        useGpuCulling = false;
+    bool        validateCulling = false; // compare the GPU culling with the CPU reference after the run
+    u32         extraLights = 0;         // random point lights added to the scene
+    bool        useLightVolumes = false; // deferred lighting with light volumes instead of the full screen pass
+    bool        useCompactGBuffer = false;
+    u32         waterResolutionDivisor = 1;  // 1, 2 or 4
+    u32         waterUpdateInterval = 1;     // refresh the water targets every N frames
+    bool        useTextureCache = true;      // block compressed textures from their .dds files
+    bool        useTextureStreaming = true;  // mips by screen footprint, needs the texture cache
+    TextureFiltering textureFiltering = TextureFiltering_Anisotropic;
+    u32         materialArrays = MATERIAL_TABLE_MAX_ARRAYS; // fewer to run the material table out of arrays
+    bool        validateMaterials = false;   // check the material table layers after the run
+};
+
+struct BenchmarkFrame
+{
+    f64        frameCpuMs;
+    u32        drawCalls;
+    u32        bindsSkipped;
+    u32        overflowClusters;
+    PassTiming passes[ProfilerPass_Count];
+};
+
+struct BenchmarkRun
+{
+    BenchmarkConfig             config;
+    std::vector<BenchmarkFrame> frames;
+
+    // Startup cost, to compare cold (--no-program-cache) and warm runs
+    f64                         initMs;
+    f64                         programLoadMs;
+
+    // Mismatches between the GPU culling and its CPU reference, when validated
+    bool                        cullingValidated;
+    u32                         cullingMismatches;
+
+    // Size of a G-buffer pixel (App::GetGBufferBytesPerPixel) of the run and of the full layout,
+    // scaled to 1080p and 4K in the report
+    u32                         gBufferBytesPerPixel;
+    u32                         gBufferFullBytesPerPixel;
+
+    // Material textures, material arrays and skybox at the end of the run (App::GetTextureMemoryBytes)
+    u64                         textureMemoryBytes;
+
+    // Material table placement at the end of the run, when validated
+    bool                        materialsValidated;
+    MaterialTableReport         materialReport;
+};
+
+namespace Benchmark
+{
+    // Parses --headless, --frames N, --warmup N, --report path, --no-program-cache, --gpu-culling, --validate-culling,
+    // --lights N, --light-volumes, --compact-gbuffer, --water-divisor N, --water-interval N, --no-texture-cache,
+    // --no-texture-streaming, --filtering bilinear|trilinear|anisotropic, --material-arrays N and --validate-materials.
+    BenchmarkConfig ParseCommandLine(int argc, char** argv);
+
+    // Places the scene camera along a deterministic orbit around the scene.
+    void ApplyCameraPath(App* app, u32 frame, u32 frameCount);
+
+    // Stores the last frame resolved by the profiler (call ProfilerManager::Flush() first).
+    void RecordFrame(BenchmarkRun& run, const Profiler& profiler);
+
+    // Writes a CSV with a row per frame or, if the path ends with .json, a JSON summary per pass.
+    bool WriteReport(const BenchmarkRun& run);
+}
+
+#endif // !BENCHMARK_FUNC
@@ -0,0 +1,152 @@
+#include "BlockCompressionFunctions.h"
+
+namespace BlockCompression
+{
+    static u16 PackRgb565(const vec3& color)
+    {
+        u32 r = (u32)glm::clamp(roundf(color.r * 31.0f / 255.0f), 0.0f, 31.0f);
+        u32 g = (u32)glm::clamp(roundf(color.g * 63.0f / 255.0f), 0.0f, 63.0f);
+        u32 b = (u32)glm::clamp(roundf(color.b * 31.0f / 255.0f), 0.0f, 31.0f);
+        return (u16)((r << 11) | (g << 5) | b);
+    }
+
+    // Same bit replication as the decoders
+    static vec3 UnpackRgb565(u16 color)
+    {
+        u32 r = (color >> 11) & 31;
+        u32 g = (color >> 5) & 63;
+        u32 b = color & 31;
+        return vec3((f32)((r << 3) | (r >> 2)), (f32)((g << 2) | (g >> 4)), (f32)((b << 3) | (b >> 2)));
+    }
+
+    static void WriteLittleEndian(u8* dst, u64 value, u32 bytes)
+    {
+        for (u32 i = 0; i < bytes; ++i)
+        {
+            dst[i] = (u8)(value >> (8 * i));
+        }
+    }
+
+    void EncodeBC1(const u8 texels[16][4], u8* block)
+    {
+        vec3 colors[16];
+        vec3 mean = vec3(0.0f);
+        for (u32 i = 0; i < 16; ++i)
+        {
+            colors[i] = vec3(texels[i][0], texels[i][1], texels[i][2]);
+            mean += colors[i];
+        }
+        mean /= 16.0f;
+
+        // Covariance of the colors, its main eigenvector by power iteration is the fitting axis
+        f32 xx = 0.0f, xy = 0.0f, xz = 0.0f, yy = 0.0f, yz = 0.0f, zz = 0.0f;
+        for (u32 i = 0; i < 16; ++i)
+        {
+            vec3 d = colors[i] - mean;
+            xx += d.x * d.x; xy += d.x * d.y; xz += d.x * d.z;
+            yy += d.y * d.y; yz += d.y * d.z; zz += d.z * d.z;
+        }
+
+        vec3 axis = vec3(1.0f);
+        for (u32 iteration = 0; iteration < 8; ++iteration)
+        {
+            axis = vec3(xx * axis.x + xy * axis.y + xz * axis.z,
+                        xy * axis.x + yy * axis.y + yz * axis.z,
+                        xz * axis.x + yz * axis.y + zz * axis.z);
+            f32 length = glm::length(axis);
+            if (length < 1e-6f)
+            {
+                axis = vec3(0.0f);
+                break;
+            }
+            axis /= length;
+        }
+
+        f32 minT = FLT_MAX;
+        f32 maxT = -FLT_MAX;
+        for (u32 i = 0; i < 16; ++i)
+        {
+            f32 t = glm::dot(colors[i] - mean, axis);
+            minT = glm::min(minT, t);
+            maxT = glm::max(maxT, t);
+        }
+
+        // Pulled in a bit, the extremes are rarely worth a palette entry of their own
+        f32 inset = (maxT - minT) / 16.0f;
+        u16 endpoint0 = PackRgb565(glm::clamp(mean + axis * (maxT - inset), 0.0f, 255.0f));
+        u16 endpoint1 = PackRgb565(glm::clamp(mean + axis * (minT + inset), 0.0f, 255.0f));
+
+        // endpoint0 > endpoint1 selects the 4 color mode
+        if (endpoint0 < endpoint1) std::swap(endpoint0, endpoint1);
+
+        u32 indices = 0;
+        if (endpoint0 != endpoint1)
+        {
+            vec3 palette[4];
+            palette[0] = UnpackRgb565(endpoint0);
+            palette[1] = UnpackRgb565(endpoint1);
+            palette[2] = (2.0f * palette[0] + palette[1]) / 3.0f;
+            palette[3] = (palette[0] + 2.0f * palette[1]) / 3.0f;
+
+            for (u32 i = 0; i < 16; ++i)
+            {
+                u32 best = 0;
+                f32 bestDistance = FLT_MAX;
+                for (u32 p = 0; p < 4; ++p)
+                {
+                    vec3 d = colors[i] - palette[p];
+                    f32 distance = glm::dot(d, d);
+                    if (distance < bestDistance)
+                    {
+                        bestDistance = distance;
+                        best = p;
+                    }
+                }
+                indices |= best << (2 * i);
+            }
+        }
+
+        WriteLittleEndian(block, endpoint0, 2);
+        WriteLittleEndian(block + 2, endpoint1, 2);
+        WriteLittleEndian(block + 4, indices, 4);
+    }
+
+    void EncodeBC3(const u8 texels[16][4], u8* block)
+    {
+        EncodeBC4(texels, 3, block);
+        EncodeBC1(texels, block + BC4_BLOCK_BYTES);
+    }
+
+    void EncodeBC4(const u8 texels[16][4], u32 channel, u8* block)
+    {
+        u8 minValue = 255;
+        u8 maxValue = 0;
+        for (u32 i = 0; i < 16; ++i)
+        {
+            minValue = glm::min(minValue, texels[i][channel]);
+            maxValue = glm::max(maxValue, texels[i][channel]);
+        }
+
+        // max > min selects the 8 value mode: 0 is max, 1 is min and 2..7 go from max to min
+        u64 indices = 0;
+        if (maxValue > minValue)
+        {
+            for (u32 i = 0; i < 16; ++i)
+            {
+                u32 step = (u32)((texels[i][channel] - minValue) * 7.0f / (maxValue - minValue) + 0.5f);
+                u64 index = step == 7 ? 0 : (step == 0 ? 1 : 8 - step);
+                indices |= index << (3 * i);
+            }
+        }
+
+        block[0] = maxValue;
+        block[1] = minValue;
+        WriteLittleEndian(block + 2, indices, 6);
+    }
+
+    void EncodeBC5(const u8 texels[16][4], u8* block)
+    {
+        EncodeBC4(texels, 0, block);
+        EncodeBC4(texels, 1, block + BC4_BLOCK_BYTES);
+    }
+}
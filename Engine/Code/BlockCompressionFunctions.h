@@ -0,0 +1,33 @@
+#ifndef BLOCK_COMPRESSION_FUNC
+#define BLOCK_COMPRESSION_FUNC
+
+#include "Globals.h"
+
+//
+// CPU encoders for the BC formats the texture cook writes. Every function takes the
+// 4x4 texels of a block as RGBA8, row by row, and writes the encoded block.
+// Endpoints come from a range fit along the principal axis of the block colors,
+// which is far from a production encoder but good enough for albedo and normal maps.
+//
+
+#define BC1_BLOCK_BYTES 8
+#define BC3_BLOCK_BYTES 16
+#define BC4_BLOCK_BYTES 8
+#define BC5_BLOCK_BYTES 16
+
+namespace BlockCompression
+{
+    // Opaque RGB, the alpha is ignored
+    void EncodeBC1(const u8 texels[16][4], u8* block);
+
+    // RGB as BC1 plus the alpha as BC4
+    void EncodeBC3(const u8 texels[16][4], u8* block);
+
+    // One channel of the texels
+    void EncodeBC4(const u8 texels[16][4], u32 channel, u8* block);
+
+    // Red and green as two BC4 blocks, for tangent space normals
+    void EncodeBC5(const u8 texels[16][4], u8* block);
+}
+
+#endif // !BLOCK_COMPRESSION_FUNC
@@ -1,5 +1,9 @@
+#include "platform.h"
 #include "BufferSuppFunctions.h"
 
+// glad is generated for GL 4.3, glBufferStorage is fetched at runtime
+typedef void (APIENTRYP PFNBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
 namespace BufferManager
 {
     bool IsPowerOf2(u32 value)
@@ -34,13 +38,30 @@ namespace BufferManager
     void MapBuffer(Buffer& buffer, GLenum access)
     {
         glBindBuffer(buffer.type, buffer.handle);
+
+        if (buffer.isRing)
+        {
+            // Keep appending after the previous passes of this frame
+            if (!buffer.persistent)
+            {
+                u32 regionEnd = (buffer.regionIndex + 1) * buffer.regionSize;
+                u8* region = (u8*)glMapBufferRange(buffer.type, buffer.head, regionEnd - buffer.head,
+                    GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+                buffer.data = region - buffer.head;
+            }
+            return;
+        }
+
         buffer.data = (u8*)glMapBuffer(buffer.type, access);
         buffer.head = 0;
     }
 
     void UnmapBuffer(Buffer& buffer)
     {
-        glUnmapBuffer(buffer.type);
+        if (!buffer.isRing || !buffer.persistent)
+        {
+            glUnmapBuffer(buffer.type);
+        }
         glBindBuffer(buffer.type, 0);
     }
 
@@ -54,7 +75,117 @@ namespace BufferManager
     {
         ASSERT(buffer.data != NULL, "The buffer must be mapped first");
         AlignHead(buffer, alignment);
+
+        // Checked in every build, writing past the end would land in the region of another frame or outside the mapping
+        u32 end = buffer.isRing ? (buffer.regionIndex + 1) * buffer.regionSize : (u32)buffer.size;
+        if (buffer.head + size > end)
+        {
+            if (buffer.overflows++ == 0)
+                ELOG("Buffer overflow: %u bytes pushed at %u past the end at %u, the data is dropped", size, buffer.head, end);
+            ASSERT(false, "Buffer overflow");
+            return;
+        }
+
         memcpy((u8*)buffer.data + buffer.head, data, size);
         buffer.head += size;
     }
+
+    static PFNBUFFERSTORAGEPROC LoadBufferStorage()
+    {
+        GLint major = 0, minor = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &major);
+        glGetIntegerv(GL_MINOR_VERSION, &minor);
+
+        bool supported = major > 4 || (major == 4 && minor >= 4) || glfwExtensionSupported("GL_ARB_buffer_storage");
+        return supported ? (PFNBUFFERSTORAGEPROC)glfwGetProcAddress("glBufferStorage") : NULL;
+    }
+
+    Buffer CreateRingBuffer(u32 regionSize, u32 regionCount, GLenum type)
+    {
+        ASSERT(regionCount <= MAX_RING_REGIONS, "Too many ring buffer regions");
+
+        Buffer buffer = {};
+        buffer.size = regionSize * regionCount;
+        buffer.type = type;
+        buffer.isRing = true;
+        buffer.regionSize = regionSize;
+        buffer.regionCount = regionCount;
+        buffer.regionIndex = regionCount - 1;
+
+        glGenBuffers(1, &buffer.handle);
+        glBindBuffer(type, buffer.handle);
+
+        static PFNBUFFERSTORAGEPROC bufferStorage = LoadBufferStorage();
+        if (bufferStorage)
+        {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            bufferStorage(type, buffer.size, NULL, flags);
+            buffer.data = (u8*)glMapBufferRange(type, 0, buffer.size, flags);
+            buffer.persistent = buffer.data != NULL;
+        }
+        if (!buffer.persistent)
+        {
+            ILOG("glBufferStorage not available, the ring buffer maps each region unsynchronized");
+            glBufferData(type, buffer.size, NULL, GL_STREAM_DRAW);
+        }
+
+        glBindBuffer(type, 0);
+
+        return buffer;
+    }
+
+    void BeginRingFrame(Buffer& buffer)
+    {
+        ASSERT(buffer.isRing, "Not a ring buffer");
+
+        buffer.regionIndex = (buffer.regionIndex + 1) % buffer.regionCount;
+        buffer.head = buffer.regionIndex * buffer.regionSize;
+
+        GLsync& fence = buffer.regionFences[buffer.regionIndex];
+        if (fence)
+        {
+            if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+            {
+                // The GPU is still reading this region from UNIFORM_RING_FRAMES frames ago
+                buffer.stalls++;
+                while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+            }
+            glDeleteSync(fence);
+            fence = 0;
+        }
+    }
+
+    void EndRingFrame(Buffer& buffer)
+    {
+        ASSERT(buffer.isRing, "Not a ring buffer");
+
+        buffer.regionFences[buffer.regionIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    Buffer CreatePersistentBuffer(u32 size, GLenum type)
+    {
+        Buffer buffer = {};
+        buffer.size = size;
+        buffer.type = type;
+
+        glGenBuffers(1, &buffer.handle);
+        glBindBuffer(type, buffer.handle);
+
+        static PFNBUFFERSTORAGEPROC bufferStorage = LoadBufferStorage();
+        if (bufferStorage)
+        {
+            GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            bufferStorage(type, buffer.size, NULL, flags);
+            buffer.data = (u8*)glMapBufferRange(type, 0, buffer.size, flags);
+            buffer.persistent = buffer.data != NULL;
+        }
+        if (!buffer.persistent)
+        {
+            glBufferData(type, buffer.size, NULL, GL_DYNAMIC_DRAW);
+        }
+
+        glBindBuffer(type, 0);
+
+        return buffer;
+    }
 }
@@ -3,9 +3,22 @@
 
 #include "Globals.h"
 
+// glad is generated for GL 4.3, the GL 4.4 buffer storage enums are defined here
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT   0x0080
+#endif
+#ifndef GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT
+#define GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT 0x00004000
+#endif
+
 #define CreateConstantBuffer(size) BufferManager::CreateBuffer(size, GL_UNIFORM_BUFFER, GL_STREAM_DRAW)
 #define CreateStaticVertexBuffer(size) BufferManager::CreateBuffer(size, GL_ARRAY_BUFFER, GL_STATIC_DRAW)
 #define CreateStaticIndexBuffer(size) BufferManager::CreateBuffer(size, GL_ELEMENT_ARRAY_BUFFER, GL_STATIC_DRAW)
+#define CreateUniformRingBuffer(regionSize) BufferManager::CreateRingBuffer(regionSize, UNIFORM_RING_FRAMES, GL_UNIFORM_BUFFER)
+
+// Frames the CPU can write ahead of the GPU in a ring buffer
+#define UNIFORM_RING_FRAMES 3
 
 #define PushData(buffer, data, size) BufferManager::PushAlignedData(buffer, data, size, 1)
 #define PushUInt(buffer, value) { u32 v = value; BufferManager::PushAlignedData(buffer, &v, sizeof(v), 4); }
@@ -35,6 +48,22 @@ namespace BufferManager
 
     void PushAlignedData(Buffer& buffer, const void* data, u32 size, u32 alignment);
 
+    // Buffer split in regionCount regions of regionSize bytes, each frame writes into the next one.
+    // It is mapped persistently with glBufferStorage when the driver has it (GL 4.4 or
+    // ARB_buffer_storage), otherwise every MapBuffer() maps the region unsynchronized.
+    // Either way, fences make sure the GPU is done with a region before it is reused.
+    Buffer CreateRingBuffer(u32 regionSize, u32 regionCount, GLenum type);
+
+    // Waits for the next region (counting a stall if the GPU still uses it) and moves the head there
+    void BeginRingFrame(Buffer& buffer);
+
+    // Fences the region written this frame
+    void EndRingFrame(Buffer& buffer);
+
+    // Buffer mapped once for reading and writing, coherent with the GPU, for small results the CPU
+    // reads back frames later. Without glBufferStorage it is a plain buffer with persistent == false.
+    Buffer CreatePersistentBuffer(u32 size, GLenum type);
+
 }
 
 #endif // !BUFFER_MANAGER_FUNC
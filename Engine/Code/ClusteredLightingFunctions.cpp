@@ -0,0 +1,119 @@
+#include "engine.h"
+#include "ClusteredLightingFunctions.h"
+
+namespace ClusteredLighting
+{
+    void Init(LightClusters& clusters, u32 programIdx)
+    {
+        clusters.programIdx = programIdx;
+
+        // Only written and read by the GPU
+        glGenBuffers(1, &clusters.lightCountBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, clusters.lightCountBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, CLUSTER_COUNT * sizeof(u32), NULL, GL_DYNAMIC_COPY);
+
+        glGenBuffers(1, &clusters.lightIndexBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, clusters.lightIndexBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, CLUSTER_COUNT * CLUSTER_MAX_LIGHTS * sizeof(u32), NULL, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        const u32 countersSize = CLUSTER_COUNTER_FRAMES * sizeof(u32);
+        clusters.overflowCounters = BufferManager::CreatePersistentBuffer(countersSize, GL_SHADER_STORAGE_BUFFER);
+        if (clusters.overflowCounters.persistent)
+            memset(clusters.overflowCounters.data, 0, countersSize);
+        else
+            ILOG("Clustered lighting: glBufferStorage not available, the overflowing clusters are not read back");
+    }
+
+    f32 ComputeLightRadius(const Light& light)
+    {
+        if (light.type == LightType_Directional) return FLT_MAX;
+
+        // Solve constant + linear * d + quadratic * d^2 = intensity / LIGHT_CUTOFF
+        f32 intensity = glm::max(light.color.r, glm::max(light.color.g, light.color.b));
+        f32 target = intensity / LIGHT_CUTOFF;
+        if (light.quadratic > 0.0f)
+        {
+            f32 discriminant = light.linear * light.linear - 4.0f * light.quadratic * (light.constant - target);
+            return (-light.linear + sqrtf(glm::max(discriminant, 0.0f))) / (2.0f * light.quadratic);
+        }
+        if (light.linear > 0.0f)
+        {
+            return glm::max(target - light.constant, 0.0f) / light.linear;
+        }
+        return FLT_MAX;
+    }
+
+    void PushClusterParams(Buffer& buffer, const glm::mat4& view, const glm::mat4& projection)
+    {
+        // Exponential slices: slice = log(depth) * scale - bias
+        f32 logDepthRange = logf(CAMERA_Z_FAR / CAMERA_Z_NEAR);
+        vec4 clusterDepth = vec4(CAMERA_Z_NEAR, CAMERA_Z_FAR,
+            CLUSTER_GRID_Z / logDepthRange,
+            CLUSTER_GRID_Z * logf(CAMERA_Z_NEAR) / logDepthRange);
+        glm::uvec4 clusterGrid = glm::uvec4(CLUSTER_GRID_X, CLUSTER_GRID_Y, CLUSTER_GRID_Z, CLUSTER_MAX_LIGHTS);
+
+        PushMat4(buffer, view);
+        PushMat4(buffer, projection * view);
+        PushVec4(buffer, clusterGrid);
+        PushVec4(buffer, clusterDepth);
+    }
+
+    void PushLights(Buffer& buffer, const std::vector<Light>& lights)
+    {
+        for (const Light& light : lights)
+        {
+            GpuLight gpuLight = {};
+            gpuLight.position = vec4(light.position, ComputeLightRadius(light));
+            gpuLight.color = vec4(light.color, 1.0f);
+            gpuLight.direction = vec4(light.direction, 0.0f);
+            gpuLight.attenuation = vec3(light.constant, light.linear, light.quadratic);
+            gpuLight.type = light.type;
+            PushData(buffer, &gpuLight, sizeof(gpuLight));
+        }
+    }
+
+    void Build(App& app, LightClusters& clusters, const glm::mat4& projection, u32 frameSlot)
+    {
+        ASSERT(frameSlot < CLUSTER_COUNTER_FRAMES, "Not enough cluster counters for the frames in flight");
+
+        // The GPU is done with this slot, read its count and reset it for this frame
+        if (clusters.overflowCounters.persistent)
+        {
+            u32* counter = (u32*)clusters.overflowCounters.data + frameSlot;
+            clusters.overflowClusters = *counter;
+            *counter = 0;
+        }
+        else
+        {
+            const u32 zero = 0;
+            glBindBuffer(GL_COPY_WRITE_BUFFER, clusters.overflowCounters.handle);
+            glClearBufferSubData(GL_COPY_WRITE_BUFFER, GL_R32UI, frameSlot * sizeof(u32), sizeof(u32), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        }
+        ProfilerManager::AddClusterStats(app.profiler, clusters.overflowClusters);
+
+        const Program& program = app.programs[clusters.programIdx];
+        glUseProgram(program.handle);
+        glUniformMatrix4fv(program.uniformLocations[Uniform_InverseProjection], 1, GL_FALSE, glm::value_ptr(glm::inverse(projection)));
+        glUniform1ui(program.uniformLocations[Uniform_CounterIndex], frameSlot);
+
+        glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app.localUniformBuffer.handle, app.globalParamsOffset, app.globalParamsSize);
+        Bind(app, clusters);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(7), clusters.overflowCounters.handle);
+
+        glDispatchCompute((CLUSTER_COUNT + CLUSTER_GROUP_SIZE - 1) / CLUSTER_GROUP_SIZE, 1, 1);
+
+        // The counter is read through the mapping once the fence of this frame signals
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+
+        glUseProgram(0);
+    }
+
+    void Bind(const App& app, const LightClusters& clusters)
+    {
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, BINDING(4), app.localUniformBuffer.handle, app.lightsOffset, app.lightsSize);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(5), clusters.lightCountBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(6), clusters.lightIndexBuffer);
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef CLUSTERED_LIGHTING_FUNC
+#define CLUSTERED_LIGHTING_FUNC
+
+#include "Globals.h"
+
+//
+// Clustered lighting: the main view frustum is split in a 3D grid (screen tiles times
+// exponential depth slices) and a compute pass lists the lights reaching each cluster,
+// using the radius where their attenuation falls under LIGHT_CUTOFF. The lighting
+// shaders only loop over the list of the cluster holding the shaded position.
+//
+
+#define CLUSTER_GRID_X     16
+#define CLUSTER_GRID_Y     9
+#define CLUSTER_GRID_Z     24
+#define CLUSTER_COUNT      (CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z)
+#define CLUSTER_MAX_LIGHTS 128
+
+// Matches local_size in CLUSTERED_LIGHTS.glsl
+#define CLUSTER_GROUP_SIZE 64
+
+// Frames the overflow counters are kept before being read back (matches the uniform ring, whose
+// fences tell when the GPU is done with a slot)
+#define CLUSTER_COUNTER_FRAMES 3
+
+// Intensity (of the brightest channel) under which a point light is considered out of range
+#define LIGHT_CUTOFF (5.0f / 256.0f)
+
+// std430 layout of the Lights buffer
+struct GpuLight
+{
+    vec4 position;    // w: radius
+    vec4 color;
+    vec4 direction;
+    vec3 attenuation; // constant, linear, quadratic
+    u32  type;
+};
+
+struct LightClusters
+{
+    u32    programIdx;
+    GLuint lightCountBuffer;  // lights per cluster
+    GLuint lightIndexBuffer;  // CLUSTER_MAX_LIGHTS light indices per cluster
+    Buffer overflowCounters;  // [CLUSTER_COUNTER_FRAMES] clusters with lights left out, persistently mapped
+    u32    overflowClusters;  // read back CLUSTER_COUNTER_FRAMES frames late
+};
+
+struct App;
+
+namespace ClusteredLighting
+{
+    void Init(LightClusters& clusters, u32 programIdx);
+
+    // Distance at which the attenuation of a point light falls under LIGHT_CUTOFF
+    f32 ComputeLightRadius(const Light& light);
+
+    // Cluster constants of the GlobalParams block: view, viewProjection, grid and depth slicing
+    void PushClusterParams(Buffer& buffer, const glm::mat4& view, const glm::mat4& projection);
+
+    void PushLights(Buffer& buffer, const std::vector<Light>& lights);
+
+    // Bins the lights pushed this frame (app.lightsOffset) into the clusters of the main view. Clusters
+    // reached by more than CLUSTER_MAX_LIGHTS lights keep the first ones and are counted in the
+    // counters of frameSlot, which must not be in use by the GPU.
+    void Build(App& app, LightClusters& clusters, const glm::mat4& projection, u32 frameSlot);
+
+    // Binds the lights and the cluster lists for the lighting shaders
+    void Bind(const App& app, const LightClusters& clusters);
+}
+
+#endif // !CLUSTERED_LIGHTING_FUNC
@@ -0,0 +1,180 @@
+#include "CullingFunctions.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#define CULLING_SSE
+#include <xmmintrin.h>
+#endif
+
+namespace Culling
+{
+    Frustum ExtractFrustum(const glm::mat4& viewProjection)
+    {
+        // glm is column major, m[c][r]
+        const glm::mat4& m = viewProjection;
+        vec4 row0 = vec4(m[0][0], m[1][0], m[2][0], m[3][0]);
+        vec4 row1 = vec4(m[0][1], m[1][1], m[2][1], m[3][1]);
+        vec4 row2 = vec4(m[0][2], m[1][2], m[2][2], m[3][2]);
+        vec4 row3 = vec4(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+        Frustum frustum;
+        frustum.planes[0] = row3 + row0; // left
+        frustum.planes[1] = row3 - row0; // right
+        frustum.planes[2] = row3 + row1; // bottom
+        frustum.planes[3] = row3 - row1; // top
+        frustum.planes[4] = row3 + row2; // near
+        frustum.planes[5] = row3 - row2; // far
+
+        for (vec4& plane : frustum.planes)
+        {
+            plane /= glm::length(vec3(plane));
+        }
+        return frustum;
+    }
+
+    void TransformAabb(const glm::mat4& matrix, const vec3& aabbMin, const vec3& aabbMax, vec3& outMin, vec3& outMax)
+    {
+        vec3 center = (aabbMin + aabbMax) * 0.5f;
+        vec3 extents = (aabbMax - aabbMin) * 0.5f;
+
+        vec3 worldCenter = vec3(matrix * vec4(center, 1.0f));
+        vec3 worldExtents;
+        for (int r = 0; r < 3; ++r)
+        {
+            worldExtents[r] = fabsf(matrix[0][r]) * extents.x + fabsf(matrix[1][r]) * extents.y + fabsf(matrix[2][r]) * extents.z;
+        }
+
+        outMin = worldCenter - worldExtents;
+        outMax = worldCenter + worldExtents;
+    }
+
+    void LimitDistance(Frustum& frustum, const vec3& cameraPos, const vec3& cameraFront, f32 distance)
+    {
+        vec3 normal = -glm::normalize(cameraFront);
+        vec4 plane = vec4(normal, distance - glm::dot(normal, cameraPos));
+
+        // Both planes face the camera, compare their distance to it
+        if (glm::dot(vec3(frustum.planes[5]), cameraPos) + frustum.planes[5].w > distance)
+            frustum.planes[5] = plane;
+    }
+
+    void ReplaceNearPlane(Frustum& frustum, const vec4& plane)
+    {
+        frustum.planes[4] = plane;
+    }
+
+    void ClipToRect(Frustum& frustum, const glm::mat4& viewProjection, const vec4& ndcRect)
+    {
+        const glm::mat4& m = viewProjection;
+        vec4 row0 = vec4(m[0][0], m[1][0], m[2][0], m[3][0]);
+        vec4 row1 = vec4(m[0][1], m[1][1], m[2][1], m[3][1]);
+        vec4 row3 = vec4(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+        // x >= a * w instead of x >= -w, and so on
+        frustum.planes[0] = row0 - ndcRect.x * row3;
+        frustum.planes[1] = ndcRect.z * row3 - row0;
+        frustum.planes[2] = row1 - ndcRect.y * row3;
+        frustum.planes[3] = ndcRect.w * row3 - row1;
+
+        for (u32 i = 0; i < 4; ++i)
+        {
+            frustum.planes[i] /= glm::length(vec3(frustum.planes[i]));
+        }
+    }
+
+    bool IsAabbVisible(const Frustum& frustum, const vec3& aabbMin, const vec3& aabbMax)
+    {
+        vec3 center = (aabbMin + aabbMax) * 0.5f;
+        vec3 extents = (aabbMax - aabbMin) * 0.5f;
+        for (const vec4& plane : frustum.planes)
+        {
+            f32 distance = glm::dot(vec3(plane), center) + plane.w;
+            f32 radius = glm::dot(glm::abs(vec3(plane)), extents);
+            if (distance + radius < 0.0f) return false;
+        }
+        return true;
+    }
+
+    void ResizeBounds(CullingBounds& bounds, u32 count)
+    {
+        u32 paddedCount = (count + 3) & ~3u;
+        bounds.centerX.assign(paddedCount, 0.0f);
+        bounds.centerY.assign(paddedCount, 0.0f);
+        bounds.centerZ.assign(paddedCount, 0.0f);
+        bounds.extentX.assign(paddedCount, 0.0f);
+        bounds.extentY.assign(paddedCount, 0.0f);
+        bounds.extentZ.assign(paddedCount, 0.0f);
+        bounds.count = count;
+    }
+
+    void SetBounds(CullingBounds& bounds, u32 index, const vec3& aabbMin, const vec3& aabbMax)
+    {
+        vec3 center = (aabbMin + aabbMax) * 0.5f;
+        vec3 extents = (aabbMax - aabbMin) * 0.5f;
+        bounds.centerX[index] = center.x;
+        bounds.centerY[index] = center.y;
+        bounds.centerZ[index] = center.z;
+        bounds.extentX[index] = extents.x;
+        bounds.extentY[index] = extents.y;
+        bounds.extentZ[index] = extents.z;
+    }
+
+    u32 CullAabbs(const Frustum& frustum, const CullingBounds& bounds, std::vector<u8>& visibility)
+    {
+        visibility.resize(bounds.centerX.size());
+        u32 visibleCount = 0;
+
+#ifdef CULLING_SSE
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 signMask = _mm_set1_ps(-0.0f);
+
+        for (u32 i = 0; i < bounds.centerX.size(); i += 4)
+        {
+            __m128 cx = _mm_loadu_ps(&bounds.centerX[i]);
+            __m128 cy = _mm_loadu_ps(&bounds.centerY[i]);
+            __m128 cz = _mm_loadu_ps(&bounds.centerZ[i]);
+            __m128 ex = _mm_loadu_ps(&bounds.extentX[i]);
+            __m128 ey = _mm_loadu_ps(&bounds.extentY[i]);
+            __m128 ez = _mm_loadu_ps(&bounds.extentZ[i]);
+
+            __m128 inside = _mm_cmpeq_ps(zero, zero);
+            for (const vec4& plane : frustum.planes)
+            {
+                __m128 nx = _mm_set1_ps(plane.x);
+                __m128 ny = _mm_set1_ps(plane.y);
+                __m128 nz = _mm_set1_ps(plane.z);
+
+                // Signed distance of the center plus the projected radius of the box on the normal
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)), _mm_add_ps(_mm_mul_ps(nz, cz), _mm_set1_ps(plane.w)));
+                __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask, nx), ex), _mm_mul_ps(_mm_andnot_ps(signMask, ny), ey)), _mm_mul_ps(_mm_andnot_ps(signMask, nz), ez));
+
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), zero));
+            }
+
+            int mask = _mm_movemask_ps(inside);
+            for (u32 j = 0; j < 4; ++j)
+            {
+                visibility[i + j] = (mask >> j) & 1;
+            }
+        }
+#else
+        for (u32 i = 0; i < bounds.centerX.size(); ++i)
+        {
+            bool inside = true;
+            for (const vec4& plane : frustum.planes)
+            {
+                f32 distance = plane.x * bounds.centerX[i] + plane.y * bounds.centerY[i] + plane.z * bounds.centerZ[i] + plane.w;
+                f32 radius = fabsf(plane.x) * bounds.extentX[i] + fabsf(plane.y) * bounds.extentY[i] + fabsf(plane.z) * bounds.extentZ[i];
+                inside = inside && distance + radius >= 0.0f;
+            }
+            visibility[i] = inside ? 1 : 0;
+        }
+#endif
+
+        // The padding entries are not real boxes
+        for (u32 i = 0; i < bounds.count; ++i)
+        {
+            visibleCount += visibility[i];
+        }
+        return visibleCount;
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef CULLING_FUNC
+#define CULLING_FUNC
+
+#include "Globals.h"
+
+// Planes point inwards: a point p is inside when dot(plane.xyz, p) + plane.w >= 0 for all of them
+struct Frustum
+{
+    vec4 planes[6];
+};
+
+//
+// World space AABBs as center/extents in structure-of-arrays layout, so the frustum
+// test reads 4 boxes per SSE register. The arrays are padded to a multiple of 4.
+//
+struct CullingBounds
+{
+    std::vector<f32> centerX, centerY, centerZ;
+    std::vector<f32> extentX, extentY, extentZ;
+    u32              count;
+};
+
+namespace Culling
+{
+    // Gribb/Hartmann plane extraction from a (projection * view) matrix
+    Frustum ExtractFrustum(const glm::mat4& viewProjection);
+
+    // Arvo's method: the AABB enclosing the transformed box
+    void TransformAabb(const glm::mat4& matrix, const vec3& aabbMin, const vec3& aabbMax, vec3& outMin, vec3& outMax);
+
+    // Moves the far plane to a distance from the camera (only if that brings it closer)
+    void LimitDistance(Frustum& frustum, const vec3& cameraPos, const vec3& cameraFront, f32 distance);
+
+    // Replaces the near plane with a clipping plane (normalized, pointing to the kept side). The side
+    // planes meet at the camera and already reject what is behind it, so the near plane only adds a sliver.
+    void ReplaceNearPlane(Frustum& frustum, const vec4& plane);
+
+    // Moves the side planes to an NDC rectangle (min x, min y, max x, max y) of the same viewProjection
+    void ClipToRect(Frustum& frustum, const glm::mat4& viewProjection, const vec4& ndcRect);
+
+    // Scalar test of a single box, same rules as CullAabbs()
+    bool IsAabbVisible(const Frustum& frustum, const vec3& aabbMin, const vec3& aabbMax);
+
+    void ResizeBounds(CullingBounds& bounds, u32 count);
+
+    void SetBounds(CullingBounds& bounds, u32 index, const vec3& aabbMin, const vec3& aabbMax);
+
+    // Writes 1 in visibility[i] for the boxes that intersect the frustum and returns how many do
+    u32 CullAabbs(const Frustum& frustum, const CullingBounds& bounds, std::vector<u8>& visibility);
+}
+
+#endif // !CULLING_FUNC
@@ -0,0 +1,278 @@
+#include "platform.h"
+#include "GeometryArenaFunctions.h"
+#include "VertexFormatFunctions.h"
+
+namespace GeometryArenaManager
+{
+    // Created through GL_COPY_WRITE_BUFFER, binding GL_ELEMENT_ARRAY_BUFFER would modify the bound VAO
+    static GLuint CreateArenaBuffer(u32 capacity)
+    {
+        GLuint handle;
+        glGenBuffers(1, &handle);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, handle);
+        glBufferData(GL_COPY_WRITE_BUFFER, capacity, NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return handle;
+    }
+
+    static void DeleteVAOs(VertexArena& vertexArena)
+    {
+        for (VAO& vao : vertexArena.vaos)
+        {
+            glDeleteVertexArrays(1, &vao.handle);
+        }
+        vertexArena.vaos.clear();
+    }
+
+    // Moves the contents to a bigger buffer. The VAOs point to the old one, so they are rebuilt lazily.
+    static void GrowBuffer(GLuint& handle, u32& capacity, u32 usedSize, u32 requiredSize)
+    {
+        u32 newCapacity = glm::max(capacity * 2, requiredSize);
+        GLuint newHandle = CreateArenaBuffer(newCapacity);
+
+        glBindBuffer(GL_COPY_READ_BUFFER, handle);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, newHandle);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, usedSize);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        glDeleteBuffers(1, &handle);
+        handle = newHandle;
+        capacity = newCapacity;
+    }
+
+    void Init(GeometryArena& arena, u32 maxInstances)
+    {
+        arena.indexCapacity = GEOMETRY_ARENA_INDEX_CAPACITY;
+        arena.indexHead = 0;
+        arena.indexBufferHandle = CreateArenaBuffer(arena.indexCapacity);
+
+        std::vector<u32> instanceIndices(maxInstances);
+        for (u32 i = 0; i < maxInstances; ++i)
+        {
+            instanceIndices[i] = i;
+        }
+
+        glGenBuffers(1, &arena.instanceIndexBufferHandle);
+        glBindBuffer(GL_ARRAY_BUFFER, arena.instanceIndexBufferHandle);
+        glBufferData(GL_ARRAY_BUFFER, maxInstances * sizeof(u32), instanceIndices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    static bool SameLayout(const VertexBufferLayout& a, const VertexBufferLayout& b)
+    {
+        if (a.stride != b.stride || a.attributes.size() != b.attributes.size()) return false;
+
+        for (u32 i = 0; i < a.attributes.size(); ++i)
+        {
+            if (a.attributes[i].location != b.attributes[i].location ||
+                a.attributes[i].componentCount != b.attributes[i].componentCount ||
+                a.attributes[i].offset != b.attributes[i].offset ||
+                a.attributes[i].type != b.attributes[i].type)
+                return false;
+        }
+        return true;
+    }
+
+    u32 FindVertexArena(GeometryArena& arena, const VertexBufferLayout& layout)
+    {
+        for (u32 i = 0; i < arena.vertexArenas.size(); ++i)
+        {
+            if (SameLayout(arena.vertexArenas[i].layout, layout))
+                return i;
+        }
+
+        VertexArena vertexArena = {};
+        vertexArena.layout = layout;
+        vertexArena.capacity = GEOMETRY_ARENA_VERTEX_CAPACITY - GEOMETRY_ARENA_VERTEX_CAPACITY % layout.stride;
+        vertexArena.bufferHandle = CreateArenaBuffer(vertexArena.capacity);
+
+        for (const VertexBufferAttribute& attribute : layout.attributes)
+        {
+            if (attribute.location != 0) continue;
+
+            vertexArena.positionAttribute = attribute;
+            vertexArena.positionAttribute.offset = 0;
+            vertexArena.positionCapacity = vertexArena.capacity / layout.stride * VertexFormat::GetAttributeSize(attribute);
+            vertexArena.positionBufferHandle = CreateArenaBuffer(vertexArena.positionCapacity);
+        }
+        arena.vertexArenas.push_back(vertexArena);
+
+        return (u32)arena.vertexArenas.size() - 1u;
+    }
+
+    u32 AllocateVertices(GeometryArena& arena, u32 vertexArenaIdx, const void* data, u32 size)
+    {
+        VertexArena& vertexArena = arena.vertexArenas[vertexArenaIdx];
+        ASSERT(size % vertexArena.layout.stride == 0, "The vertex data doesn't match the arena layout");
+
+        if (vertexArena.head + size > vertexArena.capacity)
+        {
+            GrowBuffer(vertexArena.bufferHandle, vertexArena.capacity, vertexArena.head, vertexArena.head + size);
+            DeleteVAOs(vertexArena);
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, vertexArena.bufferHandle);
+        glBufferSubData(GL_ARRAY_BUFFER, vertexArena.head, size, data);
+
+        u32 baseVertex = vertexArena.head / vertexArena.layout.stride;
+        u32 vertexCount = size / vertexArena.layout.stride;
+
+        // Same vertex indices in the position stream
+        if (vertexArena.positionBufferHandle != 0)
+        {
+            const VertexBufferLayout& layout = vertexArena.layout;
+            u32 positionSize = VertexFormat::GetAttributeSize(vertexArena.positionAttribute);
+            u32 positionOffset = 0;
+            for (const VertexBufferAttribute& attribute : layout.attributes)
+            {
+                if (attribute.location == 0) positionOffset = attribute.offset;
+            }
+
+            std::vector<u8> positions(vertexCount * positionSize);
+            for (u32 i = 0; i < vertexCount; ++i)
+            {
+                memcpy(&positions[i * positionSize], (const u8*)data + i * layout.stride + positionOffset, positionSize);
+            }
+
+            u32 positionHead = baseVertex * positionSize;
+            if (positionHead + positions.size() > vertexArena.positionCapacity)
+            {
+                GrowBuffer(vertexArena.positionBufferHandle, vertexArena.positionCapacity, positionHead, positionHead + (u32)positions.size());
+                DeleteVAOs(vertexArena);
+            }
+
+            glBindBuffer(GL_ARRAY_BUFFER, vertexArena.positionBufferHandle);
+            glBufferSubData(GL_ARRAY_BUFFER, positionHead, positions.size(), positions.data());
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        vertexArena.head += size;
+        return baseVertex;
+    }
+
+    u32 AllocateIndices(GeometryArena& arena, const void* data, u32 size)
+    {
+        if (arena.indexHead + size > arena.indexCapacity)
+        {
+            GrowBuffer(arena.indexBufferHandle, arena.indexCapacity, arena.indexHead, arena.indexHead + size);
+
+            // Every VAO captured the old index buffer
+            for (VertexArena& vertexArena : arena.vertexArenas)
+            {
+                DeleteVAOs(vertexArena);
+            }
+        }
+
+        glBindBuffer(GL_COPY_WRITE_BUFFER, arena.indexBufferHandle);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, arena.indexHead, size, data);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        u32 firstIndex = arena.indexHead / sizeof(u32);
+        arena.indexHead += size;
+        return firstIndex;
+    }
+
+    GLuint FindVAO(GeometryArena& arena, u32 vertexArenaIdx, const Program& program)
+    {
+        VertexArena& vertexArena = arena.vertexArenas[vertexArenaIdx];
+
+        for (u32 i = 0; i < (u32)vertexArena.vaos.size(); ++i)
+        {
+            if (vertexArena.vaos[i].programHandle == program.handle)
+                return vertexArena.vaos[i].handle;
+        }
+
+        auto& ShaderLayout = program.shaderLayout.attributes;
+
+        // The position stream is enough when the program reads nothing but the positions and the instance index
+        bool positionsOnly = vertexArena.positionBufferHandle != 0;
+        for (const VertexShaderAttribute& attribute : ShaderLayout)
+        {
+            if (attribute.location != 0 && attribute.location != INSTANCE_INDEX_LOCATION)
+                positionsOnly = false;
+        }
+
+        GLuint vaoHandle = 0;
+        glGenVertexArrays(1, &vaoHandle);
+        glBindVertexArray(vaoHandle);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena.indexBufferHandle);
+
+        for (auto ShaderIt = ShaderLayout.cbegin(); ShaderIt != ShaderLayout.cend(); ++ShaderIt)
+        {
+            if (ShaderIt->location == INSTANCE_INDEX_LOCATION)
+            {
+                glBindBuffer(GL_ARRAY_BUFFER, arena.instanceIndexBufferHandle);
+                glVertexAttribIPointer(INSTANCE_INDEX_LOCATION, 1, GL_UNSIGNED_INT, sizeof(u32), (void*)0);
+                glVertexAttribDivisor(INSTANCE_INDEX_LOCATION, 1);
+                glEnableVertexAttribArray(INSTANCE_INDEX_LOCATION);
+                continue;
+            }
+
+            if (positionsOnly)
+            {
+                const VertexBufferAttribute& attribute = vertexArena.positionAttribute;
+                glBindBuffer(GL_ARRAY_BUFFER, vertexArena.positionBufferHandle);
+                glVertexAttribPointer(attribute.location, attribute.componentCount, VertexFormat::GetComponentType(attribute),
+                    VertexFormat::IsNormalized(attribute), VertexFormat::GetAttributeSize(attribute), (void*)0);
+                glEnableVertexAttribArray(attribute.location);
+                continue;
+            }
+
+            bool attributeWasLinked = false;
+            glBindBuffer(GL_ARRAY_BUFFER, vertexArena.bufferHandle);
+            for (const VertexBufferAttribute& attribute : vertexArena.layout.attributes)
+            {
+                if (ShaderIt->location == attribute.location)
+                {
+                    glVertexAttribPointer(attribute.location, attribute.componentCount, VertexFormat::GetComponentType(attribute),
+                        VertexFormat::IsNormalized(attribute), vertexArena.layout.stride, (void*)(u64)attribute.offset);
+                    glEnableVertexAttribArray(attribute.location);
+
+                    attributeWasLinked = true;
+                    break;
+                }
+            }
+            assert(attributeWasLinked);
+        }
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        VAO vao = { vaoHandle, program.handle };
+        vertexArena.vaos.push_back(vao);
+
+        return vaoHandle;
+    }
+
+    u64 GetVertexBytes(const GeometryArena& arena)
+    {
+        u64 bytes = 0;
+        for (const VertexArena& vertexArena : arena.vertexArenas)
+        {
+            bytes += vertexArena.head;
+            if (vertexArena.positionBufferHandle != 0)
+                bytes += (u64)vertexArena.head / vertexArena.layout.stride * VertexFormat::GetAttributeSize(vertexArena.positionAttribute);
+        }
+        return bytes;
+    }
+
+    void InvalidateProgramVAOs(GeometryArena& arena, GLuint programHandle)
+    {
+        for (VertexArena& vertexArena : arena.vertexArenas)
+        {
+            for (u32 i = 0; i < (u32)vertexArena.vaos.size();)
+            {
+                if (vertexArena.vaos[i].programHandle == programHandle)
+                {
+                    glDeleteVertexArrays(1, &vertexArena.vaos[i].handle);
+                    vertexArena.vaos.erase(vertexArena.vaos.begin() + i);
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+        }
+    }
+}
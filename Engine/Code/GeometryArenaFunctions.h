@@ -0,0 +1,72 @@
+#ifndef GEOMETRY_ARENA_FUNC
+#define GEOMETRY_ARENA_FUNC
+
+#include "Globals.h"
+
+//
+// All the model geometry lives in a few big buffers: one vertex buffer per vertex
+// format and a single index buffer. Submeshes keep a base vertex and a first index
+// into them, so every submesh with the same format shares the same VAO and a whole
+// pass can be drawn with glMultiDrawElementsIndirect.
+//
+// Each vertex arena also keeps a copy of the positions alone, vertex for vertex, so
+// programs reading nothing else (depth only work, the light volumes) fetch a fraction
+// of the bytes with the same base vertices and indices.
+//
+
+#define GEOMETRY_ARENA_VERTEX_CAPACITY (4 * 1024 * 1024)
+#define GEOMETRY_ARENA_INDEX_CAPACITY  (2 * 1024 * 1024)
+
+// Per instance attribute with the index into the instance SSBO. It is sourced from a
+// buffer holding 0, 1, 2... with a divisor of 1, so its value is baseInstance + gl_InstanceID.
+#define INSTANCE_INDEX_LOCATION 5
+
+struct VertexArena
+{
+    VertexBufferLayout layout;
+    GLuint             bufferHandle;
+    u32                capacity;
+    u32                head;
+    std::vector<VAO>   vaos; // one per program
+
+    // Position only stream, no buffer when the layout has no location 0
+    VertexBufferAttribute positionAttribute;
+    GLuint                positionBufferHandle;
+    u32                   positionCapacity;
+};
+
+struct GeometryArena
+{
+    std::vector<VertexArena> vertexArenas;
+
+    GLuint indexBufferHandle;
+    u32    indexCapacity;
+    u32    indexHead;
+
+    GLuint instanceIndexBufferHandle;
+};
+
+namespace GeometryArenaManager
+{
+    void Init(GeometryArena& arena, u32 maxInstances);
+
+    // Returns the vertex arena with this layout, creating it the first time it is seen
+    u32 FindVertexArena(GeometryArena& arena, const VertexBufferLayout& layout);
+
+    // Copies the vertices at the end of the arena and returns their base vertex. Grows the arena if needed.
+    u32 AllocateVertices(GeometryArena& arena, u32 vertexArenaIdx, const void* data, u32 size);
+
+    // Copies the indices at the end of the index buffer and returns the first index
+    u32 AllocateIndices(GeometryArena& arena, const void* data, u32 size);
+
+    // VAO of the smallest stream with every attribute the program reads
+    GLuint FindVAO(GeometryArena& arena, u32 vertexArenaIdx, const Program& program);
+
+    // Bytes of every vertex stream
+    u64 GetVertexBytes(const GeometryArena& arena);
+
+    // Deletes the VAOs built for a program (e.g. before hot reloading it)
+    void InvalidateProgramVAOs(GeometryArena& arena, GLuint programHandle);
+}
+
+#endif // !GEOMETRY_ARENA_FUNC
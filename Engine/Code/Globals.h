@@ -59,11 +59,20 @@ struct Input {
     bool firstMouse = true;
 };
 
+enum VertexAttributeType : u8
+{
+    VertexAttributeType_Float,
+    VertexAttributeType_UNorm16,
+    VertexAttributeType_SNorm16,
+    VertexAttributeType_Half
+};
+
 struct VertexBufferAttribute
 {
     u8 location;
     u8 componentCount;
     u8 offset;
+    u8 type; // VertexAttributeType
 };
 
 struct VertexBufferLayout
@@ -83,6 +92,47 @@ struct VertexShaderLayout
     std::vector<VertexShaderAttribute> attributes;
 };
 
+enum UniformId
+{
+    Uniform_Texture,
+    Uniform_ViewMatrix,
+    Uniform_ProjectionMatrix,
+    Uniform_ModelMatrix,
+    Uniform_ReflectionTexture,
+    Uniform_RefractionTexture,
+    Uniform_DudvMap,
+    Uniform_MoveFactor,
+    Uniform_Albedo,
+    Uniform_Normals,
+    Uniform_Position,
+    Uniform_ViewDir,
+    Uniform_Projection,
+    Uniform_View,
+    Uniform_FrustumPlanes,
+    Uniform_InstanceCount,
+    Uniform_CounterIndex,
+    Uniform_Mode,
+    Uniform_SourceSize,
+    Uniform_NearFar,
+    Uniform_InverseProjection,
+    Uniform_WorldViewProjection,
+    Uniform_LightIndex,
+    Uniform_ViewportSize,
+    Uniform_Depth,
+    Uniform_InverseViewProjection,
+    Uniform_CompactGBuffer,
+    Uniform_MaterialArrays,
+    Uniform_Count
+};
+
+struct ShaderUniform
+{
+    std::string name;
+    GLint       location;
+    GLenum      type;
+    GLint       size;
+};
+
 struct VAO
 {
     GLuint handle;
@@ -92,19 +142,28 @@ struct VAO
 struct SubMesh
 {
     VertexBufferLayout vertexBufferLayout;
-    std::vector<float> vertices;
+    // Imported geometry in the compact layout (see VertexFormatFunctions.h), released once it is in the arena
+    std::vector<u8> vertices;
     std::vector<u32> indices;
-    u32 vertexOffset;
-    u32 indexOffset;
+    u32 indexCount;
+
+    // Location in the geometry arena (see GeometryArenaFunctions.h)
+    u32 vertexArenaIdx;
+    u32 baseVertex;
+    u32 firstIndex;
 
-    std::vector<VAO> vaos;
+    // Object space bounding box, computed when the model is imported
+    vec3 aabbMin;
+    vec3 aabbMax;
 };
 
 struct Mesh
 {
     std::vector<SubMesh>    submeshes;
-    GLuint                  vertexBufferHandle;
-    GLuint                  indexBufferHandle;
+
+    // Union of the submesh boxes
+    vec3 aabbMin;
+    vec3 aabbMax;
 };
 
 struct Image
@@ -119,6 +178,7 @@ struct Texture
 {
     GLuint      handle;
     std::string filepath;
+    u64         memoryBytes; // every mip level, 0 while the placeholder is shown
 };
 
 struct Program
@@ -126,8 +186,13 @@ struct Program
     GLuint             handle;
     std::string        filepath;
     std::string        programName;
-    u64                lastWriteTimestamp; // What is this for?
+    u64                lastWriteTimestamp; // Checked by HotReloadPrograms() to rebuild the program when the file changes
+    bool               isCompute;          // Loaded with LoadComputeProgram(), a single COMPUTE stage
     VertexShaderLayout shaderLayout;
+
+    // Reflected in LoadProgram, -1 when the program doesn't use the uniform
+    std::vector<ShaderUniform> uniforms;
+    GLint                      uniformLocations[Uniform_Count];
 };
 
 struct Model
@@ -140,9 +205,19 @@ enum Mode
 {
     Mode_Forward,
     Mode_Deferred,
+    Mode_DeferredLightVolumes,
     Mode_Count
 };
 
+// Minification of the material textures, see App::ConfigureMaterialSampler()
+enum TextureFiltering
+{
+    TextureFiltering_Bilinear,    // nearest mip
+    TextureFiltering_Trilinear,
+    TextureFiltering_Anisotropic, // trilinear with App::anisotropy samples
+    TextureFiltering_Count
+};
+
 struct VertexV3V2
 {
     glm::vec3 pos;
@@ -168,12 +243,26 @@ struct Material
     u32             bumpTextureIdx;
 };
 
+#define MAX_RING_REGIONS 4
+
 struct Buffer {
     GLsizei size;
     GLenum type;
     GLuint handle;
     u8* data;
     u32 head;
+
+    // Ring mode (BufferManager::CreateRingBuffer), one region per frame in flight
+    bool isRing;
+    bool persistent;
+    u32 regionSize;
+    u32 regionCount;
+    u32 regionIndex;
+    GLsync regionFences[MAX_RING_REGIONS];
+    u32 stalls;
+
+    // Pushes dropped because they did not fit, see BufferManager::PushAlignedData()
+    u32 overflows;
 };
 
 struct Camera
@@ -207,8 +296,20 @@ struct Entity
 {
     glm::mat4 worldMatrix;
     u32 modelIndex;
-    u32 localParamsOffset;
-    u32 localParamsSize;
+
+    // World space box, refreshed when worldMatrix changes (boundsMatrix is the one it was computed with)
+    vec3 worldAabbMin = vec3(0.0f);
+    vec3 worldAabbMax = vec3(0.0f);
+    glm::mat4 boundsMatrix = glm::mat4(1.0f);
+    bool boundsValid = false;
+};
+
+// Entities sharing a model, drawn with a single instanced draw per submesh
+struct InstanceBatch
+{
+    u32 modelIndex;
+    u32 firstInstance; // into App::instanceOrder and the instance SSBO, used as baseInstance
+    u32 instanceCount;
 };
 
 enum LightType
@@ -224,6 +325,10 @@ struct Light
     vec3 direction;
     vec3 position;
 
+    // Point light attenuation: 1 / (constant + linear * d + quadratic * d^2)
+    f32 constant = 1.0f;
+    f32 linear = 0.09f;
+    f32 quadratic = 0.032f;
 };
 
 struct FrameBuffer
@@ -239,14 +344,15 @@ struct FrameBuffer
             glDeleteFramebuffers(1, &fbHandle);
             fbHandle = 0;
         }
+        // The attachments are textures
         for (int i = 0; i < colorAttachment.size(); i++)
         {
-            glDeleteFramebuffers(1, &colorAttachment[i]);
+            glDeleteTextures(1, &colorAttachment[i]);
         }
         colorAttachment.clear();
         if (depthHandle)
         {
-            glDeleteRenderbuffers(1, &depthHandle);
+            glDeleteTextures(1, &depthHandle);
             depthHandle = 0;
         }
     }
@@ -262,6 +368,19 @@ struct WaterBuffer
     FrameBuffer fboReflection;
     FrameBuffer fboRefraction;
 
+    // displaySize divided by App::waterResolutionDivisor
+    ivec2 size = ivec2(0);
+
+    // Camera and water at the last refresh of the targets, see App::NeedsWaterUpdate()
+    bool      valid = false;
+    u32       framesSinceUpdate = 0;
+    vec3      updateCameraPos = vec3(0.0f);
+    vec3      updateCameraFront = vec3(0.0f);
+    glm::mat4 updateWaterMatrix = glm::mat4(1.0f);
+
+    // NDC extent of the water quad at the last refresh (min x, min y, max x, max y)
+    vec4      screenRect = vec4(-1.0f, -1.0f, 1.0f, 1.0f);
+
     GLuint GetReflectionTexture()
     {
         for (int i = 0; i < fboReflection.colorAttachment.size(); i++)
@@ -0,0 +1,346 @@
+#include "engine.h"
+#include "GpuCullingFunctions.h"
+
+#include <algorithm>
+
+namespace GpuCulling
+{
+    static const char* GetViewName(CullingView view)
+    {
+        static const char* viewNames[] = { "Main", "Reflection", "Refraction" };
+        static_assert(ARRAY_COUNT(viewNames) == CullingView_Count, "Missing view names");
+        return viewNames[view];
+    }
+
+    // Through GL_COPY_WRITE_BUFFER so no other binding is disturbed. Empty buffers keep
+    // a minimum size, binding a zero sized range is an error.
+    static void UploadBuffer(GLuint handle, const void* data, u32 size)
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, handle);
+        glBufferData(GL_COPY_WRITE_BUFFER, glm::max(size, 16u), NULL, GL_DYNAMIC_DRAW);
+        if (size > 0)
+            glBufferSubData(GL_COPY_WRITE_BUFFER, 0, size, data);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    void Init(GpuCullingScene& scene, u32 programIdx)
+    {
+        scene.programIdx = programIdx;
+
+        glGenBuffers(1, &scene.matrixBuffer);
+        glGenBuffers(1, &scene.instanceBuffer);
+        glGenBuffers(1, &scene.batchBuffer);
+        glGenBuffers(1, &scene.batchCommandBuffer);
+        glGenBuffers(1, &scene.commandTemplateBuffer);
+        glGenBuffers(CullingView_Count, scene.commandBuffers);
+        glGenBuffers(CullingView_Count, scene.visibleBuffers);
+        glGenBuffers(1, &scene.drawIndexBuffer);
+        glGenBuffers(1, &scene.drawParamsBuffer);
+        const u32 countersSize = GPU_CULLING_COUNTER_FRAMES * CullingView_Count * sizeof(u32);
+        scene.counters = BufferManager::CreatePersistentBuffer(countersSize, GL_SHADER_STORAGE_BUFFER);
+        if (scene.counters.persistent)
+            memset(scene.counters.data, 0, countersSize);
+        else
+            ILOG("GPU culling: glBufferStorage not available, the visible counts are not read back");
+
+        // Forces the first upload
+        scene.uploadedGeneration = UINT32_MAX;
+    }
+
+    bool NeedsUpload(const App& app, const GpuCullingScene& scene)
+    {
+        return scene.uploadedGeneration != app.sceneGeneration;
+    }
+
+    void Upload(const App& app, GpuCullingScene& scene)
+    {
+        const u32 instanceCount = (u32)app.instanceOrder.size();
+
+        scene.matrices.resize(instanceCount);
+        scene.instances.resize(instanceCount);
+        scene.batches.clear();
+        scene.commands.clear();
+        scene.drawIndices.clear();
+        scene.drawParams.clear();
+
+        // Sort keys of the commands, as runs of a single command
+        std::vector<GpuCullingRun> commandKeys;
+
+        for (u32 b = 0; b < app.instanceBatches.size(); ++b)
+        {
+            const InstanceBatch& batch = app.instanceBatches[b];
+            const Model& model = app.models[batch.modelIndex];
+            const Mesh& mesh = app.meshes[model.meshIdx];
+
+            for (u32 i = batch.firstInstance; i < batch.firstInstance + batch.instanceCount; ++i)
+            {
+                GpuCullInstance& instance = scene.instances[i];
+                instance = GpuCullInstance{};
+                instance.aabbMin = vec4(mesh.aabbMin, 1.0f);
+                instance.aabbMax = vec4(mesh.aabbMax, 1.0f);
+                instance.batchIdx = b;
+                scene.matrices[i] = app.entities[app.instanceOrder[i]].worldMatrix;
+            }
+
+            GpuCullBatch cullBatch = {};
+            cullBatch.firstCommandIdx = (u32)scene.commands.size();
+
+            for (u32 s = 0; s < mesh.submeshes.size(); ++s)
+            {
+                const SubMesh& submesh = mesh.submeshes[s];
+
+                // The visible lists are read through the instance index buffer, which has room for MAX_DRAW_INSTANCES
+                if (scene.drawIndices.size() + batch.instanceCount > MAX_DRAW_INSTANCES)
+                {
+                    if (!scene.drawLimitWarned)
+                    {
+                        ELOG("GPU culling: too many draws, the submeshes past %u draw instances are left out", MAX_DRAW_INSTANCES);
+                        scene.drawLimitWarned = true;
+                    }
+                    break;
+                }
+
+                // The instance count is filled by the compute shader
+                DrawElementsIndirectCommand command = {};
+                command.count = submesh.indexCount;
+                command.firstIndex = submesh.firstIndex;
+                command.baseVertex = submesh.baseVertex;
+                command.baseInstance = (u32)scene.drawIndices.size();
+                scene.drawIndices.insert(scene.drawIndices.end(), batch.instanceCount, (u32)scene.drawParams.size());
+                scene.drawParams.push_back(RenderQueueManager::MakeDrawParams(submesh, model.materialIdx[s]));
+
+                GpuCullingRun key = {};
+                key.vertexArenaIdx = submesh.vertexArenaIdx;
+                key.firstCommand = (u32)scene.commands.size();
+                key.commandCount = 1;
+
+                commandKeys.push_back(key);
+                scene.commands.push_back(command);
+            }
+
+            cullBatch.commandCount = (u32)scene.commands.size() - cullBatch.firstCommandIdx;
+            scene.batches.push_back(cullBatch);
+        }
+
+        // Commands sharing a VAO must be contiguous to be drawn together
+        std::stable_sort(commandKeys.begin(), commandKeys.end(), [](const GpuCullingRun& a, const GpuCullingRun& b)
+        {
+            return a.vertexArenaIdx < b.vertexArenaIdx;
+        });
+
+        std::vector<DrawElementsIndirectCommand> sortedCommands(scene.commands.size());
+        scene.batchCommands.resize(scene.commands.size());
+        scene.runs.clear();
+        for (u32 c = 0; c < commandKeys.size(); ++c)
+        {
+            const GpuCullingRun& key = commandKeys[c];
+            sortedCommands[c] = scene.commands[key.firstCommand];
+
+            // Each command belongs to a single batch, so the batch slots map 1:1 to the unsorted commands
+            scene.batchCommands[key.firstCommand] = c;
+
+            if (scene.runs.empty() || scene.runs.back().vertexArenaIdx != key.vertexArenaIdx)
+            {
+                GpuCullingRun run = key;
+                run.firstCommand = c;
+                run.commandCount = 0;
+                scene.runs.push_back(run);
+            }
+            scene.runs.back().commandCount++;
+        }
+        scene.commands.swap(sortedCommands);
+
+        UploadBuffer(scene.matrixBuffer, scene.matrices.data(), instanceCount * sizeof(glm::mat4));
+        UploadBuffer(scene.instanceBuffer, scene.instances.data(), instanceCount * sizeof(GpuCullInstance));
+        UploadBuffer(scene.batchBuffer, scene.batches.data(), scene.batches.size() * sizeof(GpuCullBatch));
+        UploadBuffer(scene.batchCommandBuffer, scene.batchCommands.data(), scene.batchCommands.size() * sizeof(u32));
+        UploadBuffer(scene.commandTemplateBuffer, scene.commands.data(), scene.commands.size() * sizeof(DrawElementsIndirectCommand));
+        UploadBuffer(scene.drawIndexBuffer, scene.drawIndices.data(), scene.drawIndices.size() * sizeof(u32));
+        UploadBuffer(scene.drawParamsBuffer, scene.drawParams.data(), scene.drawParams.size() * sizeof(GpuDrawParams));
+        for (u32 view = 0; view < CullingView_Count; ++view)
+        {
+            UploadBuffer(scene.commandBuffers[view], scene.commands.data(), scene.commands.size() * sizeof(DrawElementsIndirectCommand));
+            UploadBuffer(scene.visibleBuffers[view], NULL, scene.drawIndices.size() * sizeof(u32));
+        }
+
+        scene.uploadedGeneration = app.sceneGeneration;
+
+        // The command buffers hold the templates again until each view is culled
+        for (u32 view = 0; view < CullingView_Count; ++view)
+        {
+            scene.culled[view] = false;
+        }
+
+        ILOG("GPU culling: uploaded %u instances, %u commands in %u runs", instanceCount, (u32)scene.commands.size(), (u32)scene.runs.size());
+    }
+
+    void Cull(App& app, GpuCullingScene& scene, CullingView view, const Frustum& frustum, u32 frameSlot)
+    {
+        ASSERT(frameSlot < GPU_CULLING_COUNTER_FRAMES, "Not enough culling counters for the frames in flight");
+        scene.frustums[view] = frustum;
+        scene.culled[view] = true;
+
+        const u32 instanceCount = (u32)scene.instances.size();
+        const u32 counterIndex = frameSlot * CullingView_Count + view;
+        const GLintptr counterOffset = counterIndex * sizeof(u32);
+
+        // The GPU is done with this slot, read its count and reset it for this frame. Going through
+        // the mapping keeps the driver from syncing with the dispatches of the other views, which
+        // write to the same buffer.
+        if (scene.counters.persistent)
+        {
+            u32* counter = (u32*)scene.counters.data + counterIndex;
+            scene.visibleCounts[view] = *counter;
+            *counter = 0;
+        }
+        else
+        {
+            const u32 zero = 0;
+            glBindBuffer(GL_COPY_WRITE_BUFFER, scene.counters.handle);
+            glClearBufferSubData(GL_COPY_WRITE_BUFFER, GL_R32UI, counterOffset, sizeof(u32), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+            scene.visibleCounts[view] = instanceCount;
+        }
+
+        // Restore the commands with no instances
+        const u32 commandsSize = (u32)scene.commands.size() * sizeof(DrawElementsIndirectCommand);
+        if (commandsSize > 0)
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER, scene.commandTemplateBuffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, scene.commandBuffers[view]);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, commandsSize);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        if (instanceCount == 0) return;
+
+        const Program& program = app.programs[scene.programIdx];
+        glUseProgram(program.handle);
+        glUniform4fv(program.uniformLocations[Uniform_FrustumPlanes], 6, &frustum.planes[0].x);
+        glUniform1ui(program.uniformLocations[Uniform_InstanceCount], instanceCount);
+        glUniform1ui(program.uniformLocations[Uniform_CounterIndex], counterIndex);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(0), scene.matrixBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(1), scene.instanceBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(2), scene.batchBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(3), scene.batchCommandBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(4), scene.commandBuffers[view]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(5), scene.visibleBuffers[view]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(6), scene.counters.handle);
+
+        glDispatchCompute((instanceCount + GPU_CULLING_GROUP_SIZE - 1) / GPU_CULLING_GROUP_SIZE, 1, 1);
+
+        // The commands are read as indirect parameters, the visible list from the vertex shaders,
+        // and the counter through the mapping once the fence of this frame signals
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+    }
+
+    u32 Draw(App& app, GpuCullingScene& scene, CullingView view, const Program& program)
+    {
+        glUseProgram(program.handle);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(1), scene.matrixBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(3), scene.visibleBuffers[view]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(7), scene.drawIndexBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(9), scene.drawParamsBuffer);
+        MaterialTables::Bind(app, app.materialTable, program);
+
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, scene.commandBuffers[view]);
+
+        for (const GpuCullingRun& run : scene.runs)
+        {
+            glBindVertexArray(GeometryArenaManager::FindVAO(app.geometryArena, run.vertexArenaIdx, program));
+
+            const u8* offset = (const u8*)0 + run.firstCommand * sizeof(DrawElementsIndirectCommand);
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, offset, run.commandCount, 0);
+        }
+
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        glBindVertexArray(0);
+
+        return (u32)scene.runs.size();
+    }
+
+    void CullReference(const GpuCullingScene& scene, const Frustum& frustum,
+        std::vector<u32>& instanceCounts, std::vector<std::vector<u32>>& batchVisible)
+    {
+        instanceCounts.assign(scene.commands.size(), 0);
+        batchVisible.assign(scene.batches.size(), std::vector<u32>());
+
+        for (u32 i = 0; i < scene.instances.size(); ++i)
+        {
+            const GpuCullInstance& instance = scene.instances[i];
+
+            vec3 worldMin, worldMax;
+            Culling::TransformAabb(scene.matrices[i], vec3(instance.aabbMin), vec3(instance.aabbMax), worldMin, worldMax);
+            if (!Culling::IsAabbVisible(frustum, worldMin, worldMax)) continue;
+
+            const GpuCullBatch& batch = scene.batches[instance.batchIdx];
+            if (batch.commandCount == 0) continue;
+
+            for (u32 c = 0; c < batch.commandCount; ++c)
+            {
+                instanceCounts[scene.batchCommands[batch.firstCommandIdx + c]]++;
+            }
+            batchVisible[instance.batchIdx].push_back(i);
+        }
+    }
+
+    u32 Validate(const GpuCullingScene& scene, CullingView view)
+    {
+        std::vector<DrawElementsIndirectCommand> gpuCommands(scene.commands.size());
+        std::vector<u32> gpuVisible(scene.drawIndices.size());
+
+        if (!gpuCommands.empty())
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER, scene.commandBuffers[view]);
+            glGetBufferSubData(GL_COPY_READ_BUFFER, 0, gpuCommands.size() * sizeof(DrawElementsIndirectCommand), gpuCommands.data());
+        }
+        if (!gpuVisible.empty())
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER, scene.visibleBuffers[view]);
+            glGetBufferSubData(GL_COPY_READ_BUFFER, 0, gpuVisible.size() * sizeof(u32), gpuVisible.data());
+        }
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+        std::vector<u32> instanceCounts;
+        std::vector<std::vector<u32>> batchVisible;
+        CullReference(scene, scene.frustums[view], instanceCounts, batchVisible);
+
+        u32 mismatches = 0;
+        for (u32 c = 0; c < gpuCommands.size(); ++c)
+        {
+            if (gpuCommands[c].instanceCount != instanceCounts[c]) mismatches++;
+        }
+
+        // The atomics make the order within a command range arbitrary
+        for (u32 b = 0; b < scene.batches.size(); ++b)
+        {
+            const GpuCullBatch& batch = scene.batches[b];
+            for (u32 i = 0; i < batch.commandCount; ++i)
+            {
+                const DrawElementsIndirectCommand& command = gpuCommands[scene.batchCommands[batch.firstCommandIdx + i]];
+                if (command.instanceCount != batchVisible[b].size())
+                {
+                    mismatches++;
+                    continue;
+                }
+
+                std::vector<u32> visible(gpuVisible.begin() + command.baseInstance, gpuVisible.begin() + command.baseInstance + command.instanceCount);
+                std::sort(visible.begin(), visible.end());
+                if (visible != batchVisible[b]) mismatches++;
+            }
+        }
+
+        if (mismatches > 0)
+        {
+            ELOG("GPU culling: %u mismatches with the CPU reference in the %s view", mismatches, GetViewName(view));
+        }
+        else
+        {
+            ILOG("GPU culling: %s view matches the CPU reference", GetViewName(view));
+        }
+
+        return mismatches;
+    }
+}
@@ -0,0 +1,119 @@
+#ifndef GPU_CULLING_FUNC
+#define GPU_CULLING_FUNC
+
+#include "Globals.h"
+#include "CullingFunctions.h"
+#include "RenderQueueFunctions.h"
+
+//
+// GPU driven culling: the instances are uploaded once (and again only when the scene
+// changes), then a compute shader tests them against the frustum of each view and
+// writes the surviving ones into the indirect commands and the visible list of that
+// view. Every command has its own range of the visible list, with the draw params of the
+// command indexed by a parallel list, and the CPU only issues a glMultiDrawElementsIndirect
+// per run of commands that share a vertex arena.
+//
+
+#define GPU_CULLING_GROUP_SIZE 64
+
+// Frames the visible counters are kept before being read back (matches the uniform ring, whose
+// fences tell when the GPU is done with a slot)
+#define GPU_CULLING_COUNTER_FRAMES 3
+
+enum CullingView
+{
+    CullingView_Main,
+    CullingView_Reflection,
+    CullingView_Refraction,
+    CullingView_Count
+};
+
+// std430 layouts shared with GPU_CULLING.glsl
+struct GpuCullInstance
+{
+    vec4 aabbMin;  // object space
+    vec4 aabbMax;
+    u32  batchIdx;
+    u32  padding[3];
+};
+
+struct GpuCullBatch
+{
+    u32 firstCommandIdx; // into batchCommands
+    u32 commandCount;
+    u32 padding[2];
+};
+
+// Commands sharing a VAO, drawn with a single glMultiDrawElementsIndirect
+struct GpuCullingRun
+{
+    u32 vertexArenaIdx;
+    u32 firstCommand;
+    u32 commandCount;
+};
+
+struct GpuCullingScene
+{
+    u32 programIdx;
+
+    GLuint matrixBuffer;       // mat4 per instance, also read by the draw shaders
+    GLuint instanceBuffer;     // GpuCullInstance per instance
+    GLuint batchBuffer;        // GpuCullBatch per batch
+    GLuint batchCommandBuffer; // command indices of each batch
+    GLuint commandTemplateBuffer;
+    GLuint commandBuffers[CullingView_Count];
+    GLuint visibleBuffers[CullingView_Count];
+    GLuint drawIndexBuffer;    // draw params of each visible list entry, fixed per command range
+    GLuint drawParamsBuffer;   // GpuDrawParams per command, in creation order
+    Buffer counters;           // [GPU_CULLING_COUNTER_FRAMES][CullingView_Count] visible instances, persistently mapped
+
+    // CPU copies of the uploaded data, used by the reference implementation
+    std::vector<glm::mat4>                   matrices;
+    std::vector<GpuCullInstance>             instances;
+    std::vector<GpuCullBatch>                batches;
+    std::vector<u32>                         batchCommands;
+    std::vector<DrawElementsIndirectCommand> commands; // baseInstance is the start of the command range in the visible lists
+    std::vector<u32>                         drawIndices;
+    std::vector<GpuDrawParams>               drawParams;
+    std::vector<GpuCullingRun>               runs;
+
+    // App::sceneGeneration the upload was built from, see NeedsUpload()
+    u32  uploadedGeneration;
+    bool drawLimitWarned;
+
+    Frustum frustums[CullingView_Count];
+    bool    culled[CullingView_Count];        // Cull() ran since the last upload, see Validate()
+    u32     visibleCounts[CullingView_Count]; // read back GPU_CULLING_COUNTER_FRAMES frames late
+};
+
+struct App;
+
+namespace GpuCulling
+{
+    void Init(GpuCullingScene& scene, u32 programIdx);
+
+    // True when entities were added or moved, or models loaded, since the last upload
+    bool NeedsUpload(const App& app, const GpuCullingScene& scene);
+
+    // Uploads the instances in app.instanceOrder, grouped as app.instanceBatches
+    void Upload(const App& app, GpuCullingScene& scene);
+
+    // Dispatches the culling of a view. frameSlot picks the counters, it must not be in use
+    // by the GPU (the region index of the uniform ring buffer is, once BeginRingFrame waited on
+    // its fence). The counts of that slot are read from the mapping without any GL call.
+    void Cull(App& app, GpuCullingScene& scene, CullingView view, const Frustum& frustum, u32 frameSlot);
+
+    // Draws the commands written by Cull() with the bound program. Returns the draw calls issued.
+    u32 Draw(App& app, GpuCullingScene& scene, CullingView view, const Program& program);
+
+    // CPU version of the compute shader: instance count per command and visible instances per batch (sorted),
+    // which every command of the batch gets in its range
+    void CullReference(const GpuCullingScene& scene, const Frustum& frustum,
+        std::vector<u32>& instanceCounts, std::vector<std::vector<u32>>& batchVisible);
+
+    // Reads back the last culling of a view and compares it with CullReference(). Call after glFinish(),
+    // only for the views with culled set. Returns the number of mismatching commands and command ranges.
+    u32 Validate(const GpuCullingScene& scene, CullingView view);
+}
+
+#endif // !GPU_CULLING_FUNC
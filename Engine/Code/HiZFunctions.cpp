@@ -0,0 +1,227 @@
+#include "engine.h"
+#include "HiZFunctions.h"
+
+// Matches local_size in HIZ.glsl
+#define HIZ_GROUP_SIZE 8
+
+namespace HiZManager
+{
+    enum HiZMode
+    {
+        HiZMode_CopyDepth,
+        HiZMode_Reduce,
+        HiZMode_Debug
+    };
+
+    static ivec2 GetLevelSize(ivec2 size, u32 level)
+    {
+        return glm::max(ivec2(size.x >> level, size.y >> level), ivec2(1));
+    }
+
+    static void ReleaseReadbacks(HiZPyramid& hiZ)
+    {
+        for (HiZReadback& readback : hiZ.readbacks)
+        {
+            if (readback.fence)
+            {
+                glDeleteSync(readback.fence);
+                readback.fence = 0;
+            }
+        }
+        hiZ.depthValid = false;
+    }
+
+    static void Resize(HiZPyramid& hiZ, ivec2 size)
+    {
+        if (hiZ.texture)
+            glDeleteTextures(1, &hiZ.texture);
+
+        hiZ.size = size;
+        hiZ.levelCount = 1;
+        while ((glm::max(size.x, size.y) >> hiZ.levelCount) > 0)
+        {
+            hiZ.levelCount++;
+        }
+
+        glGenTextures(1, &hiZ.texture);
+        glBindTexture(GL_TEXTURE_2D, hiZ.texture);
+        glTexStorage2D(GL_TEXTURE_2D, hiZ.levelCount, GL_RG32F, size.x, size.y);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        hiZ.readbackLevel = 0;
+        while (GetLevelSize(size, hiZ.readbackLevel).x > HIZ_READBACK_MAX_WIDTH && hiZ.readbackLevel + 1 < hiZ.levelCount)
+        {
+            hiZ.readbackLevel++;
+        }
+        hiZ.readbackSize = GetLevelSize(size, hiZ.readbackLevel);
+
+        ReleaseReadbacks(hiZ);
+        for (HiZReadback& readback : hiZ.readbacks)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+            glBufferData(GL_PIXEL_PACK_BUFFER, hiZ.readbackSize.x * hiZ.readbackSize.y * sizeof(vec2), NULL, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        hiZ.debugLevel = glm::min(hiZ.debugLevel, (i32)hiZ.levelCount - 1);
+    }
+
+    void Init(HiZPyramid& hiZ, u32 programIdx)
+    {
+        hiZ.programIdx = programIdx;
+        for (HiZReadback& readback : hiZ.readbacks)
+        {
+            glGenBuffers(1, &readback.pbo);
+        }
+    }
+
+    static void Dispatch(ivec2 size)
+    {
+        glDispatchCompute((size.x + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, (size.y + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+
+    // Takes the readback of HIZ_READBACK_FRAMES frames ago if it is ready, and reuses its PBO
+    static void Readback(HiZPyramid& hiZ, const glm::mat4& viewProjection)
+    {
+        HiZReadback& readback = hiZ.readbacks[hiZ.readbackHead];
+        if (readback.fence)
+        {
+            GLenum status = glClientWaitSync(readback.fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                return;
+
+            glDeleteSync(readback.fence);
+            readback.fence = 0;
+
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+            const vec2* data = (const vec2*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+            if (data)
+            {
+                hiZ.depth.assign(data, data + hiZ.readbackSize.x * hiZ.readbackSize.y);
+                hiZ.depthViewProjection = readback.viewProjection;
+                hiZ.depthValid = true;
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            }
+        }
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+        glBindTexture(GL_TEXTURE_2D, hiZ.texture);
+        glGetTexImage(GL_TEXTURE_2D, hiZ.readbackLevel, GL_RG, GL_FLOAT, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        readback.viewProjection = viewProjection;
+        readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        hiZ.readbackHead = (hiZ.readbackHead + 1) % HIZ_READBACK_FRAMES;
+    }
+
+    static void BuildDebug(HiZPyramid& hiZ, const Program& program)
+    {
+        ivec2 levelSize = GetLevelSize(hiZ.size, hiZ.debugLevel);
+        if (!hiZ.debugTexture || hiZ.debugSize != levelSize)
+        {
+            if (hiZ.debugTexture)
+                glDeleteTextures(1, &hiZ.debugTexture);
+
+            glGenTextures(1, &hiZ.debugTexture);
+            glBindTexture(GL_TEXTURE_2D, hiZ.debugTexture);
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, levelSize.x, levelSize.y);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            hiZ.debugSize = levelSize;
+        }
+
+        glUniform1i(program.uniformLocations[Uniform_Mode], HiZMode_Debug);
+        glUniform2i(program.uniformLocations[Uniform_SourceSize], levelSize.x, levelSize.y);
+        glUniform2f(program.uniformLocations[Uniform_NearFar], CAMERA_Z_NEAR, CAMERA_Z_FAR);
+        glBindImageTexture(0, hiZ.texture, hiZ.debugLevel, GL_FALSE, 0, GL_READ_ONLY, GL_RG32F);
+        glBindImageTexture(2, hiZ.debugTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+        Dispatch(levelSize);
+    }
+
+    void Build(App& app, HiZPyramid& hiZ, GLuint depthTexture, ivec2 depthSize, const glm::mat4& viewProjection)
+    {
+        if (hiZ.size != depthSize)
+            Resize(hiZ, depthSize);
+
+        const Program& program = app.programs[hiZ.programIdx];
+        glUseProgram(program.handle);
+
+        // Level 0 is a copy of the depth buffer
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        glUniform1i(program.uniformLocations[Uniform_Mode], HiZMode_CopyDepth);
+        glUniform2i(program.uniformLocations[Uniform_SourceSize], hiZ.size.x, hiZ.size.y);
+        glBindImageTexture(1, hiZ.texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG32F);
+        Dispatch(hiZ.size);
+
+        // Every other level reduces the previous one
+        glUniform1i(program.uniformLocations[Uniform_Mode], HiZMode_Reduce);
+        for (u32 level = 1; level < hiZ.levelCount; ++level)
+        {
+            ivec2 sourceSize = GetLevelSize(hiZ.size, level - 1);
+            glUniform2i(program.uniformLocations[Uniform_SourceSize], sourceSize.x, sourceSize.y);
+            glBindImageTexture(0, hiZ.texture, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_RG32F);
+            glBindImageTexture(1, hiZ.texture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG32F);
+            Dispatch(GetLevelSize(hiZ.size, level));
+        }
+
+        if (hiZ.showDebug)
+            BuildDebug(hiZ, program);
+
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glUseProgram(0);
+
+        glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT);
+        Readback(hiZ, viewProjection);
+    }
+
+    bool IsOccluded(const HiZPyramid& hiZ, const vec3& aabbMin, const vec3& aabbMax)
+    {
+        if (!hiZ.depthValid) return false;
+
+        vec3 ndcMin = vec3(FLT_MAX);
+        vec3 ndcMax = vec3(-FLT_MAX);
+        for (u32 i = 0; i < 8; ++i)
+        {
+            vec3 corner = vec3(i & 1 ? aabbMax.x : aabbMin.x, i & 2 ? aabbMax.y : aabbMin.y, i & 4 ? aabbMax.z : aabbMin.z);
+            vec4 clip = hiZ.depthViewProjection * vec4(corner, 1.0f);
+
+            // Crossing the near plane, it covers the camera
+            if (clip.w <= CAMERA_Z_NEAR) return false;
+
+            vec3 ndc = vec3(clip) / clip.w;
+            ndcMin = glm::min(ndcMin, ndc);
+            ndcMax = glm::max(ndcMax, ndc);
+        }
+
+        // Outside of the view the depth is unknown
+        if (ndcMax.x < -1.0f || ndcMin.x > 1.0f || ndcMax.y < -1.0f || ndcMin.y > 1.0f) return false;
+
+        f32 boxDepth = ndcMin.z * 0.5f + 0.5f;
+
+        // One texel of margin, the odd sizes fold an extra row/column into the last texel
+        vec2 uvMin = glm::clamp(vec2(ndcMin) * 0.5f + 0.5f, vec2(0.0f), vec2(1.0f));
+        vec2 uvMax = glm::clamp(vec2(ndcMax) * 0.5f + 0.5f, vec2(0.0f), vec2(1.0f));
+        ivec2 texelMin = glm::max(ivec2(uvMin * vec2(hiZ.readbackSize)) - 1, ivec2(0));
+        ivec2 texelMax = glm::min(ivec2(uvMax * vec2(hiZ.readbackSize)) + 1, hiZ.readbackSize - 1);
+
+        if (texelMax.x - texelMin.x >= HIZ_MAX_TEST_TEXELS || texelMax.y - texelMin.y >= HIZ_MAX_TEST_TEXELS) return false;
+
+        for (i32 y = texelMin.y; y <= texelMax.y; ++y)
+        {
+            for (i32 x = texelMin.x; x <= texelMax.x; ++x)
+            {
+                // Something behind the nearest point of the box, it may show there
+                if (boxDepth <= hiZ.depth[y * hiZ.readbackSize.x + x].y) return false;
+            }
+        }
+        return true;
+    }
+}
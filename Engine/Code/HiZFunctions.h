@@ -0,0 +1,67 @@
+#ifndef HIZ_FUNC
+#define HIZ_FUNC
+
+#include "Globals.h"
+
+//
+// Hierarchical Z: a mip chain of the G-buffer depth where every texel keeps the min and
+// max depth of the texels it covers. One level is read back asynchronously, and the
+// next frames test the entity boxes against it before submitting them to the G-buffer
+// pass. The boxes are projected with the view-projection the depth was rendered with.
+//
+
+// Frames between a readback request and its use, so mapping the PBO never stalls
+#define HIZ_READBACK_FRAMES 3
+
+// The CPU reads the first level whose width is not larger than this
+#define HIZ_READBACK_MAX_WIDTH 256
+
+// Boxes spanning more texels than this in a dimension are big enough to be kept without testing
+#define HIZ_MAX_TEST_TEXELS 64
+
+struct HiZReadback
+{
+    GLuint    pbo;
+    GLsync    fence;
+    glm::mat4 viewProjection;
+};
+
+struct HiZPyramid
+{
+    u32    programIdx;
+
+    GLuint texture;    // GL_RG32F, min/max window space depth
+    ivec2  size;
+    u32    levelCount;
+
+    HiZReadback readbacks[HIZ_READBACK_FRAMES];
+    u32         readbackHead;
+    u32         readbackLevel;
+    ivec2       readbackSize;
+
+    // Last level read back, with the view-projection of the frame it comes from
+    std::vector<vec2> depth;
+    glm::mat4         depthViewProjection;
+    bool              depthValid;
+
+    // Level visualized in the Info window
+    bool   showDebug;
+    i32    debugLevel;
+    GLuint debugTexture;
+    ivec2  debugSize;
+};
+
+struct App;
+
+namespace HiZManager
+{
+    void Init(HiZPyramid& hiZ, u32 programIdx);
+
+    // Builds the pyramid from a depth texture (it is resized to match) and requests the readback
+    void Build(App& app, HiZPyramid& hiZ, GLuint depthTexture, ivec2 depthSize, const glm::mat4& viewProjection);
+
+    // True if the world space box is behind the depth read back. Conservative: unknown means visible.
+    bool IsOccluded(const HiZPyramid& hiZ, const vec3& aabbMin, const vec3& aabbMax);
+}
+
+#endif // !HIZ_FUNC
@@ -0,0 +1,128 @@
+#include "JobSystemFunctions.h"
+
+namespace JobManager
+{
+    static void WorkerLoop(JobSystem* jobSystem)
+    {
+        for (;;)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(jobSystem->jobsMutex);
+                jobSystem->jobsCondition.wait(lock, [jobSystem] { return jobSystem->quit || !jobSystem->jobs.empty(); });
+
+                if (jobSystem->quit) return;
+
+                job = std::move(jobSystem->jobs.front());
+                jobSystem->jobs.pop_front();
+            }
+
+            job();
+            jobSystem->pendingWork--;
+        }
+    }
+
+    void Init(JobSystem& jobSystem, u32 threadCount)
+    {
+        if (threadCount == 0)
+        {
+            // Leave a core for the main thread
+            u32 cores = std::thread::hardware_concurrency();
+            threadCount = cores > 1 ? cores - 1 : 1;
+        }
+
+        jobSystem.quit = false;
+        for (u32 i = 0; i < threadCount; ++i)
+        {
+            jobSystem.workers.emplace_back(WorkerLoop, &jobSystem);
+        }
+    }
+
+    void Shutdown(JobSystem& jobSystem)
+    {
+        {
+            std::lock_guard<std::mutex> lock(jobSystem.jobsMutex);
+            jobSystem.quit = true;
+            jobSystem.jobs.clear();
+        }
+        jobSystem.jobsCondition.notify_all();
+
+        for (std::thread& worker : jobSystem.workers)
+        {
+            worker.join();
+        }
+        jobSystem.workers.clear();
+
+        std::lock_guard<std::mutex> lock(jobSystem.uploadsMutex);
+        jobSystem.uploads.clear();
+        jobSystem.pendingWork = 0;
+    }
+
+    bool IsRunning(const JobSystem& jobSystem)
+    {
+        return !jobSystem.workers.empty();
+    }
+
+    void Submit(JobSystem& jobSystem, Job job)
+    {
+        if (!IsRunning(jobSystem))
+        {
+            // No workers (e.g. offline tools): run it right away
+            jobSystem.pendingWork++;
+            job();
+            jobSystem.pendingWork--;
+            return;
+        }
+
+        jobSystem.pendingWork++;
+        {
+            std::lock_guard<std::mutex> lock(jobSystem.jobsMutex);
+            jobSystem.jobs.push_back(std::move(job));
+        }
+        jobSystem.jobsCondition.notify_one();
+    }
+
+    void PushUpload(JobSystem& jobSystem, UploadTask task)
+    {
+        jobSystem.pendingWork++;
+        std::lock_guard<std::mutex> lock(jobSystem.uploadsMutex);
+        jobSystem.uploads.push_back(std::move(task));
+    }
+
+    u32 DrainUploads(JobSystem& jobSystem, App* app, f64 budgetMs)
+    {
+        f64 startTime = glfwGetTime();
+        u32 tasksRun = 0;
+
+        for (;;)
+        {
+            UploadTask task;
+            {
+                std::lock_guard<std::mutex> lock(jobSystem.uploadsMutex);
+                if (jobSystem.uploads.empty()) break;
+
+                task = std::move(jobSystem.uploads.front());
+                jobSystem.uploads.pop_front();
+            }
+
+            task(app);
+            jobSystem.pendingWork--;
+            tasksRun++;
+
+            if ((glfwGetTime() - startTime) * 1000.0 >= budgetMs) break;
+        }
+
+        return tasksRun;
+    }
+
+    void Flush(JobSystem& jobSystem, App* app)
+    {
+        while (jobSystem.pendingWork > 0)
+        {
+            if (DrainUploads(jobSystem, app, UPLOAD_BUDGET_MS) == 0)
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+}
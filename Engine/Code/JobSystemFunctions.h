@@ -0,0 +1,60 @@
+#ifndef JOB_SYSTEM_FUNC
+#define JOB_SYSTEM_FUNC
+
+#include "Globals.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <atomic>
+
+struct App;
+
+// Milliseconds per frame the main thread spends running GL upload tasks
+#define UPLOAD_BUDGET_MS 4.0
+
+typedef std::function<void()>     Job;
+typedef std::function<void(App*)> UploadTask;
+
+//
+// Worker threads run CPU-only jobs (parsing, decoding...). Anything that needs the
+// GL context is pushed as an upload task, which the main thread runs in Update().
+//
+struct JobSystem
+{
+    std::vector<std::thread> workers;
+
+    std::deque<Job>          jobs;
+    std::mutex               jobsMutex;
+    std::condition_variable  jobsCondition;
+    bool                     quit = false;
+
+    std::deque<UploadTask>   uploads;
+    std::mutex               uploadsMutex;
+
+    // Jobs submitted and not finished yet, plus uploads not run yet
+    std::atomic<u32>         pendingWork{ 0 };
+};
+
+namespace JobManager
+{
+    void Init(JobSystem& jobSystem, u32 threadCount = 0);
+
+    void Shutdown(JobSystem& jobSystem);
+
+    bool IsRunning(const JobSystem& jobSystem);
+
+    void Submit(JobSystem& jobSystem, Job job);
+
+    // Called from worker jobs to hand their results to the main thread
+    void PushUpload(JobSystem& jobSystem, UploadTask task);
+
+    // Runs upload tasks until the time budget is spent (at least one task per call). Returns the tasks run.
+    u32 DrainUploads(JobSystem& jobSystem, App* app, f64 budgetMs);
+
+    // Blocks the main thread until every job and upload has finished
+    void Flush(JobSystem& jobSystem, App* app);
+}
+
+#endif // !JOB_SYSTEM_FUNC
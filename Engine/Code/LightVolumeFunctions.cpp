@@ -0,0 +1,164 @@
+#include "engine.h"
+#include "LightVolumeFunctions.h"
+#include "VertexFormatFunctions.h"
+
+namespace LightVolumes
+{
+    void Init(App& app, LightVolumeRenderer& renderer, u32 programIdx)
+    {
+        renderer.programIdx = programIdx;
+        Configure(app, renderer);
+    }
+
+    void Configure(App& app, LightVolumeRenderer& renderer)
+    {
+        FrameBuffer& frameBuffer = renderer.frameBuffer;
+        frameBuffer.Clear();
+        frameBuffer.colorAttachment.push_back(app.CreateTexture(true));
+
+        // Same format as the G-buffer depth so it can be blitted
+        glGenTextures(1, &frameBuffer.depthHandle);
+        glBindTexture(GL_TEXTURE_2D, frameBuffer.depthHandle);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, app.displaySize.x, app.displaySize.y, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenFramebuffers(1, &frameBuffer.fbHandle);
+        glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer.fbHandle);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, frameBuffer.colorAttachment[0], 0);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, frameBuffer.depthHandle, 0);
+
+        GLenum frameBufferStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        if (frameBufferStatus != GL_FRAMEBUFFER_COMPLETE)
+        {
+            ELOG("Light volume framebuffer incomplete (0x%x)", frameBufferStatus);
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    static void DrawFullScreen(const App& app, const Program& program)
+    {
+        glUniformMatrix4fv(program.uniformLocations[Uniform_WorldViewProjection], 1, GL_FALSE, glm::value_ptr(glm::mat4(1.0f)));
+        glBindVertexArray(app.vao);
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+    }
+
+    void Render(App& app, LightVolumeRenderer& renderer)
+    {
+        const Program& program = app.programs[renderer.programIdx];
+        const glm::mat4 viewProjection = app.projection * app.view;
+
+        renderer.pointLightsDrawn = 0;
+        renderer.pointLightsCulled = 0;
+        u32 drawCalls = 0;
+
+        // The stencil test runs against a copy of the G-buffer depth, the compact layout samples the original
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, app.deferredFrameBuffer.fbHandle);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, renderer.frameBuffer.fbHandle);
+        glBlitFramebuffer(0, 0, app.displaySize.x, app.displaySize.y, 0, 0, app.displaySize.x, app.displaySize.y, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, renderer.frameBuffer.fbHandle);
+        glDrawBuffer(GL_COLOR_ATTACHMENT0);
+        glViewport(0, 0, app.displaySize.x, app.displaySize.y);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClearStencil(0);
+        glClear(GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+        glUseProgram(program.handle);
+        glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app.localUniformBuffer.handle, app.globalParamsOffset, app.globalParamsSize);
+        ClusteredLighting::Bind(app, app.lightClusters);
+
+        app.BindGBuffer(program);
+        glUniform2f(program.uniformLocations[Uniform_ViewportSize], (f32)app.displaySize.x, (f32)app.displaySize.y);
+
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE);
+        glDepthMask(GL_FALSE);
+
+        // The sphere is only available once its model has been uploaded
+        const Mesh& sphereMesh = app.meshes[app.models[app.SphereModelIndex].meshIdx];
+        const bool sphereLoaded = !sphereMesh.submeshes.empty();
+        f32 sphereRadius = 1.0f;
+        GLuint sphereVao = 0;
+        if (sphereLoaded)
+        {
+            sphereRadius = glm::max(glm::max(sphereMesh.aabbMax.x, sphereMesh.aabbMax.y), sphereMesh.aabbMax.z);
+            sphereVao = GeometryArenaManager::FindVAO(app.geometryArena, sphereMesh.submeshes[0].vertexArenaIdx, program);
+        }
+
+        for (u32 i = 0; i < app.lights.size(); ++i)
+        {
+            const Light& light = app.lights[i];
+            f32 radius = ClusteredLighting::ComputeLightRadius(light);
+            glUniform1ui(program.uniformLocations[Uniform_LightIndex], i);
+
+            if (light.type == LightType_Directional || radius == FLT_MAX || !sphereLoaded)
+            {
+                glDisable(GL_DEPTH_TEST);
+                glDisable(GL_STENCIL_TEST);
+                DrawFullScreen(app, program);
+                drawCalls++;
+                continue;
+            }
+
+            if (!Culling::IsAabbVisible(app.viewFrustum, light.position - vec3(radius), light.position + vec3(radius)))
+            {
+                renderer.pointLightsCulled++;
+                continue;
+            }
+
+            // The sphere is read from the position-only stream, quantized inside its box
+            const SubMesh& submesh = sphereMesh.submeshes[0];
+            glm::mat4 worldMatrix = glm::translate(light.position);
+            worldMatrix = glm::scale(worldMatrix, vec3(radius / sphereRadius));
+            worldMatrix = glm::translate(worldMatrix, submesh.aabbMin);
+            worldMatrix = glm::scale(worldMatrix, VertexFormat::GetPositionScale(submesh.aabbMin, submesh.aabbMax));
+            glUniformMatrix4fv(program.uniformLocations[Uniform_WorldViewProjection], 1, GL_FALSE, glm::value_ptr(viewProjection * worldMatrix));
+
+            glBindVertexArray(sphereVao);
+
+            // Stencil pass: both faces, no color. Where the surface is in front of the back faces but
+            // not of the front faces, the depth fails only for the back faces and the stencil ends non zero.
+            // It also works with the camera inside the sphere, where the front faces are clipped.
+            glEnable(GL_DEPTH_TEST);
+            glDepthFunc(GL_LESS);
+            glDisable(GL_CULL_FACE);
+            glEnable(GL_STENCIL_TEST);
+            glStencilFunc(GL_ALWAYS, 0, 0xFF);
+            glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+            glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            glDrawElementsBaseVertex(GL_TRIANGLES, submesh.indexCount, GL_UNSIGNED_INT, (void*)(u64)(submesh.firstIndex * sizeof(u32)), submesh.baseVertex);
+
+            // Light pass: back faces only, so it is drawn once per pixel even from inside the sphere.
+            // The marked pixels are reset to zero for the next light.
+            glDisable(GL_DEPTH_TEST);
+            glEnable(GL_CULL_FACE);
+            glCullFace(GL_FRONT);
+            glStencilFunc(GL_NOTEQUAL, 0, 0xFF);
+            glStencilOp(GL_KEEP, GL_KEEP, GL_ZERO);
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            glDrawElementsBaseVertex(GL_TRIANGLES, submesh.indexCount, GL_UNSIGNED_INT, (void*)(u64)(submesh.firstIndex * sizeof(u32)), submesh.baseVertex);
+            glCullFace(GL_BACK);
+
+            renderer.pointLightsDrawn++;
+            drawCalls += 2;
+        }
+
+        glBindVertexArray(0);
+        glDisable(GL_STENCIL_TEST);
+        glDisable(GL_BLEND);
+        glEnable(GL_DEPTH_TEST);
+        glDepthMask(GL_TRUE);
+        glUseProgram(0);
+
+        ProfilerManager::AddDrawStats(app.profiler, drawCalls, 0);
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, renderer.frameBuffer.fbHandle);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, app.displaySize.x, app.displaySize.y, 0, 0, app.displaySize.x, app.displaySize.y, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef LIGHT_VOLUME_FUNC
+#define LIGHT_VOLUME_FUNC
+
+#include "Globals.h"
+
+//
+// Light volume deferred shading: instead of a full screen pass looping over the lights,
+// every light is drawn on its own with additive blending. Directional lights (and point
+// lights without a finite radius) are full screen quads, point lights are the sphere
+// model scaled to their radius (see ClusteredLighting::ComputeLightRadius). A stencil
+// pass against the scene depth marks the pixels whose surface lies inside the sphere,
+// so only those are shaded.
+//
+
+struct LightVolumeRenderer
+{
+    u32         programIdx;
+
+    // Light accumulation target, its depth-stencil gets a copy of the G-buffer depth every frame
+    FrameBuffer frameBuffer;
+
+    // Last frame
+    u32         pointLightsDrawn;
+    u32         pointLightsCulled;
+};
+
+struct App;
+
+namespace LightVolumes
+{
+    void Init(App& app, LightVolumeRenderer& renderer, u32 programIdx);
+
+    // Recreates the accumulation target for the current display size
+    void Configure(App& app, LightVolumeRenderer& renderer);
+
+    // Shades the G-buffer into the back buffer. Point lights are culled against app.viewFrustum.
+    void Render(App& app, LightVolumeRenderer& renderer);
+}
+
+#endif // !LIGHT_VOLUME_FUNC
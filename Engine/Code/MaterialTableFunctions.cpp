@@ -0,0 +1,406 @@
+#include "engine.h"
+#include "MaterialTableFunctions.h"
+#include "MipmapFunctions.h"
+
+namespace MaterialTables
+{
+    // Format, size and levels of a texture, the levels stop at MAX_LEVEL or 1x1
+    static void GetTextureLayout(GLuint handle, GLenum& internalFormat, ivec2& size, u32& levelCount, u64& bytes)
+    {
+        GLint format = 0, maxLevel = 0;
+        glBindTexture(GL_TEXTURE_2D, handle);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &size.x);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &size.y);
+        glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &maxLevel);
+        internalFormat = (GLenum)format;
+        levelCount = glm::min((u32)maxLevel + 1, Mipmaps::GetLevelCount(size));
+
+        bytes = 0;
+        for (u32 level = 0; level < levelCount; ++level)
+        {
+            GLint compressed = 0, levelBytes = 0;
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED, &compressed);
+            if (compressed)
+            {
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &levelBytes);
+            }
+            else
+            {
+                // RGB8 is padded to 4 bytes by the drivers
+                levelBytes = glm::max(size.x >> level, 1) * glm::max(size.y >> level, 1) * 4;
+            }
+            bytes += levelBytes;
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    static GLuint CreateArrayTexture(const MaterialTextureArray& array, u32 capacity)
+    {
+        GLuint handle;
+        glGenTextures(1, &handle);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, handle);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, array.levelCount, array.internalFormat, array.size.x, array.size.y, capacity);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        return handle;
+    }
+
+    static void CopyLayer(const MaterialTextureArray& array, GLuint source, GLenum sourceTarget, u32 sourceLayer, u32 sourceLevelOffset,
+        GLuint destination, u32 destinationLayer)
+    {
+        for (u32 level = 0; level < array.levelCount; ++level)
+        {
+            glCopyImageSubData(source, sourceTarget, level + sourceLevelOffset, 0, 0, sourceLayer, destination, GL_TEXTURE_2D_ARRAY, level, 0, 0, destinationLayer,
+                glm::max(array.size.x >> level, 1), glm::max(array.size.y >> level, 1), 1);
+        }
+    }
+
+    // Reallocates the array with room for more layers, the used ones are copied over
+    static void Grow(MaterialTable& table, MaterialTextureArray& array, u32 capacity)
+    {
+        GLuint handle = CreateArrayTexture(array, capacity);
+
+        if (array.handle != 0)
+        {
+            for (u32 level = 0; level < array.levelCount && array.layerCount > 0; ++level)
+            {
+                glCopyImageSubData(array.handle, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0, handle, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0,
+                    glm::max(array.size.x >> level, 1), glm::max(array.size.y >> level, 1), array.layerCount);
+            }
+            glDeleteTextures(1, &array.handle);
+            table.memoryBytes -= array.capacity * array.layerBytes;
+        }
+
+        array.handle = handle;
+        array.capacity = capacity;
+        table.memoryBytes += array.capacity * array.layerBytes;
+    }
+
+    // Moves the layers in use to a smaller array, the texture slots in it follow their layer
+    static void Compact(MaterialTable& table, i32 arrayIdx)
+    {
+        MaterialTextureArray& array = table.arrays[arrayIdx];
+        const u32 usedCount = array.layerCount - (u32)array.freeLayers.size();
+        const u32 capacity = glm::max((u32)MATERIAL_TABLE_FIRST_CAPACITY, usedCount * 2);
+        GLuint handle = CreateArrayTexture(array, capacity);
+
+        u32 nextLayer = 0;
+        for (MaterialLayer& layer : table.layers)
+        {
+            if (layer.array != arrayIdx) continue;
+
+            CopyLayer(array, array.handle, GL_TEXTURE_2D_ARRAY, layer.layer, 0, handle, nextLayer);
+            layer.layer = (i32)nextLayer++;
+        }
+        ASSERT(nextLayer == usedCount, "The texture slots and the free layers of the array disagree");
+
+        glDeleteTextures(1, &array.handle);
+        table.memoryBytes -= array.capacity * array.layerBytes;
+        array.handle = handle;
+        array.capacity = capacity;
+        array.layerCount = usedCount;
+        array.freeLayers.clear();
+        table.memoryBytes += array.capacity * array.layerBytes;
+        table.dirty = true;
+    }
+
+    static void RemoveLayer(MaterialTable& table, MaterialLayer& layer)
+    {
+        if (layer.array < 0) return;
+
+        const i32 arrayIdx = layer.array;
+        MaterialTextureArray& array = table.arrays[arrayIdx];
+        array.freeLayers.push_back(layer.layer);
+        layer.array = -1;
+        layer.layer = -1;
+        layer.levelOffset = 0;
+        table.dirty = true;
+
+        // Arrays of a size the streamed textures moved out of are dropped once empty, and
+        // shrunk once mostly free, so the budget of the streaming sees the memory come back
+        const u32 usedCount = array.layerCount - (u32)array.freeLayers.size();
+        if (usedCount == 0)
+        {
+            glDeleteTextures(1, &array.handle);
+            table.memoryBytes -= array.capacity * array.layerBytes;
+            array = MaterialTextureArray{};
+        }
+        else if (array.capacity > MATERIAL_TABLE_FIRST_CAPACITY && usedCount <= array.capacity / 4)
+        {
+            Compact(table, arrayIdx);
+        }
+    }
+
+    // Every array slot in use: an array of the same format the lower levels of the texture fit,
+    // the largest one. Returns the levels to skip, or -1 with arrayIdx unset.
+    static i32 FindReducedArray(const MaterialTable& table, GLenum internalFormat, ivec2 size, u32 levelCount, i32& arrayIdx)
+    {
+        for (u32 offset = 1; offset < levelCount; ++offset)
+        {
+            const ivec2 levelSize = glm::max(ivec2(size.x >> offset, size.y >> offset), ivec2(1));
+            for (i32 i = 0; i < (i32)table.maxArrays; ++i)
+            {
+                const MaterialTextureArray& array = table.arrays[i];
+                if (array.handle != 0 && array.internalFormat == internalFormat && array.size == levelSize && array.levelCount == levelCount - offset)
+                {
+                    arrayIdx = i;
+                    return (i32)offset;
+                }
+            }
+        }
+        return -1;
+    }
+
+    // Copies a texture into a free layer of the array matching its layout. Fails with every array slot
+    // in use and no smaller array of its format.
+    static bool PlaceTexture(MaterialTable& table, GLuint handle, MaterialLayer& layer)
+    {
+        GLenum internalFormat;
+        ivec2 size;
+        u32 levelCount;
+        u64 layerBytes;
+        GetTextureLayout(handle, internalFormat, size, levelCount, layerBytes);
+
+        i32 arrayIdx = -1;
+        i32 freeIdx = -1;
+        i32 levelOffset = 0;
+        for (i32 i = 0; i < (i32)table.maxArrays; ++i)
+        {
+            const MaterialTextureArray& array = table.arrays[i];
+            if (array.handle == 0)
+            {
+                if (freeIdx < 0) freeIdx = i;
+            }
+            else if (array.internalFormat == internalFormat && array.size == size && array.levelCount == levelCount)
+            {
+                arrayIdx = i;
+                break;
+            }
+        }
+
+        if (arrayIdx < 0 && freeIdx < 0)
+        {
+            levelOffset = FindReducedArray(table, internalFormat, size, levelCount, arrayIdx);
+            if (levelOffset < 0) return false;
+        }
+        else if (arrayIdx < 0)
+        {
+            arrayIdx = freeIdx;
+            MaterialTextureArray& array = table.arrays[arrayIdx];
+            array.internalFormat = internalFormat;
+            array.size = size;
+            array.levelCount = levelCount;
+            array.layerBytes = layerBytes;
+            Grow(table, array, MATERIAL_TABLE_FIRST_CAPACITY);
+        }
+
+        MaterialTextureArray& array = table.arrays[arrayIdx];
+        u32 layerIdx;
+        if (!array.freeLayers.empty())
+        {
+            layerIdx = array.freeLayers.back();
+            array.freeLayers.pop_back();
+        }
+        else
+        {
+            if (array.layerCount == array.capacity)
+                Grow(table, array, array.capacity * 2);
+            layerIdx = array.layerCount++;
+        }
+
+        CopyLayer(array, handle, GL_TEXTURE_2D, 0, levelOffset, array.handle, layerIdx);
+
+        layer.array = arrayIdx;
+        layer.layer = (i32)layerIdx;
+        layer.levelOffset = (u32)levelOffset;
+        return true;
+    }
+
+    // The fallback textures are shared by the slots still loading, they are never released
+    static bool IsPlaceholder(const App& app, u32 textureIdx)
+    {
+        const u32 placeholders[] = { app.whiteTexIdx, app.blackTexIdx, app.normalTexIdx, app.magentaTexIdx };
+        for (u32 placeholderIdx : placeholders)
+        {
+            if (placeholderIdx >= app.textures.size()) continue;
+            if (textureIdx == placeholderIdx || app.textures[textureIdx].handle == app.textures[placeholderIdx].handle)
+                return true;
+        }
+        return false;
+    }
+
+    static glm::ivec2 GetTextureSlot(const MaterialTable& table, u32 textureIdx)
+    {
+        if (textureIdx >= table.layers.size()) return glm::ivec2(-1);
+        return glm::ivec2(table.layers[textureIdx].array, table.layers[textureIdx].layer);
+    }
+
+    void Init(MaterialTable& table)
+    {
+        glGenBuffers(1, &table.materialBuffer);
+        table.dirty = true;
+    }
+
+    void Update(App& app, MaterialTable& table)
+    {
+        table.layers.resize(app.textures.size(), MaterialLayer{ 0, -1, -1, 0 });
+        if (table.materials.size() != app.materials.size())
+            table.dirty = true;
+
+        std::vector<bool> used(app.textures.size(), false);
+        for (const Material& material : app.materials)
+        {
+            const u32 textureIndices[] = { material.albedoTextureIdx, material.emissiveTextureIdx, material.specularTextureIdx,
+                material.normalsTextureIdx, material.bumpTextureIdx };
+            for (u32 textureIdx : textureIndices)
+            {
+                if (textureIdx < used.size()) used[textureIdx] = true;
+            }
+        }
+
+        for (u32 textureIdx = 0; textureIdx < app.textures.size(); ++textureIdx)
+        {
+            Texture& texture = app.textures[textureIdx];
+            MaterialLayer& layer = table.layers[textureIdx];
+            if (!used[textureIdx] || texture.handle == 0 || texture.handle == layer.sourceHandle)
+                continue;
+
+            RemoveLayer(table, layer);
+
+            // Tried again every frame, freed or compacted arrays give their slot back
+            if (!PlaceTexture(table, texture.handle, layer))
+            {
+                layer.sourceHandle = 0;
+                if (!table.fullWarned)
+                {
+                    ELOG("Material table: more than %u texture layouts, some material textures won't be sampled", table.maxArrays);
+                    table.fullWarned = true;
+                }
+                continue;
+            }
+            layer.sourceHandle = texture.handle;
+            table.dirty = true;
+
+            // Only the layer is sampled from now on, the array accounts for its memory
+            if (!IsPlaceholder(app, textureIdx))
+            {
+                glDeleteTextures(1, &texture.handle);
+                texture.handle = 0;
+                texture.memoryBytes = 0;
+                layer.sourceHandle = 0;
+            }
+        }
+
+        if (!table.dirty) return;
+
+        table.materials.resize(app.materials.size());
+        for (u32 i = 0; i < app.materials.size(); ++i)
+        {
+            const Material& material = app.materials[i];
+            GpuMaterial& gpuMaterial = table.materials[i];
+            gpuMaterial.albedo = GetTextureSlot(table, material.albedoTextureIdx);
+            gpuMaterial.emissive = GetTextureSlot(table, material.emissiveTextureIdx);
+            gpuMaterial.specular = GetTextureSlot(table, material.specularTextureIdx);
+            gpuMaterial.normals = GetTextureSlot(table, material.normalsTextureIdx);
+            gpuMaterial.bump = GetTextureSlot(table, material.bumpTextureIdx);
+        }
+
+        // Binding a zero sized range is an error, empty tables keep one entry
+        u32 size = (u32)(table.materials.size() * sizeof(GpuMaterial));
+        glBindBuffer(GL_COPY_WRITE_BUFFER, table.materialBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, glm::max(size, (u32)sizeof(GpuMaterial)), NULL, GL_DYNAMIC_DRAW);
+        if (size > 0)
+            glBufferSubData(GL_COPY_WRITE_BUFFER, 0, size, table.materials.data());
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        table.dirty = false;
+    }
+
+    void Bind(const App& app, const MaterialTable& table, const Program& program)
+    {
+        GLint units[MATERIAL_TABLE_MAX_ARRAYS];
+        for (u32 i = 0; i < MATERIAL_TABLE_MAX_ARRAYS; ++i)
+        {
+            units[i] = i;
+            glActiveTexture(GL_TEXTURE0 + i);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, table.arrays[i].handle);
+            glBindSampler(i, app.materialSampler);
+        }
+        glActiveTexture(GL_TEXTURE0);
+
+        glUniform1iv(program.uniformLocations[Uniform_MaterialArrays], MATERIAL_TABLE_MAX_ARRAYS, units);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(8), table.materialBuffer);
+    }
+
+    void Unbind()
+    {
+        // The passes after the geometry bind other textures to these units
+        for (u32 i = 0; i < MATERIAL_TABLE_MAX_ARRAYS; ++i)
+        {
+            glBindSampler(i, 0);
+        }
+    }
+
+    u32 GetArrayCount(const MaterialTable& table)
+    {
+        u32 count = 0;
+        for (const MaterialTextureArray& array : table.arrays)
+        {
+            if (array.handle != 0) count++;
+        }
+        return count;
+    }
+
+    MaterialTableReport Validate(const App& app, const MaterialTable& table)
+    {
+        MaterialTableReport report = {};
+
+        std::vector<bool> used(app.textures.size(), false);
+        for (const Material& material : app.materials)
+        {
+            const u32 textureIndices[] = { material.albedoTextureIdx, material.emissiveTextureIdx, material.specularTextureIdx,
+                material.normalsTextureIdx, material.bumpTextureIdx };
+            for (u32 textureIdx : textureIndices)
+            {
+                if (textureIdx < used.size()) used[textureIdx] = true;
+            }
+        }
+
+        std::vector<std::vector<bool>> taken(MATERIAL_TABLE_MAX_ARRAYS);
+        for (u32 i = 0; i < MATERIAL_TABLE_MAX_ARRAYS; ++i)
+        {
+            const MaterialTextureArray& array = table.arrays[i];
+            taken[i].assign(array.layerCount, false);
+            for (u32 freeLayer : array.freeLayers)
+            {
+                if (freeLayer < array.layerCount) taken[i][freeLayer] = true;
+            }
+        }
+
+        for (u32 textureIdx = 0; textureIdx < table.layers.size(); ++textureIdx)
+        {
+            const MaterialLayer& layer = table.layers[textureIdx];
+            if (layer.array < 0)
+            {
+                if (textureIdx < used.size() && used[textureIdx]) report.unplaced++;
+                continue;
+            }
+
+            const MaterialTextureArray& array = table.arrays[layer.array];
+            if (array.handle == 0 || layer.layer < 0 || (u32)layer.layer >= array.layerCount || taken[layer.array][layer.layer])
+            {
+                report.errors++;
+                continue;
+            }
+            taken[layer.array][layer.layer] = true;
+
+            if (textureIdx < used.size() && used[textureIdx])
+            {
+                report.placed++;
+                if (layer.levelOffset > 0) report.reduced++;
+            }
+        }
+
+        return report;
+    }
+}
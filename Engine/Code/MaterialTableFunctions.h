@@ -0,0 +1,100 @@
+#ifndef MATERIAL_TABLE_FUNC
+#define MATERIAL_TABLE_FUNC
+
+#include "Globals.h"
+
+//
+// Material textures packed into 2D texture arrays, one array per internal format, size
+// and level count, so the geometry passes bind every material once instead of a texture
+// per draw. Each frame the texture slots used by a material whose handle changed (async
+// loads, streamed mips) get copied with glCopyImageSubData into a layer of the matching
+// array, then their own texture is released. The layer of each material texture is kept
+// in an SSBO indexed by material, and the draws find their material through a list
+// parallel to the visible instances, so draws with different materials share the bind
+// state and can go in the same glMultiDrawElementsIndirect.
+//
+// Streaming moves a texture between arrays as its resident size changes. Empty arrays are
+// freed and sparse ones compacted, so their slots and memory get reused. When every slot
+// is taken, a texture goes into an array of its format with a smaller size, without its
+// top levels, and is only left unsampled (white) when there is none.
+//
+
+// Arrays bound at once, texture units 0..N-1. Matches uMaterialArrays in the geometry shaders.
+#define MATERIAL_TABLE_MAX_ARRAYS 16
+
+#define MATERIAL_TABLE_FIRST_CAPACITY 4
+
+struct MaterialTextureArray
+{
+    GLuint           handle;        // 0 for a free array slot
+    GLenum           internalFormat;
+    ivec2            size;
+    u32              levelCount;
+    u64              layerBytes;
+    u32              capacity;      // layers allocated
+    u32              layerCount;    // layers ever used, the free ones are in freeLayers
+    std::vector<u32> freeLayers;
+};
+
+// Where the texture of a texture slot lives
+struct MaterialLayer
+{
+    GLuint sourceHandle; // texture copied, 0 once released
+    i32    array;        // -1 when not placed
+    i32    layer;
+    u32    levelOffset;  // top levels dropped to fit a smaller array, 0 when the array matches
+};
+
+// std430 layout shared with the geometry shaders, array and layer of each texture
+struct GpuMaterial
+{
+    glm::ivec2 albedo;
+    glm::ivec2 emissive;
+    glm::ivec2 specular;
+    glm::ivec2 normals;
+    glm::ivec2 bump;
+};
+
+// Placement of the texture slots used by the materials, see Validate()
+struct MaterialTableReport
+{
+    u32 placed;
+    u32 reduced;  // placed without their top levels
+    u32 unplaced; // sampled as white
+    u32 errors;   // layers out of range, freed or shared by two slots
+};
+
+struct MaterialTable
+{
+    u32                        maxArrays = MATERIAL_TABLE_MAX_ARRAYS; // lower it to exercise the overflow
+    MaterialTextureArray       arrays[MATERIAL_TABLE_MAX_ARRAYS];
+    std::vector<MaterialLayer> layers;    // per texture slot
+    std::vector<GpuMaterial>   materials; // per material
+    GLuint                     materialBuffer;
+
+    bool dirty;
+    bool fullWarned;
+    u64  memoryBytes; // allocated layers of every array, counted by App::GetTextureMemoryBytes
+};
+
+struct App;
+
+namespace MaterialTables
+{
+    void Init(MaterialTable& table);
+
+    // Places the texture slots that changed and uploads the materials when needed
+    void Update(App& app, MaterialTable& table);
+
+    // Binds the arrays, the material sampler and the material SSBO for the bound program
+    void Bind(const App& app, const MaterialTable& table, const Program& program);
+
+    void Unbind();
+
+    u32 GetArrayCount(const MaterialTable& table);
+
+    // Checks the layer of every texture slot used by a material
+    MaterialTableReport Validate(const App& app, const MaterialTable& table);
+}
+
+#endif // !MATERIAL_TABLE_FUNC
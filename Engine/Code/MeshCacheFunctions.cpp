@@ -0,0 +1,340 @@
+#include "engine.h"
+#include "MeshCacheFunctions.h"
+#include "VertexFormatFunctions.h"
+
+namespace MeshCache
+{
+    static void CopyString(char* dst, u32 dstSize, const std::string& src)
+    {
+        if (src.size() >= dstSize)
+        {
+            ELOG("MeshCache: string %s is too long and will be truncated", src.c_str());
+        }
+        strncpy(dst, src.c_str(), dstSize - 1);
+        dst[dstSize - 1] = '\0';
+    }
+
+    // The material library isn't exposed by Assimp, look for the mtllib line in the .obj
+    static std::string FindMaterialLibrary(const char* filename)
+    {
+        FILE* file = fopen(filename, "rb");
+        if (!file) return "";
+
+        std::string materialLib;
+        char line[512];
+        while (fgets(line, sizeof(line), file))
+        {
+            if (strncmp(line, "mtllib ", 7) == 0)
+            {
+                materialLib = line + 7;
+                while (!materialLib.empty() && (materialLib.back() == '\n' || materialLib.back() == '\r' || materialLib.back() == ' '))
+                    materialLib.pop_back();
+                break;
+            }
+        }
+        fclose(file);
+
+        if (materialLib.empty()) return "";
+
+        std::string directory = filename;
+        size_t separator = directory.find_last_of("/\\");
+        return separator != std::string::npos ? directory.substr(0, separator + 1) + materialLib : materialLib;
+    }
+
+    std::string GetCachePath(const char* filename)
+    {
+        return std::string(filename) + MESH_CACHE_EXTENSION;
+    }
+
+    bool Write(const char* filename, const ModelData& modelData)
+    {
+        const std::vector<SubMesh>& submeshes = modelData.mesh.submeshes;
+
+        MeshCacheHeader header = {};
+        header.magic = MESH_CACHE_MAGIC;
+        header.version = MESH_CACHE_VERSION;
+        header.sourceTimestamp = GetFileLastWriteTimestamp(filename);
+
+        std::string materialLib = FindMaterialLibrary(filename);
+        CopyString(header.materialLibPath, sizeof(header.materialLibPath), materialLib);
+        header.materialLibTimestamp = materialLib.empty() ? 0 : GetFileLastWriteTimestamp(materialLib.c_str());
+
+        std::vector<MeshCacheSubMesh> cachedSubmeshes(submeshes.size());
+        u32 vertexDataSize = 0;
+        u32 indexDataSize = 0;
+        for (u32 i = 0; i < submeshes.size(); ++i)
+        {
+            const SubMesh& submesh = submeshes[i];
+            MeshCacheSubMesh& cached = cachedSubmeshes[i];
+
+            if (submesh.vertexBufferLayout.attributes.size() > MESH_CACHE_MAX_ATTRIBUTES)
+            {
+                ELOG("MeshCache: %s has too many vertex attributes to be cooked", filename);
+                return false;
+            }
+
+            cached = MeshCacheSubMesh{};
+            cached.materialIdx = i < modelData.materialIdx.size() ? modelData.materialIdx[i] : 0;
+            cached.vertexOffset = vertexDataSize;
+            cached.indexOffset = indexDataSize;
+            cached.indexCount = (u32)submesh.indices.size();
+            cached.aabbMin = submesh.aabbMin;
+            cached.aabbMax = submesh.aabbMax;
+            cached.stride = submesh.vertexBufferLayout.stride;
+            cached.attributeCount = (u8)submesh.vertexBufferLayout.attributes.size();
+            for (u32 a = 0; a < cached.attributeCount; ++a)
+            {
+                cached.attributes[a] = submesh.vertexBufferLayout.attributes[a];
+            }
+
+            vertexDataSize += (u32)submesh.vertices.size();
+            indexDataSize += submesh.indices.size() * sizeof(u32);
+        }
+
+        std::vector<MeshCacheMaterial> cachedMaterials(modelData.materials.size());
+        for (u32 i = 0; i < modelData.materials.size(); ++i)
+        {
+            const MaterialData& material = modelData.materials[i];
+            MeshCacheMaterial& cached = cachedMaterials[i];
+
+            cached = MeshCacheMaterial{};
+            CopyString(cached.name, sizeof(cached.name), material.name);
+            cached.albedo = material.albedo;
+            cached.emissive = material.emissive;
+            cached.smoothness = material.smoothness;
+            CopyString(cached.albedoTexture, sizeof(cached.albedoTexture), material.albedoTexture);
+            CopyString(cached.emissiveTexture, sizeof(cached.emissiveTexture), material.emissiveTexture);
+            CopyString(cached.specularTexture, sizeof(cached.specularTexture), material.specularTexture);
+            CopyString(cached.normalsTexture, sizeof(cached.normalsTexture), material.normalsTexture);
+            CopyString(cached.bumpTexture, sizeof(cached.bumpTexture), material.bumpTexture);
+        }
+
+        header.submeshCount = (u32)cachedSubmeshes.size();
+        header.materialCount = (u32)cachedMaterials.size();
+        header.submeshesOffset = sizeof(MeshCacheHeader);
+        header.materialsOffset = header.submeshesOffset + header.submeshCount * sizeof(MeshCacheSubMesh);
+        header.vertexDataOffset = BufferManager::Align(header.materialsOffset + header.materialCount * sizeof(MeshCacheMaterial), 16);
+        header.vertexDataSize = vertexDataSize;
+        header.indexDataOffset = BufferManager::Align(header.vertexDataOffset + vertexDataSize, 16);
+        header.indexDataSize = indexDataSize;
+
+        std::string cachePath = GetCachePath(filename);
+        FILE* file = fopen(cachePath.c_str(), "wb");
+        if (!file)
+        {
+            ELOG("MeshCache: could not write %s", cachePath.c_str());
+            return false;
+        }
+
+        const u8 padding[16] = {};
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(cachedSubmeshes.data(), sizeof(MeshCacheSubMesh), cachedSubmeshes.size(), file);
+        fwrite(cachedMaterials.data(), sizeof(MeshCacheMaterial), cachedMaterials.size(), file);
+        fwrite(padding, 1, header.vertexDataOffset - (u32)ftell(file), file);
+        for (const SubMesh& submesh : submeshes)
+        {
+            fwrite(submesh.vertices.data(), 1, submesh.vertices.size(), file);
+        }
+        fwrite(padding, 1, header.indexDataOffset - (u32)ftell(file), file);
+        for (const SubMesh& submesh : submeshes)
+        {
+            fwrite(submesh.indices.data(), sizeof(u32), submesh.indices.size(), file);
+        }
+        fclose(file);
+
+        return true;
+    }
+
+    static bool IsUpToDate(const char* filename, const MeshCacheHeader& header)
+    {
+        if (header.magic != MESH_CACHE_MAGIC || header.version != MESH_CACHE_VERSION)
+            return false;
+
+        if (header.sourceTimestamp != GetFileLastWriteTimestamp(filename))
+            return false;
+
+        if (header.materialLibPath[0] != '\0' &&
+            header.materialLibTimestamp != GetFileLastWriteTimestamp(header.materialLibPath))
+            return false;
+
+        return true;
+    }
+
+    static bool IsTerminated(const char* string, u32 size)
+    {
+        return memchr(string, '\0', size) != NULL;
+    }
+
+    // Checks every offset, size and index CreateModel() trusts against the mapping
+    static bool IsValid(const char* filename, const MappedFile& file)
+    {
+        const MeshCacheHeader* header = (const MeshCacheHeader*)file.data;
+
+        if ((u64)header->submeshesOffset + (u64)header->submeshCount * sizeof(MeshCacheSubMesh) > file.size ||
+            (u64)header->materialsOffset + (u64)header->materialCount * sizeof(MeshCacheMaterial) > file.size ||
+            (u64)header->vertexDataOffset + header->vertexDataSize > file.size ||
+            (u64)header->indexDataOffset + header->indexDataSize > file.size)
+        {
+            ELOG("MeshCache: %s has tables or data past the end of the file", filename);
+            return false;
+        }
+
+        const MeshCacheSubMesh* cachedSubmeshes = (const MeshCacheSubMesh*)(file.data + header->submeshesOffset);
+        for (u32 i = 0; i < header->submeshCount; ++i)
+        {
+            const MeshCacheSubMesh& cached = cachedSubmeshes[i];
+            u32 vertexEnd = i + 1 < header->submeshCount ? cachedSubmeshes[i + 1].vertexOffset : header->vertexDataSize;
+
+            if (cached.attributeCount > MESH_CACHE_MAX_ATTRIBUTES ||
+                cached.vertexOffset > vertexEnd || vertexEnd > header->vertexDataSize ||
+                (u64)cached.indexOffset + (u64)cached.indexCount * sizeof(u32) > header->indexDataSize ||
+                cached.materialIdx >= header->materialCount)
+            {
+                ELOG("MeshCache: %s has an invalid submesh %u", filename, i);
+                return false;
+            }
+
+            // The arenas divide by the stride and the GPU fetches every attribute of every indexed vertex
+            if (cached.stride == 0 || (vertexEnd - cached.vertexOffset) % cached.stride != 0 ||
+                (header->indexDataOffset + cached.indexOffset) % sizeof(u32) != 0)
+            {
+                ELOG("MeshCache: %s has an invalid vertex layout in submesh %u", filename, i);
+                return false;
+            }
+            for (u32 a = 0; a < cached.attributeCount; ++a)
+            {
+                const VertexBufferAttribute& attribute = cached.attributes[a];
+                if (attribute.type > VertexAttributeType_Half || attribute.componentCount == 0 || attribute.componentCount > 4 ||
+                    attribute.offset + VertexFormat::GetAttributeSize(attribute) > cached.stride)
+                {
+                    ELOG("MeshCache: %s has an invalid vertex attribute in submesh %u", filename, i);
+                    return false;
+                }
+            }
+
+            const u32 vertexCount = (vertexEnd - cached.vertexOffset) / cached.stride;
+            const u32* indices = (const u32*)(file.data + header->indexDataOffset + cached.indexOffset);
+            for (u32 j = 0; j < cached.indexCount; ++j)
+            {
+                if (indices[j] >= vertexCount)
+                {
+                    ELOG("MeshCache: %s has an index past the vertices of submesh %u", filename, i);
+                    return false;
+                }
+            }
+        }
+
+        const MeshCacheMaterial* cachedMaterials = (const MeshCacheMaterial*)(file.data + header->materialsOffset);
+        for (u32 i = 0; i < header->materialCount; ++i)
+        {
+            const MeshCacheMaterial& cached = cachedMaterials[i];
+            if (!IsTerminated(cached.name, sizeof(cached.name)) ||
+                !IsTerminated(cached.albedoTexture, sizeof(cached.albedoTexture)) ||
+                !IsTerminated(cached.emissiveTexture, sizeof(cached.emissiveTexture)) ||
+                !IsTerminated(cached.specularTexture, sizeof(cached.specularTexture)) ||
+                !IsTerminated(cached.normalsTexture, sizeof(cached.normalsTexture)) ||
+                !IsTerminated(cached.bumpTexture, sizeof(cached.bumpTexture)))
+            {
+                ELOG("MeshCache: %s has an unterminated string in material %u", filename, i);
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    MappedFile MapModel(const char* filename)
+    {
+        MappedFile file = MapFile(GetCachePath(filename).c_str());
+        if (!file.data) return file;
+
+        // A corrupt or hand edited file is rejected as a whole, the caller imports the source model instead
+        const MeshCacheHeader* header = (const MeshCacheHeader*)file.data;
+        if (file.size < sizeof(MeshCacheHeader) ||
+            !IsTerminated(header->materialLibPath, sizeof(header->materialLibPath)) ||
+            !IsUpToDate(filename, *header) ||
+            !IsValid(filename, file))
+        {
+            UnmapFile(file);
+            return MappedFile{};
+        }
+
+        return file;
+    }
+
+    void CreateModel(App* app, u32 modelIdx, const MappedFile& file)
+    {
+        const MeshCacheHeader* header = (const MeshCacheHeader*)file.data;
+        const MeshCacheSubMesh* cachedSubmeshes = (const MeshCacheSubMesh*)(file.data + header->submeshesOffset);
+        const MeshCacheMaterial* cachedMaterials = (const MeshCacheMaterial*)(file.data + header->materialsOffset);
+
+        Model& model = app->models[modelIdx];
+        Mesh& mesh = app->meshes[model.meshIdx];
+
+        // Geometry goes straight from the mapping to the arenas
+        const u8* vertexData = file.data + header->vertexDataOffset;
+        const u8* indexData = file.data + header->indexDataOffset;
+
+        for (u32 i = 0; i < header->submeshCount; ++i)
+        {
+            const MeshCacheSubMesh& cached = cachedSubmeshes[i];
+            u32 vertexEnd = i + 1 < header->submeshCount ? cachedSubmeshes[i + 1].vertexOffset : header->vertexDataSize;
+
+            SubMesh submesh = {};
+            submesh.vertexBufferLayout.stride = cached.stride;
+            for (u32 a = 0; a < cached.attributeCount; ++a)
+            {
+                submesh.vertexBufferLayout.attributes.push_back(cached.attributes[a]);
+            }
+            submesh.indexCount = cached.indexCount;
+            submesh.aabbMin = cached.aabbMin;
+            submesh.aabbMax = cached.aabbMax;
+
+            submesh.vertexArenaIdx = GeometryArenaManager::FindVertexArena(app->geometryArena, submesh.vertexBufferLayout);
+            submesh.baseVertex = GeometryArenaManager::AllocateVertices(app->geometryArena, submesh.vertexArenaIdx,
+                vertexData + cached.vertexOffset, vertexEnd - cached.vertexOffset);
+            submesh.firstIndex = GeometryArenaManager::AllocateIndices(app->geometryArena,
+                indexData + cached.indexOffset, cached.indexCount * sizeof(u32));
+
+            mesh.submeshes.push_back(submesh);
+        }
+        ModelLoader::ComputeMeshBounds(mesh);
+        app->sceneGeneration++;
+
+        u32 baseMeshMaterialIndex = (u32)app->materials.size();
+        for (u32 i = 0; i < header->materialCount; ++i)
+        {
+            const MeshCacheMaterial& cached = cachedMaterials[i];
+
+            MaterialData material = {};
+            material.name = cached.name;
+            material.albedo = cached.albedo;
+            material.emissive = cached.emissive;
+            material.smoothness = cached.smoothness;
+            material.albedoTexture = cached.albedoTexture;
+            material.emissiveTexture = cached.emissiveTexture;
+            material.specularTexture = cached.specularTexture;
+            material.normalsTexture = cached.normalsTexture;
+            material.bumpTexture = cached.bumpTexture;
+            ModelLoader::CreateMaterial(app, material);
+        }
+        for (u32 i = 0; i < header->submeshCount; ++i)
+        {
+            model.materialIdx.push_back(baseMeshMaterialIndex + cachedSubmeshes[i].materialIdx);
+        }
+    }
+
+    bool Cook(const char* filename)
+    {
+        ModelData modelData;
+        if (!ModelLoader::ImportModel(filename, modelData))
+            return false;
+
+        bool written = Write(filename, modelData);
+        if (written)
+        {
+            ILOG("Cooked %s into %s", filename, GetCachePath(filename).c_str());
+        }
+        return written;
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef MESH_CACHE_FUNC
+#define MESH_CACHE_FUNC
+
+#include "Globals.h"
+#include "ModelLoadingFunctions.h"
+
+//
+// Cooked meshes: the processed submeshes of a model (already triangulated, with
+// normals and tangent space, in the compact vertex format) stored next to the
+// source file as <model>.mesh.
+// Every record has a fixed size so the file can be used straight from a memory
+// mapping, and the vertices and indices of each submesh are copied from it into the
+// shared geometry arenas.
+//
+
+#define MESH_CACHE_EXTENSION ".mesh"
+#define MESH_CACHE_MAGIC     0x4853454d // 'MESH'
+#define MESH_CACHE_VERSION   4
+
+#define MESH_CACHE_MAX_ATTRIBUTES 8
+#define MESH_CACHE_PATH_LENGTH    128
+
+struct MeshCacheHeader
+{
+    u32  magic;
+    u32  version;
+    u64  sourceTimestamp;
+    u64  materialLibTimestamp;
+    char materialLibPath[MESH_CACHE_PATH_LENGTH];
+    u32  submeshCount;
+    u32  materialCount;
+    u32  submeshesOffset;
+    u32  materialsOffset;
+    u32  vertexDataOffset;
+    u32  vertexDataSize;
+    u32  indexDataOffset;
+    u32  indexDataSize;
+};
+
+struct MeshCacheSubMesh
+{
+    u32                   materialIdx;
+    u32                   vertexOffset;
+    u32                   indexOffset;
+    u32                   indexCount;
+    vec3                  aabbMin;
+    vec3                  aabbMax;
+    u8                    stride;
+    u8                    attributeCount;
+    VertexBufferAttribute attributes[MESH_CACHE_MAX_ATTRIBUTES];
+};
+
+struct MeshCacheMaterial
+{
+    char name[64];
+    vec3 albedo;
+    vec3 emissive;
+    f32  smoothness;
+    char albedoTexture[MESH_CACHE_PATH_LENGTH];
+    char emissiveTexture[MESH_CACHE_PATH_LENGTH];
+    char specularTexture[MESH_CACHE_PATH_LENGTH];
+    char normalsTexture[MESH_CACHE_PATH_LENGTH];
+    char bumpTexture[MESH_CACHE_PATH_LENGTH];
+};
+
+namespace MeshCache
+{
+    std::string GetCachePath(const char* filename);
+
+    bool Write(const char* filename, const ModelData& modelData);
+
+    // Maps the cooked mesh of a model, or returns an empty mapping if there is none, it is
+    // older than the .obj/.mtl files or any of its offsets, sizes, strides, indices or strings is
+    // out of bounds. It doesn't touch OpenGL, so workers can call it.
+    MappedFile MapModel(const char* filename);
+
+    // Uploads a mapped cooked mesh into a reserved model (see ModelLoader::ReserveModel()).
+    // The caller unmaps the file afterwards.
+    void CreateModel(App* app, u32 modelIdx, const MappedFile& file);
+
+    // Offline cooking, imports the model and writes its cooked mesh without needing a GL context.
+    bool Cook(const char* filename);
+}
+
+#endif // !MESH_CACHE_FUNC
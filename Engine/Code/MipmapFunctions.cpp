@@ -0,0 +1,170 @@
+#include "MipmapFunctions.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define MIPMAPS_SSE
+#include <emmintrin.h>
+#endif
+
+#define LINEAR_TO_SRGB_ENTRIES 4096
+
+struct ConversionTables
+{
+    f32 srgbToLinear[256];
+    f32 unormToFloat[256];
+    u8  linearToSrgb[LINEAR_TO_SRGB_ENTRIES];
+
+    ConversionTables()
+    {
+        for (u32 i = 0; i < 256; ++i)
+        {
+            f32 value = i / 255.0f;
+            srgbToLinear[i] = value <= 0.04045f ? value / 12.92f : powf((value + 0.055f) / 1.055f, 2.4f);
+            unormToFloat[i] = value;
+        }
+        for (u32 i = 0; i < LINEAR_TO_SRGB_ENTRIES; ++i)
+        {
+            f32 linear = i / (f32)(LINEAR_TO_SRGB_ENTRIES - 1);
+            f32 value = linear <= 0.0031308f ? linear * 12.92f : 1.055f * powf(linear, 1.0f / 2.4f) - 0.055f;
+            linearToSrgb[i] = (u8)glm::clamp(value * 255.0f + 0.5f, 0.0f, 255.0f);
+        }
+    }
+};
+
+// Built on first use, thread safe since C++11
+static const ConversionTables& GetTables()
+{
+    static ConversionTables tables;
+    return tables;
+}
+
+#ifdef MIPMAPS_SSE
+static inline __m128 LoadTexel(const u8* texel, const f32* rgbTable, const f32* alphaTable)
+{
+    return _mm_setr_ps(rgbTable[texel[0]], rgbTable[texel[1]], rgbTable[texel[2]], alphaTable[texel[3]]);
+}
+#endif
+
+namespace Mipmaps
+{
+    u32 GetLevelCount(ivec2 size)
+    {
+        return 1 + (u32)log2f((f32)glm::max(glm::max(size.x, size.y), 1));
+    }
+
+    std::vector<u8> ExpandToRgba(const Image& image)
+    {
+        std::vector<u8> rgba(image.size.x * image.size.y * 4);
+        const u8* pixels = (const u8*)image.pixels;
+        for (i32 y = 0; y < image.size.y; ++y)
+        {
+            for (i32 x = 0; x < image.size.x; ++x)
+            {
+                const u8* src = pixels + y * image.stride + x * image.nchannels;
+                u8* dst = &rgba[(y * image.size.x + x) * 4];
+                switch (image.nchannels)
+                {
+                case 1: dst[0] = dst[1] = dst[2] = src[0]; dst[3] = 255; break;
+                case 2: dst[0] = dst[1] = dst[2] = src[0]; dst[3] = src[1]; break;
+                case 3: dst[0] = src[0]; dst[1] = src[1]; dst[2] = src[2]; dst[3] = 255; break;
+                default: dst[0] = src[0]; dst[1] = src[1]; dst[2] = src[2]; dst[3] = src[3]; break;
+                }
+            }
+        }
+        return rgba;
+    }
+
+    void Downsample(const u8* src, ivec2 srcSize, u8* dst, ivec2 dstSize, bool gammaCorrect)
+    {
+        const ConversionTables& tables = GetTables();
+        const f32* rgbTable = gammaCorrect ? tables.srgbToLinear : tables.unormToFloat;
+        const f32* alphaTable = tables.unormToFloat;
+
+        // The average lands on the linear to sRGB table indices, or back on 0..255
+        const f32 rgbScale = gammaCorrect ? LINEAR_TO_SRGB_ENTRIES - 1 : 255.0f;
+        const f32 alphaScale = 255.0f;
+#ifdef MIPMAPS_SSE
+        const __m128 scale = _mm_setr_ps(rgbScale, rgbScale, rgbScale, alphaScale);
+#endif
+
+        for (i32 y = 0; y < dstSize.y; ++y)
+        {
+            // With an odd source size the last texel also covers the extra row/column, as in HIZ.glsl
+            i32 rowCount = (srcSize.y & 1) != 0 && y == dstSize.y - 1 ? 3 : 2;
+            const u8* rows[3];
+            for (i32 r = 0; r < rowCount; ++r)
+            {
+                rows[r] = src + glm::min(2 * y + r, srcSize.y - 1) * srcSize.x * 4;
+            }
+
+            for (i32 x = 0; x < dstSize.x; ++x)
+            {
+                i32 columnCount = (srcSize.x & 1) != 0 && x == dstSize.x - 1 ? 3 : 2;
+                i32 columns[3];
+                for (i32 c = 0; c < columnCount; ++c)
+                {
+                    columns[c] = glm::min(2 * x + c, srcSize.x - 1) * 4;
+                }
+                const f32 weight = 1.0f / (rowCount * columnCount);
+
+                alignas(16) i32 values[4];
+#ifdef MIPMAPS_SSE
+                __m128 sum = _mm_setzero_ps();
+                for (i32 r = 0; r < rowCount; ++r)
+                {
+                    for (i32 c = 0; c < columnCount; ++c)
+                    {
+                        sum = _mm_add_ps(sum, LoadTexel(rows[r] + columns[c], rgbTable, alphaTable));
+                    }
+                }
+                _mm_store_si128((__m128i*)values, _mm_cvtps_epi32(_mm_mul_ps(sum, _mm_mul_ps(scale, _mm_set1_ps(weight)))));
+#else
+                for (u32 channel = 0; channel < 4; ++channel)
+                {
+                    const f32* table = channel < 3 ? rgbTable : alphaTable;
+                    f32 sum = 0.0f;
+                    for (i32 r = 0; r < rowCount; ++r)
+                    {
+                        for (i32 c = 0; c < columnCount; ++c)
+                        {
+                            sum += table[rows[r][columns[c] + channel]];
+                        }
+                    }
+                    values[channel] = (i32)(sum * weight * (channel < 3 ? rgbScale : alphaScale) + 0.5f);
+                }
+#endif
+                u8* out = dst + (y * dstSize.x + x) * 4;
+                for (u32 c = 0; c < 3; ++c)
+                {
+                    out[c] = gammaCorrect ? tables.linearToSrgb[values[c]] : (u8)values[c];
+                }
+                out[3] = (u8)values[3];
+            }
+        }
+    }
+
+    void BuildChain(const Image& image, bool gammaCorrect, MipChain& chain)
+    {
+        u32 levelCount = GetLevelCount(image.size);
+        chain.levels.resize(levelCount);
+        chain.sizes.resize(levelCount);
+
+        chain.levels[0] = ExpandToRgba(image);
+        chain.sizes[0] = image.size;
+        for (u32 level = 1; level < levelCount; ++level)
+        {
+            chain.sizes[level] = glm::max(chain.sizes[level - 1] / 2, ivec2(1));
+            chain.levels[level].resize(chain.sizes[level].x * chain.sizes[level].y * 4);
+            Downsample(chain.levels[level - 1].data(), chain.sizes[level - 1], chain.levels[level].data(), chain.sizes[level], gammaCorrect);
+        }
+    }
+
+    u64 GetChainSize(const MipChain& chain)
+    {
+        u64 size = 0;
+        for (const std::vector<u8>& level : chain.levels)
+        {
+            size += level.size();
+        }
+        return size;
+    }
+}
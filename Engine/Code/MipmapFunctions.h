@@ -0,0 +1,38 @@
+#ifndef MIPMAP_FUNC
+#define MIPMAP_FUNC
+
+#include "Globals.h"
+
+//
+// Mip chains built on the CPU, by the texture cook and by the workers of the uncompressed
+// path, instead of glGenerateMipmap. Every level is a 2x2 box filter of the previous one
+// (3 texels wide on the last row/column of odd sizes).
+// Color textures are averaged in linear space: the texels go through an sRGB to linear
+// table, the 4 to 9 of them are summed with SSE (one register per texel) and the result is
+// encoded back with a 4096 entry linear to sRGB table. Alpha and normal maps are averaged
+// as they are stored.
+//
+
+struct MipChain
+{
+    std::vector<std::vector<u8>> levels; // RGBA8, largest first
+    std::vector<ivec2>           sizes;
+};
+
+namespace Mipmaps
+{
+    // Levels down to 1x1
+    u32 GetLevelCount(ivec2 size);
+
+    // Any channel count to RGBA8
+    std::vector<u8> ExpandToRgba(const Image& image);
+
+    // dstSize is half srcSize (at least 1), the last texel of an odd size averages 3 source texels
+    void Downsample(const u8* src, ivec2 srcSize, u8* dst, ivec2 dstSize, bool gammaCorrect);
+
+    void BuildChain(const Image& image, bool gammaCorrect, MipChain& chain);
+
+    u64 GetChainSize(const MipChain& chain);
+}
+
+#endif // !MIPMAP_FUNC
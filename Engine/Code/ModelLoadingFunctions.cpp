@@ -1,15 +1,21 @@
 #include "engine.h"
 #include "ModelLoadingFunctions.h"
+#include "MeshCacheFunctions.h"
+#include "MipmapFunctions.h"
+#include "VertexFormatFunctions.h"
+
+#include <memory>
 
 #include <stb_image.h>
 #include <stb_image_write.h>
 
 namespace ModelLoader
 {
-    Image LoadImage(const char* filename)
+    Image LoadImage(const char* filename, bool flipVertically)
     {
         Image img = {};
-        stbi_set_flip_vertically_on_load(true);
+        // Per thread, images are decoded from the job system workers
+        stbi_set_flip_vertically_on_load_thread(flipVertically);
         img.pixels = stbi_load(filename, &img.size.x, &img.size.y, &img.nchannels, 0);
         if (img.pixels)
         {
@@ -27,6 +33,12 @@ namespace ModelLoader
         stbi_image_free(image.pixels);
     }
 
+    // RGB8 is padded to 4 bytes by the drivers, the mip chain adds a third
+    static u64 GetUncompressedMemoryBytes(const Image& image)
+    {
+        return (u64)image.size.x * image.size.y * 4 * 4 / 3;
+    }
+
     GLuint CreateTexture2DFromImage(Image image)
     {
         GLenum internalFormat = GL_RGB8;
@@ -44,8 +56,8 @@ namespace ModelLoader
         glGenTextures(1, &texHandle);
         glBindTexture(GL_TEXTURE_2D, texHandle);
         glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.size.x, image.size.y, 0, dataFormat, dataType, image.pixels);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -55,6 +67,26 @@ namespace ModelLoader
         return texHandle;
     }
 
+    GLuint CreateTexture2DFromMipChain(const MipChain& chain)
+    {
+        GLuint texHandle;
+        glGenTextures(1, &texHandle);
+        glBindTexture(GL_TEXTURE_2D, texHandle);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        for (u32 level = 0; level < chain.levels.size(); ++level)
+        {
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, chain.sizes[level].x, chain.sizes[level].y, 0, GL_RGBA, GL_UNSIGNED_BYTE, chain.levels[level].data());
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)chain.levels.size() - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        return texHandle;
+    }
+
     u32 LoadTexture2D(App* app, const char* filepath)
     {
         for (u32 texIdx = 0; texIdx < app->textures.size(); ++texIdx)
@@ -68,6 +100,7 @@ namespace ModelLoader
             Texture tex = {};
             tex.handle = CreateTexture2DFromImage(image);
             tex.filepath = filepath;
+            tex.memoryBytes = GetUncompressedMemoryBytes(image);
 
             u32 texIdx = app->textures.size();
             app->textures.push_back(tex);
@@ -81,37 +114,116 @@ namespace ModelLoader
         }
     }
 
+    u32 LoadTexture2DAsync(App* app, const char* filepath, u32 placeholderTexIdx, TextureKind kind)
+    {
+        for (u32 texIdx = 0; texIdx < app->textures.size(); ++texIdx)
+            if (app->textures[texIdx].filepath == filepath)
+                return texIdx;
+
+        Texture tex = {};
+        tex.handle = app->textures[placeholderTexIdx].handle;
+        tex.filepath = filepath;
+
+        u32 texIdx = app->textures.size();
+        app->textures.push_back(tex);
+
+        JobSystem* jobs = &app->jobs;
+        std::string path = filepath;
+        if (app->useTextureCache)
+        {
+            JobManager::Submit(app->jobs, [jobs, path, kind, texIdx]()
+            {
+                CookedTexture cooked = {};
+                bool loaded = TextureCache::Load(path.c_str(), kind, true, cooked);
+
+                JobManager::PushUpload(*jobs, [cooked, loaded, texIdx](App* app) mutable
+                {
+                    if (loaded && app->textureStreaming.enabled)
+                    {
+                        // Keeps the file mapped, the finer levels come from it later
+                        TextureStreaming::Register(*app, app->textureStreaming, texIdx, cooked);
+                    }
+                    else if (loaded)
+                    {
+                        app->textures[texIdx].handle = TextureCache::CreateTexture2D(cooked.image);
+                        app->textures[texIdx].memoryBytes = cooked.image.dataSize;
+                        TextureCache::Release(cooked);
+                    }
+                    else
+                    {
+                        app->textures[texIdx].handle = app->textures[app->magentaTexIdx].handle;
+                    }
+                });
+            });
+            return texIdx;
+        }
+
+        // The mips are built on the worker too, in linear space for colors
+        JobManager::Submit(app->jobs, [jobs, path, kind, texIdx]()
+        {
+            Image image = LoadImage(path.c_str());
+            std::shared_ptr<MipChain> chain;
+            if (image.pixels)
+            {
+                chain = std::make_shared<MipChain>();
+                Mipmaps::BuildChain(image, kind == TextureKind_Color, *chain);
+                FreeImage(image);
+            }
+
+            JobManager::PushUpload(*jobs, [chain, texIdx](App* app)
+            {
+                if (chain)
+                {
+                    app->textures[texIdx].handle = CreateTexture2DFromMipChain(*chain);
+                    app->textures[texIdx].memoryBytes = Mipmaps::GetChainSize(*chain);
+                }
+                else
+                {
+                    app->textures[texIdx].handle = app->textures[app->magentaTexIdx].handle;
+                }
+            });
+        });
+
+        return texIdx;
+    }
+
     void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
     {
-        std::vector<float> vertices;
+        std::vector<u8> vertices;
         std::vector<u32> indices;
 
-        bool hasTexCoords = false;
-        bool hasTangentSpace = false;
+        bool hasTexCoords = mesh->mTextureCoords[0] != nullptr; // does the mesh contain texture coordinates?
+        bool hasTangentSpace = mesh->mTangents != nullptr && mesh->mBitangents;
+
+        // The positions are quantized inside the box
+        vec3 aabbMin = vec3(FLT_MAX);
+        vec3 aabbMax = vec3(-FLT_MAX);
+        for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+        {
+            vec3 position = vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+            aabbMin = glm::min(aabbMin, position);
+            aabbMax = glm::max(aabbMax, position);
+        }
+
+        // create the vertex format
+        VertexBufferLayout vertexBufferLayout = VertexFormat::GetCompactLayout(hasTexCoords, hasTangentSpace);
 
         // process vertices
+        vertices.reserve(mesh->mNumVertices * vertexBufferLayout.stride);
         for (unsigned int i = 0; i < mesh->mNumVertices; i++)
         {
-            vertices.push_back(mesh->mVertices[i].x);
-            vertices.push_back(mesh->mVertices[i].y);
-            vertices.push_back(mesh->mVertices[i].z);
-            vertices.push_back(mesh->mNormals[i].x);
-            vertices.push_back(mesh->mNormals[i].y);
-            vertices.push_back(mesh->mNormals[i].z);
-
-            if (mesh->mTextureCoords[0]) // does the mesh contain texture coordinates?
-            {
-                hasTexCoords = true;
-                vertices.push_back(mesh->mTextureCoords[0][i].x);
-                vertices.push_back(mesh->mTextureCoords[0][i].y);
-            }
+            vec3 position = vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+            vec3 normal = vec3(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z);
+
+            vec2 texCoord = vec2(0.0f);
+            if (hasTexCoords)
+                texCoord = vec2(mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y);
 
-            if (mesh->mTangents != nullptr && mesh->mBitangents)
+            vec3 tangent = vec3(0.0f);
+            vec3 bitangent = vec3(0.0f);
+            if (hasTangentSpace)
             {
-                hasTangentSpace = true;
-                vertices.push_back(mesh->mTangents[i].x);
-                vertices.push_back(mesh->mTangents[i].y);
-                vertices.push_back(mesh->mTangents[i].z);
+                tangent = vec3(mesh->mTangents[i].x, mesh->mTangents[i].y, mesh->mTangents[i].z);
 
                 // For some reason ASSIMP gives me the bitangents flipped.
                 // Maybe it's my fault, but when I generate my own geometry
@@ -121,10 +233,10 @@ namespace ModelLoader
                 // I think that (even if the documentation says the opposite)
                 // it returns a left-handed tangent space matrix.
                 // SOLUTION: I invert the components of the bitangent here.
-                vertices.push_back(-mesh->mBitangents[i].x);
-                vertices.push_back(-mesh->mBitangents[i].y);
-                vertices.push_back(-mesh->mBitangents[i].z);
+                bitangent = -vec3(mesh->mBitangents[i].x, mesh->mBitangents[i].y, mesh->mBitangents[i].z);
             }
+
+            VertexFormat::PushCompactVertex(vertices, vertexBufferLayout, aabbMin, aabbMax, position, normal, texCoord, tangent, bitangent);
         }
 
         // process indices
@@ -140,34 +252,22 @@ namespace ModelLoader
         // store the proper (previously proceessed) material for this mesh
         submeshMaterialIndices.push_back(baseMeshMaterialIndex + mesh->mMaterialIndex);
 
-        // create the vertex format
-        VertexBufferLayout vertexBufferLayout = {};
-        vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 0, 3, 0 });
-        vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 1, 3, 3 * sizeof(float) });
-        vertexBufferLayout.stride = 6 * sizeof(float);
-        if (hasTexCoords)
-        {
-            vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 2, 2, vertexBufferLayout.stride });
-            vertexBufferLayout.stride += 2 * sizeof(float);
-        }
-        if (hasTangentSpace)
-        {
-            vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 3, 3, vertexBufferLayout.stride });
-            vertexBufferLayout.stride += 3 * sizeof(float);
-
-            vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 4, 3, vertexBufferLayout.stride });
-            vertexBufferLayout.stride += 3 * sizeof(float);
-        }
-
         // add the submesh into the mesh
         SubMesh submesh = {};
         submesh.vertexBufferLayout = vertexBufferLayout;
+        submesh.indexCount = (u32)indices.size();
+        if (mesh->mNumVertices > 0)
+        {
+            submesh.aabbMin = aabbMin;
+            submesh.aabbMax = aabbMax;
+        }
+
         submesh.vertices.swap(vertices);
         submesh.indices.swap(indices);
         myMesh->submeshes.push_back(submesh);
     }
 
-    void ProcessAssimpMaterial(App* app, aiMaterial* material, Material& myMaterial, String directory)
+    void ProcessAssimpMaterial(aiMaterial* material, MaterialData& myMaterial, const std::string& directory)
     {
         aiString name;
         aiColor3D diffuseColor;
@@ -185,41 +285,32 @@ namespace ModelLoader
         myMaterial.emissive = vec3(emissiveColor.r, emissiveColor.g, emissiveColor.b);
         myMaterial.smoothness = shininess / 256.0f;
 
+        // Texture paths are only resolved here, CreateMaterial() loads them
         aiString aiFilename;
         if (material->GetTextureCount(aiTextureType_DIFFUSE) > 0)
         {
             material->GetTexture(aiTextureType_DIFFUSE, 0, &aiFilename);
-            String filename = MakeString(aiFilename.C_Str());
-            String filepath = MakePath(directory, filename);
-            myMaterial.albedoTextureIdx = LoadTexture2D(app, filepath.str);
+            myMaterial.albedoTexture = directory + "/" + aiFilename.C_Str();
         }
         if (material->GetTextureCount(aiTextureType_EMISSIVE) > 0)
         {
             material->GetTexture(aiTextureType_EMISSIVE, 0, &aiFilename);
-            String filename = MakeString(aiFilename.C_Str());
-            String filepath = MakePath(directory, filename);
-            myMaterial.emissiveTextureIdx = LoadTexture2D(app, filepath.str);
+            myMaterial.emissiveTexture = directory + "/" + aiFilename.C_Str();
         }
         if (material->GetTextureCount(aiTextureType_SPECULAR) > 0)
         {
             material->GetTexture(aiTextureType_SPECULAR, 0, &aiFilename);
-            String filename = MakeString(aiFilename.C_Str());
-            String filepath = MakePath(directory, filename);
-            myMaterial.specularTextureIdx = LoadTexture2D(app, filepath.str);
+            myMaterial.specularTexture = directory + "/" + aiFilename.C_Str();
         }
         if (material->GetTextureCount(aiTextureType_NORMALS) > 0)
         {
             material->GetTexture(aiTextureType_NORMALS, 0, &aiFilename);
-            String filename = MakeString(aiFilename.C_Str());
-            String filepath = MakePath(directory, filename);
-            myMaterial.normalsTextureIdx = LoadTexture2D(app, filepath.str);
+            myMaterial.normalsTexture = directory + "/" + aiFilename.C_Str();
         }
         if (material->GetTextureCount(aiTextureType_HEIGHT) > 0)
         {
             material->GetTexture(aiTextureType_HEIGHT, 0, &aiFilename);
-            String filename = MakeString(aiFilename.C_Str());
-            String filepath = MakePath(directory, filename);
-            myMaterial.bumpTextureIdx = LoadTexture2D(app, filepath.str);
+            myMaterial.bumpTexture = directory + "/" + aiFilename.C_Str();
         }
 
         //myMaterial.createNormalFromBump();
@@ -241,7 +332,7 @@ namespace ModelLoader
         }
     }
 
-    u32 LoadModel(App* app, const char* filename)
+    bool ImportModel(const char* filename, ModelData& modelData)
     {
         const aiScene* scene = aiImportFile(filename,
             aiProcess_Triangulate |
@@ -256,70 +347,147 @@ namespace ModelLoader
         if (!scene)
         {
             ELOG("Error loading mesh %s: %s", filename, aiGetErrorString());
-            return UINT32_MAX;
+            return false;
         }
 
-        app->meshes.push_back(Mesh{});
-        Mesh& mesh = app->meshes.back();
-        u32 meshIdx = (u32)app->meshes.size() - 1u;
-
-        app->models.push_back(Model{});
-        Model& model = app->models.back();
-        model.meshIdx = meshIdx;
-        u32 modelIdx = (u32)app->models.size() - 1u;
-
-        String directory = GetDirectoryPart(MakeString(filename));
+        std::string directory = filename;
+        size_t separator = directory.find_last_of("/\\");
+        directory = separator != std::string::npos ? directory.substr(0, separator) : std::string(".");
 
         // Create a list of materials
-        u32 baseMeshMaterialIndex = (u32)app->materials.size();
         for (unsigned int i = 0; i < scene->mNumMaterials; ++i)
         {
-            app->materials.push_back(Material{});
-            Material& material = app->materials.back();
-            ProcessAssimpMaterial(app, scene->mMaterials[i], material, directory);
+            modelData.materials.push_back(MaterialData{});
+            ProcessAssimpMaterial(scene->mMaterials[i], modelData.materials.back(), directory);
         }
 
-        ProcessAssimpNode(scene, scene->mRootNode, &mesh, baseMeshMaterialIndex, model.materialIdx);
+        ProcessAssimpNode(scene, scene->mRootNode, &modelData.mesh, 0, modelData.materialIdx);
 
         aiReleaseImport(scene);
 
-        u32 vertexBufferSize = 0;
-        u32 indexBufferSize = 0;
+        return true;
+    }
+
+    u32 CreateMaterial(App* app, const MaterialData& materialData)
+    {
+        Material material = {};
+        material.name = materialData.name;
+        material.albedo = materialData.albedo;
+        material.emissive = materialData.emissive;
+        material.smoothness = materialData.smoothness;
+
+        material.albedoTextureIdx = app->whiteTexIdx;
+        material.emissiveTextureIdx = app->blackTexIdx;
+        material.specularTextureIdx = app->blackTexIdx;
+        material.normalsTextureIdx = app->normalTexIdx;
+        material.bumpTextureIdx = app->blackTexIdx;
+
+        // Each slot shows the same placeholder while loading as when the material has no texture
+        if (!materialData.albedoTexture.empty())   material.albedoTextureIdx = LoadTexture2DAsync(app, materialData.albedoTexture.c_str(), app->whiteTexIdx);
+        if (!materialData.emissiveTexture.empty()) material.emissiveTextureIdx = LoadTexture2DAsync(app, materialData.emissiveTexture.c_str(), app->blackTexIdx);
+        if (!materialData.specularTexture.empty()) material.specularTextureIdx = LoadTexture2DAsync(app, materialData.specularTexture.c_str(), app->blackTexIdx);
+        if (!materialData.normalsTexture.empty())  material.normalsTextureIdx = LoadTexture2DAsync(app, materialData.normalsTexture.c_str(), app->normalTexIdx, TextureKind_Normal);
+        if (!materialData.bumpTexture.empty())     material.bumpTextureIdx = LoadTexture2DAsync(app, materialData.bumpTexture.c_str(), app->blackTexIdx);
+
+        app->materials.push_back(material);
+        return (u32)app->materials.size() - 1u;
+    }
+
+    u32 ReserveModel(App* app)
+    {
+        app->meshes.push_back(Mesh{});
+
+        Model model = {};
+        model.meshIdx = (u32)app->meshes.size() - 1u;
+        app->models.push_back(model);
+
+        return (u32)app->models.size() - 1u;
+    }
 
-        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    void CreateModel(App* app, u32 modelIdx, ModelData& modelData)
+    {
+        Model& model = app->models[modelIdx];
+        Mesh& mesh = app->meshes[model.meshIdx];
+        mesh.submeshes.swap(modelData.mesh.submeshes);
+
+        u32 baseMeshMaterialIndex = (u32)app->materials.size();
+        for (const MaterialData& materialData : modelData.materials)
         {
-            vertexBufferSize += mesh.submeshes[i].vertices.size() * sizeof(float);
-            indexBufferSize += mesh.submeshes[i].indices.size() * sizeof(u32);
+            CreateMaterial(app, materialData);
         }
+        for (u32 materialIdx : modelData.materialIdx)
+        {
+            model.materialIdx.push_back(baseMeshMaterialIndex + materialIdx);
+        }
+
+        // Sub-allocate the geometry from the arena of each submesh vertex format
+        for (SubMesh& submesh : mesh.submeshes)
+        {
+            const u32 verticesSize = (u32)submesh.vertices.size();
+            const u32 indicesSize = submesh.indices.size() * sizeof(u32);
 
-        glGenBuffers(1, &mesh.vertexBufferHandle);
-        glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-        glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, NULL, GL_STATIC_DRAW);
+            submesh.vertexArenaIdx = GeometryArenaManager::FindVertexArena(app->geometryArena, submesh.vertexBufferLayout);
+            submesh.baseVertex = GeometryArenaManager::AllocateVertices(app->geometryArena, submesh.vertexArenaIdx, submesh.vertices.data(), verticesSize);
+            submesh.firstIndex = GeometryArenaManager::AllocateIndices(app->geometryArena, submesh.indices.data(), indicesSize);
 
-        glGenBuffers(1, &mesh.indexBufferHandle);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferSize, NULL, GL_STATIC_DRAW);
+            // The arena holds the geometry now, only the counts and the box are kept
+            std::vector<u8>().swap(submesh.vertices);
+            std::vector<u32>().swap(submesh.indices);
+        }
 
-        u32 indicesOffset = 0;
-        u32 verticesOffset = 0;
+        ComputeMeshBounds(mesh);
+        app->sceneGeneration++;
+    }
 
-        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    void ComputeMeshBounds(Mesh& mesh)
+    {
+        mesh.aabbMin = mesh.submeshes.empty() ? vec3(0.0f) : vec3(FLT_MAX);
+        mesh.aabbMax = mesh.submeshes.empty() ? vec3(0.0f) : vec3(-FLT_MAX);
+        for (const SubMesh& submesh : mesh.submeshes)
         {
-            const void* verticesData = mesh.submeshes[i].vertices.data();
-            const u32   verticesSize = mesh.submeshes[i].vertices.size() * sizeof(float);
-            glBufferSubData(GL_ARRAY_BUFFER, verticesOffset, verticesSize, verticesData);
-            mesh.submeshes[i].vertexOffset = verticesOffset;
-            verticesOffset += verticesSize;
-
-            const void* indicesData = mesh.submeshes[i].indices.data();
-            const u32   indicesSize = mesh.submeshes[i].indices.size() * sizeof(u32);
-            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indicesOffset, indicesSize, indicesData);
-            mesh.submeshes[i].indexOffset = indicesOffset;
-            indicesOffset += indicesSize;
+            mesh.aabbMin = glm::min(mesh.aabbMin, submesh.aabbMin);
+            mesh.aabbMax = glm::max(mesh.aabbMax, submesh.aabbMax);
         }
+    }
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    u32 LoadModelAsync(App* app, const char* filename)
+    {
+        u32 modelIdx = ReserveModel(app);
+
+        JobSystem* jobs = &app->jobs;
+        std::string path = filename;
+        JobManager::Submit(app->jobs, [jobs, path, modelIdx]()
+        {
+            f64 startTime = glfwGetTime();
+
+            MappedFile cookedMesh = MeshCache::MapModel(path.c_str());
+            if (cookedMesh.data)
+            {
+                JobManager::PushUpload(*jobs, [path, modelIdx, cookedMesh, startTime](App* app) mutable
+                {
+                    MeshCache::CreateModel(app, modelIdx, cookedMesh);
+                    UnmapFile(cookedMesh);
+                    ILOG("Model %s loaded from cooked mesh in %.2f ms", path.c_str(), (glfwGetTime() - startTime) * 1000.0);
+                });
+                return;
+            }
+
+            // Shared so the payload can be moved through a copyable std::function
+            std::shared_ptr<ModelData> modelData = std::make_shared<ModelData>();
+            if (!ImportModel(path.c_str(), *modelData))
+            {
+                // The reserved model stays empty, entities using it draw nothing
+                return;
+            }
+
+            MeshCache::Write(path.c_str(), *modelData);
+
+            JobManager::PushUpload(*jobs, [path, modelIdx, modelData, startTime](App* app)
+            {
+                CreateModel(app, modelIdx, *modelData);
+                ILOG("Model %s imported in %.2f ms", path.c_str(), (glfwGetTime() - startTime) * 1000.0);
+            });
+        });
 
         return modelIdx;
     }
@@ -5,27 +5,78 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include "Globals.h"
+#include "TextureCacheFunctions.h"
 #include <vector>
 
 struct App;
+struct MipChain;
+
+// CPU side description of a material, texture paths are not loaded yet
+struct MaterialData
+{
+    std::string name;
+    vec3        albedo;
+    vec3        emissive;
+    f32         smoothness;
+    std::string albedoTexture;
+    std::string emissiveTexture;
+    std::string specularTexture;
+    std::string normalsTexture;
+    std::string bumpTexture;
+};
+
+// Result of importing a model file, before anything is uploaded to the GPU
+struct ModelData
+{
+    Mesh                      mesh;
+    std::vector<u32>          materialIdx; // per submesh, index into materials
+    std::vector<MaterialData> materials;
+};
 
 namespace ModelLoader
 {
-    Image LoadImage(const char* filename);
+    // Thread safe, the job system decodes images with it
+    Image LoadImage(const char* filename, bool flipVertically = true);
 
     void FreeImage(Image image);
 
+    // Lets the driver build the mips, only for the small built-in textures
     GLuint CreateTexture2DFromImage(Image image);
 
+    // RGBA8 with every level of the chain (see MipmapFunctions.h)
+    GLuint CreateTexture2DFromMipChain(const MipChain& chain);
+
     u32 LoadTexture2D(App* app, const char* filepath);
 
+    // Returns a texture slot right away that shows the given placeholder (white, black or flat
+    // normal, see App) until the image is decoded on a worker and uploaded, or the magenta one
+    // if it fails to load. With app->useTextureCache the worker loads (or cooks) the compressed
+    // image instead.
+    u32 LoadTexture2DAsync(App* app, const char* filepath, u32 placeholderTexIdx, TextureKind kind = TextureKind_Color);
+
     void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices);
 
-    void ProcessAssimpMaterial(App* app, aiMaterial* material, Material& myMaterial, String directory);
+    void ProcessAssimpMaterial(aiMaterial* material, MaterialData& myMaterial, const std::string& directory);
 
     void ProcessAssimpNode(const aiScene* scene, aiNode* node, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices);
 
-    u32 LoadModel(App* app, const char* filename);
+    // Parses a model file with Assimp. It doesn't touch OpenGL nor the frame arena.
+    bool ImportModel(const char* filename, ModelData& modelData);
+
+    u32 CreateMaterial(App* app, const MaterialData& materialData);
+
+    // Registers an empty mesh and model, so entities can reference it before the data arrives.
+    u32 ReserveModel(App* app);
+
+    // Uploads the imported geometry into a reserved model and registers its materials.
+    void CreateModel(App* app, u32 modelIdx, ModelData& modelData);
+
+    // Recomputes the mesh box from its submeshes.
+    void ComputeMeshBounds(Mesh& mesh);
+
+    // Reserves a model and loads it on a worker: the cooked mesh if it is up to date, otherwise
+    // the model is imported and cooked. The data is uploaded later from Update().
+    u32 LoadModelAsync(App* app, const char* filename);
 }
 
 #endif
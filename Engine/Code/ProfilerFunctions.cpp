@@ -0,0 +1,229 @@
+#include "ProfilerFunctions.h"
+
+#include <algorithm>
+
+namespace ProfilerManager
+{
+    const char* GetPassName(ProfilerPass pass)
+    {
+        static const char* passNames[] = {
+            "Reflection",
+            "Refraction",
+            "Forward",
+            "GBuffer",
+            "Skybox",
+            "Lighting",
+            "Water",
+            "HiZ"
+        };
+        static_assert(ARRAY_COUNT(passNames) == ProfilerPass_Count, "Missing pass names");
+        return passNames[pass];
+    }
+
+    void Init(Profiler& profiler)
+    {
+        for (u32 i = 0; i < PROFILER_QUERY_FRAMES; ++i)
+        {
+            glGenQueries(ProfilerPass_Count, profiler.queries[i]);
+        }
+        profiler.activePass = -1;
+        profiler.initialized = true;
+    }
+
+    static void PushHistory(Profiler& profiler, const ProfilerFrame& frame)
+    {
+        profiler.lastFrame = frame;
+        profiler.history[profiler.historyHead] = frame;
+        profiler.historyHead = (profiler.historyHead + 1) % PROFILER_HISTORY_SIZE;
+        profiler.historyCount = glm::min(profiler.historyCount + 1, (u32)PROFILER_HISTORY_SIZE);
+    }
+
+    static void ResolveSlot(Profiler& profiler, u32 slot, bool wait)
+    {
+        ProfilerFrame& frame = profiler.inFlight[slot];
+        if (!frame.pending) return;
+
+        for (u32 i = 0; i < ProfilerPass_Count; ++i)
+        {
+            if (!frame.queryIssued[i]) continue;
+
+            if (!wait)
+            {
+                GLint available = 0;
+                glGetQueryObjectiv(profiler.queries[slot][i], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available)
+                {
+                    // The GPU is more than PROFILER_QUERY_FRAMES behind: drop the sample instead of stalling
+                    frame.pending = false;
+                    profiler.droppedFrames++;
+                    return;
+                }
+            }
+        }
+
+        for (u32 i = 0; i < ProfilerPass_Count; ++i)
+        {
+            if (!frame.queryIssued[i]) continue;
+
+            GLuint64 elapsedNs = 0;
+            glGetQueryObjectui64v(profiler.queries[slot][i], GL_QUERY_RESULT, &elapsedNs);
+            frame.passes[i].gpuMs = (f64)elapsedNs / 1000000.0;
+        }
+
+        frame.pending = false;
+        PushHistory(profiler, frame);
+    }
+
+    void BeginFrame(Profiler& profiler)
+    {
+        profiler.frameBegin = glfwGetTime();
+        profiler.frameIndex++;
+
+        if (!profiler.initialized) return;
+
+        u32 slot = profiler.frameIndex % PROFILER_QUERY_FRAMES;
+        ResolveSlot(profiler, slot, false);
+        profiler.inFlight[slot] = ProfilerFrame{};
+        profiler.activePass = -1;
+    }
+
+    void BeginPass(Profiler& profiler, ProfilerPass pass)
+    {
+        if (!profiler.initialized) return;
+
+        ProfilerFrame& frame = profiler.inFlight[profiler.frameIndex % PROFILER_QUERY_FRAMES];
+        profiler.cpuBegin[pass] = glfwGetTime();
+
+        // GL_TIME_ELAPSED queries cannot nest, and each pass owns a single query per frame
+        if (profiler.activePass == -1 && !frame.queryIssued[pass])
+        {
+            glBeginQuery(GL_TIME_ELAPSED, profiler.queries[profiler.frameIndex % PROFILER_QUERY_FRAMES][pass]);
+            frame.queryIssued[pass] = true;
+            profiler.activePass = pass;
+        }
+    }
+
+    void EndPass(Profiler& profiler, ProfilerPass pass)
+    {
+        if (!profiler.initialized) return;
+
+        ProfilerFrame& frame = profiler.inFlight[profiler.frameIndex % PROFILER_QUERY_FRAMES];
+
+        if (profiler.activePass == (i32)pass)
+        {
+            glEndQuery(GL_TIME_ELAPSED);
+            profiler.activePass = -1;
+        }
+
+        frame.passes[pass].cpuMs += (glfwGetTime() - profiler.cpuBegin[pass]) * 1000.0;
+        frame.passes[pass].used = true;
+    }
+
+    void AddDrawStats(Profiler& profiler, u32 drawCalls, u32 bindsSkipped)
+    {
+        if (!profiler.initialized) return;
+
+        ProfilerFrame& frame = profiler.inFlight[profiler.frameIndex % PROFILER_QUERY_FRAMES];
+        frame.drawCalls += drawCalls;
+        frame.bindsSkipped += bindsSkipped;
+    }
+
+    void AddClusterStats(Profiler& profiler, u32 overflowClusters)
+    {
+        if (!profiler.initialized) return;
+
+        ProfilerFrame& frame = profiler.inFlight[profiler.frameIndex % PROFILER_QUERY_FRAMES];
+        frame.overflowClusters += overflowClusters;
+    }
+
+    void AddCullStats(Profiler& profiler, ProfilerPass pass, u32 visible, u32 culled)
+    {
+        if (!profiler.initialized) return;
+
+        ProfilerFrame& frame = profiler.inFlight[profiler.frameIndex % PROFILER_QUERY_FRAMES];
+        frame.passes[pass].visibleInstances += visible;
+        frame.passes[pass].culledInstances += culled;
+    }
+
+    void AddOcclusionStats(Profiler& profiler, ProfilerPass pass, u32 occluded)
+    {
+        if (!profiler.initialized) return;
+
+        ProfilerFrame& frame = profiler.inFlight[profiler.frameIndex % PROFILER_QUERY_FRAMES];
+        frame.passes[pass].occludedInstances += occluded;
+    }
+
+    void EndFrame(Profiler& profiler)
+    {
+        if (!profiler.initialized) return;
+
+        ProfilerFrame& frame = profiler.inFlight[profiler.frameIndex % PROFILER_QUERY_FRAMES];
+        frame.frameCpuMs = (glfwGetTime() - profiler.frameBegin) * 1000.0;
+        frame.pending = true;
+    }
+
+    void Flush(Profiler& profiler)
+    {
+        if (!profiler.initialized) return;
+
+        // Resolve from the oldest to the newest frame so the history keeps its order
+        for (u32 i = 1; i <= PROFILER_QUERY_FRAMES; ++i)
+        {
+            ResolveSlot(profiler, (profiler.frameIndex + i) % PROFILER_QUERY_FRAMES, true);
+        }
+    }
+
+    static PassStats ComputeStats(std::vector<f64>& values)
+    {
+        PassStats stats = {};
+        stats.sampleCount = (u32)values.size();
+        if (values.empty()) return stats;
+
+        f64 sum = 0.0;
+        stats.minMs = values[0];
+        for (f64 value : values)
+        {
+            sum += value;
+            stats.minMs = glm::min(stats.minMs, value);
+        }
+        stats.avgMs = sum / values.size();
+
+        size_t p99Index = (size_t)(0.99 * (values.size() - 1));
+        std::nth_element(values.begin(), values.begin() + p99Index, values.end());
+        stats.p99Ms = values[p99Index];
+
+        return stats;
+    }
+
+    void GetPassStats(const Profiler& profiler, ProfilerPass pass, PassStats& cpuStats, PassStats& gpuStats)
+    {
+        std::vector<f64> cpuValues;
+        std::vector<f64> gpuValues;
+        cpuValues.reserve(profiler.historyCount);
+        gpuValues.reserve(profiler.historyCount);
+
+        for (u32 i = 0; i < profiler.historyCount; ++i)
+        {
+            const ProfilerFrame& frame = profiler.history[i];
+            if (!frame.passes[pass].used) continue;
+
+            cpuValues.push_back(frame.passes[pass].cpuMs);
+            if (frame.queryIssued[pass])
+                gpuValues.push_back(frame.passes[pass].gpuMs);
+        }
+
+        cpuStats = ComputeStats(cpuValues);
+        gpuStats = ComputeStats(gpuValues);
+    }
+
+    void GetFrameStats(const Profiler& profiler, PassStats& frameStats)
+    {
+        std::vector<f64> values;
+        values.reserve(profiler.historyCount);
+        for (u32 i = 0; i < profiler.historyCount; ++i)
+        {
+            values.push_back(profiler.history[i].frameCpuMs);
+        }
+        frameStats = ComputeStats(values);
+    }
+}
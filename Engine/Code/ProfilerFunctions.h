@@ -0,0 +1,108 @@
+#ifndef PROFILER_FUNC
+#define PROFILER_FUNC
+
+#include "Globals.h"
+
+// Number of frames the GPU queries are kept in flight before being read back,
+// so reading the results never stalls the pipeline.
+#define PROFILER_QUERY_FRAMES 3
+#define PROFILER_HISTORY_SIZE 240
+
+enum ProfilerPass
+{
+    ProfilerPass_Reflection,
+    ProfilerPass_Refraction,
+    ProfilerPass_Forward,
+    ProfilerPass_GBuffer,
+    ProfilerPass_Skybox,
+    ProfilerPass_Lighting,
+    ProfilerPass_Water,
+    ProfilerPass_HiZ,
+    ProfilerPass_Count
+};
+
+struct PassTiming
+{
+    f64  cpuMs;
+    f64  gpuMs;
+    u32  visibleInstances;
+    u32  culledInstances;
+    u32  occludedInstances;
+    bool used;
+};
+
+struct PassStats
+{
+    f64 minMs;
+    f64 avgMs;
+    f64 p99Ms;
+    u32 sampleCount;
+};
+
+struct ProfilerFrame
+{
+    PassTiming passes[ProfilerPass_Count];
+    bool       queryIssued[ProfilerPass_Count];
+    f64        frameCpuMs;
+    u32        drawCalls;
+    u32        bindsSkipped;
+    u32        overflowClusters; // clusters reached by more than CLUSTER_MAX_LIGHTS lights, a few frames late
+    bool       pending;
+};
+
+struct Profiler
+{
+    GLuint        queries[PROFILER_QUERY_FRAMES][ProfilerPass_Count];
+    ProfilerFrame inFlight[PROFILER_QUERY_FRAMES];
+    u32           frameIndex;
+    f64           frameBegin;
+    f64           cpuBegin[ProfilerPass_Count];
+    i32           activePass;
+
+    // Last frame whose GPU timings were read back
+    ProfilerFrame lastFrame;
+
+    // Rolling history of resolved frames (ring buffer)
+    ProfilerFrame history[PROFILER_HISTORY_SIZE];
+    u32           historyHead;
+    u32           historyCount;
+
+    u32           droppedFrames;
+    bool          initialized;
+};
+
+namespace ProfilerManager
+{
+    const char* GetPassName(ProfilerPass pass);
+
+    void Init(Profiler& profiler);
+
+    void BeginFrame(Profiler& profiler);
+
+    void BeginPass(Profiler& profiler, ProfilerPass pass);
+
+    void EndPass(Profiler& profiler, ProfilerPass pass);
+
+    // Adds to the draw counters of the current frame
+    void AddDrawStats(Profiler& profiler, u32 drawCalls, u32 bindsSkipped);
+
+    // Adds to the light cluster counters of the current frame
+    void AddClusterStats(Profiler& profiler, u32 overflowClusters);
+
+    // Adds to the frustum culling counters of a pass
+    void AddCullStats(Profiler& profiler, ProfilerPass pass, u32 visible, u32 culled);
+
+    // Adds to the occlusion culling counter of a pass (instances inside the frustum but hidden)
+    void AddOcclusionStats(Profiler& profiler, ProfilerPass pass, u32 occluded);
+
+    void EndFrame(Profiler& profiler);
+
+    // Blocks until every in-flight query is resolved. Meant for headless runs after a glFinish().
+    void Flush(Profiler& profiler);
+
+    void GetPassStats(const Profiler& profiler, ProfilerPass pass, PassStats& cpuStats, PassStats& gpuStats);
+
+    void GetFrameStats(const Profiler& profiler, PassStats& frameStats);
+}
+
+#endif // !PROFILER_FUNC
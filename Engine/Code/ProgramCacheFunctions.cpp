@@ -0,0 +1,137 @@
+#include "platform.h"
+#include "ProgramCacheFunctions.h"
+
+namespace ProgramCache
+{
+    static bool supported = false;
+    static u64  driverHash = 0;
+
+    static u64 HashBytes(u64 hash, const void* data, u32 size)
+    {
+        // FNV-1a
+        const u8* bytes = (const u8*)data;
+        for (u32 i = 0; i < size; ++i)
+        {
+            hash ^= bytes[i];
+            hash *= 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    static u64 HashString(u64 hash, const char* str)
+    {
+        return str ? HashBytes(hash, str, (u32)strlen(str)) : hash;
+    }
+
+    static std::string GetCachePath(const char* programName)
+    {
+        return std::string(PROGRAM_CACHE_DIRECTORY) + "/" + programName + ".bin";
+    }
+
+    bool Init()
+    {
+        GLint formatCount = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+        supported = formatCount > 0 && MakeDirectory(PROGRAM_CACHE_DIRECTORY);
+
+        // A driver update invalidates every binary
+        driverHash = 0xcbf29ce484222325ull;
+        driverHash = HashString(driverHash, (const char*)glGetString(GL_VENDOR));
+        driverHash = HashString(driverHash, (const char*)glGetString(GL_RENDERER));
+        driverHash = HashString(driverHash, (const char*)glGetString(GL_VERSION));
+
+        if (!supported)
+        {
+            ILOG("Program binary cache disabled (%d binary formats)", formatCount);
+        }
+        return supported;
+    }
+
+    bool IsSupported()
+    {
+        return supported;
+    }
+
+    u64 ComputeKey(String programSource, const char* preamble)
+    {
+        u64 key = driverHash;
+        key = HashString(key, preamble);
+        key = HashBytes(key, programSource.str, programSource.len);
+        return key;
+    }
+
+    GLuint Load(const char* programName, u64 key)
+    {
+        if (!supported) return 0;
+
+        FILE* file = fopen(GetCachePath(programName).c_str(), "rb");
+        if (!file) return 0;
+
+        fseek(file, 0, SEEK_END);
+        long fileSize = ftell(file);
+        fseek(file, 0, SEEK_SET);
+
+        // A truncated or corrupt file is compiled from source like a stale one
+        ProgramCacheHeader header = {};
+        bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+            header.magic == PROGRAM_CACHE_MAGIC &&
+            header.version == PROGRAM_CACHE_VERSION &&
+            header.key == key &&
+            header.binaryLength > 0 &&
+            header.binaryLength <= PROGRAM_CACHE_MAX_BINARY_SIZE &&
+            (u64)fileSize == sizeof(header) + (u64)header.binaryLength;
+
+        std::vector<u8> binary;
+        if (valid)
+        {
+            binary.resize(header.binaryLength);
+            valid = fread(binary.data(), 1, binary.size(), file) == binary.size();
+        }
+        fclose(file);
+
+        if (!valid) return 0;
+
+        GLuint programHandle = glCreateProgram();
+        glProgramBinary(programHandle, header.binaryFormat, binary.data(), header.binaryLength);
+
+        GLint success = 0;
+        glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            // The driver can reject binaries at any time, just compile from source again
+            glDeleteProgram(programHandle);
+            return 0;
+        }
+
+        return programHandle;
+    }
+
+    void Store(GLuint programHandle, const char* programName, u64 key)
+    {
+        if (!supported || programHandle == 0) return;
+
+        GLint binaryLength = 0;
+        glGetProgramiv(programHandle, GL_PROGRAM_BINARY_LENGTH, &binaryLength);
+        if (binaryLength <= 0) return;
+
+        std::vector<u8> binary(binaryLength);
+        ProgramCacheHeader header = {};
+        header.magic = PROGRAM_CACHE_MAGIC;
+        header.version = PROGRAM_CACHE_VERSION;
+        header.key = key;
+        glGetProgramBinary(programHandle, binaryLength, NULL, &header.binaryFormat, binary.data());
+        header.binaryLength = (u32)binaryLength;
+
+        std::string path = GetCachePath(programName);
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file)
+        {
+            ELOG("Could not write program cache %s", path.c_str());
+            return;
+        }
+
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(binary.data(), 1, binary.size(), file);
+        fclose(file);
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef PROGRAM_CACHE_FUNC
+#define PROGRAM_CACHE_FUNC
+
+#include "Globals.h"
+
+#define PROGRAM_CACHE_DIRECTORY "ProgramCache"
+#define PROGRAM_CACHE_MAGIC     0x50524743 // 'PRGC'
+#define PROGRAM_CACHE_VERSION   1
+
+// Larger binaries in a cache file are treated as corrupt
+#define PROGRAM_CACHE_MAX_BINARY_SIZE MB(64)
+
+struct ProgramCacheHeader
+{
+    u32    magic;
+    u32    version;
+    u64    key;
+    GLenum binaryFormat;
+    u32    binaryLength;
+};
+
+namespace ProgramCache
+{
+    // Checks driver support for program binaries and creates the cache directory.
+    bool Init();
+
+    bool IsSupported();
+
+    // Hash of the program source, the #define preamble injected before it and the driver strings.
+    u64 ComputeKey(String programSource, const char* preamble);
+
+    // Returns 0 if there is no cached binary for this key or the driver rejects it.
+    GLuint Load(const char* programName, u64 key);
+
+    void Store(GLuint programHandle, const char* programName, u64 key);
+}
+
+#endif // !PROGRAM_CACHE_FUNC
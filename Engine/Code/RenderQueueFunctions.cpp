@@ -0,0 +1,154 @@
+#include "RenderQueueFunctions.h"
+#include "BufferSuppFunctions.h"
+#include "VertexFormatFunctions.h"
+
+namespace RenderQueueManager
+{
+    u64 MakeDrawKey(GLuint program, GLuint vao, f32 depth, f32 farPlane)
+    {
+        const u64 depthMax = (1ull << DRAW_KEY_DEPTH_BITS) - 1ull;
+        f32 normalizedDepth = glm::clamp(depth / farPlane, 0.0f, 1.0f);
+
+        u64 key = 0;
+        key |= ((u64)program & 0xff) << DRAW_KEY_PROGRAM_SHIFT;
+        key |= ((u64)vao & 0xffff) << DRAW_KEY_VAO_SHIFT;
+        key |= (u64)(normalizedDepth * depthMax);
+        return key;
+    }
+
+    GpuDrawParams MakeDrawParams(const SubMesh& submesh, u32 materialIdx)
+    {
+        GpuDrawParams params = {};
+        params.positionOffset = vec4(submesh.aabbMin, 0.0f);
+        params.positionScale = vec4(VertexFormat::GetPositionScale(submesh.aabbMin, submesh.aabbMax), 0.0f);
+        params.materialIdx = materialIdx;
+        return params;
+    }
+
+    void Clear(RenderQueue& queue)
+    {
+        queue.commands.clear();
+    }
+
+    void Push(RenderQueue& queue, const DrawCommand& command)
+    {
+        queue.commands.push_back(command);
+    }
+
+    void Sort(RenderQueue& queue)
+    {
+        std::vector<DrawCommand>& src = queue.commands;
+        std::vector<DrawCommand>& dst = queue.scratch;
+        dst.resize(src.size());
+
+        const u32 count = (u32)src.size();
+        if (count < 2) return;
+
+        for (u32 shift = 0; shift < 64; shift += 8)
+        {
+            u32 histogram[256] = {};
+            for (u32 i = 0; i < count; ++i)
+            {
+                histogram[(src[i].key >> shift) & 0xff]++;
+            }
+
+            // Every key has the same byte here, the pass wouldn't move anything
+            if (histogram[(src[0].key >> shift) & 0xff] == count) continue;
+
+            u32 offset = 0;
+            for (u32 b = 0; b < 256; ++b)
+            {
+                u32 bucketCount = histogram[b];
+                histogram[b] = offset;
+                offset += bucketCount;
+            }
+
+            for (u32 i = 0; i < count; ++i)
+            {
+                dst[histogram[(src[i].key >> shift) & 0xff]++] = src[i];
+            }
+
+            src.swap(dst);
+        }
+    }
+
+    void Execute(RenderQueue& queue)
+    {
+        queue.drawCalls = 0;
+        queue.bindsSkipped = 0;
+
+        GLuint boundVao = 0;
+
+        for (const DrawCommand& command : queue.commands)
+        {
+            if (command.vao != boundVao)
+            {
+                glBindVertexArray(command.vao);
+                boundVao = command.vao;
+            }
+            else queue.bindsSkipped++;
+
+            glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, command.indexCount, GL_UNSIGNED_INT,
+                (void*)(u64)(command.firstIndex * sizeof(u32)), command.instanceCount, command.baseVertex, command.baseInstance);
+            queue.drawCalls++;
+        }
+
+        glBindVertexArray(0);
+    }
+
+    void ExecuteIndirect(RenderQueue& queue, Buffer& indirectBuffer)
+    {
+        queue.drawCalls = 0;
+        queue.bindsSkipped = 0;
+
+        const u32 count = (u32)queue.commands.size();
+        if (count == 0) return;
+
+        BufferManager::MapBuffer(indirectBuffer, GL_WRITE_ONLY);
+        BufferManager::AlignHead(indirectBuffer, sizeof(u32));
+        u32 commandsOffset = indirectBuffer.head;
+        for (const DrawCommand& command : queue.commands)
+        {
+            DrawElementsIndirectCommand indirect = {};
+            indirect.count = command.indexCount;
+            indirect.instanceCount = command.instanceCount;
+            indirect.firstIndex = command.firstIndex;
+            indirect.baseVertex = command.baseVertex;
+            indirect.baseInstance = command.baseInstance;
+            PushData(indirectBuffer, &indirect, sizeof(indirect));
+        }
+        BufferManager::UnmapBuffer(indirectBuffer);
+
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer.handle);
+
+        GLuint boundVao = 0;
+
+        u32 first = 0;
+        for (u32 i = 1; i <= count; ++i)
+        {
+            const DrawCommand& firstCommand = queue.commands[first];
+            if (i < count && queue.commands[i].vao == firstCommand.vao)
+                continue;
+
+            if (firstCommand.vao != boundVao)
+            {
+                glBindVertexArray(firstCommand.vao);
+                boundVao = firstCommand.vao;
+            }
+            else queue.bindsSkipped++;
+
+            // Every draw merged into this call saves its VAO bind
+            u32 drawCount = i - first;
+            queue.bindsSkipped += drawCount - 1;
+
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                (void*)(u64)(commandsOffset + first * sizeof(DrawElementsIndirectCommand)), drawCount, 0);
+            queue.drawCalls++;
+
+            first = i;
+        }
+
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        glBindVertexArray(0);
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef RENDER_QUEUE_FUNC
+#define RENDER_QUEUE_FUNC
+
+#include "Globals.h"
+
+//
+// Draw key, most significant bits first, so sorting the keys groups the draws
+// that share state and orders them front to back inside each group:
+//   program (8) | vao (16) | unused (16) | depth (24)
+// The materials don't split the groups, the draws find their textures through
+// the material table (see MaterialTableFunctions.h).
+//
+#define DRAW_KEY_PROGRAM_SHIFT 56
+#define DRAW_KEY_VAO_SHIFT     40
+#define DRAW_KEY_DEPTH_BITS    24
+
+struct DrawCommand
+{
+    u64    key;
+    GLuint vao;
+    u32    indexCount;
+    u32    firstIndex;
+    u32    baseVertex;
+    u32    instanceCount;
+    u32    baseInstance;
+};
+
+// std430 layout shared with the geometry shaders, one per draw. The visible list entries
+// of a draw point to it, see App::drawIndices.
+struct GpuDrawParams
+{
+    vec4 positionOffset; // submesh box the positions are quantized in
+    vec4 positionScale;
+    u32  materialIdx;
+    u32  padding[3];
+};
+
+// Layout read by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand
+{
+    u32 count;
+    u32 instanceCount;
+    u32 firstIndex;
+    u32 baseVertex;
+    u32 baseInstance;
+};
+
+struct RenderQueue
+{
+    std::vector<DrawCommand> commands;
+    std::vector<DrawCommand> scratch; // radix sort ping-pong buffer
+
+    // Last Execute() results
+    u32 drawCalls;
+    u32 bindsSkipped;
+};
+
+namespace RenderQueueManager
+{
+    // Depth is the view distance normalized by farPlane, quantized to DRAW_KEY_DEPTH_BITS
+    u64 MakeDrawKey(GLuint program, GLuint vao, f32 depth, f32 farPlane);
+
+    GpuDrawParams MakeDrawParams(const SubMesh& submesh, u32 materialIdx);
+
+    void Clear(RenderQueue& queue);
+
+    void Push(RenderQueue& queue, const DrawCommand& command);
+
+    // LSD radix sort on the keys, 8 bits per pass, skipping the bytes every key shares
+    void Sort(RenderQueue& queue);
+
+    // Issues the sorted instanced draws with the program and the material table already
+    // bound, binding a VAO only when it differs from the previous draw.
+    void Execute(RenderQueue& queue);
+
+    // Writes the sorted draws as indirect commands into the ring buffer and issues a
+    // glMultiDrawElementsIndirect per run of draws sharing a VAO.
+    void ExecuteIndirect(RenderQueue& queue, Buffer& indirectBuffer);
+}
+
+#endif // !RENDER_QUEUE_FUNC
@@ -0,0 +1,363 @@
+#include "engine.h"
+#include "TextureCacheFunctions.h"
+#include "BlockCompressionFunctions.h"
+#include "MipmapFunctions.h"
+
+#define DDS_MAGIC       0x20534444 // 'DDS '
+#define DDS_FOURCC_DX10 0x30315844 // 'DX10'
+#define DDS_FOURCC_DXT1 0x31545844 // 'DXT1'
+#define DDS_FOURCC_DXT5 0x35545844 // 'DXT5'
+
+#define DDSD_CAPS        0x1
+#define DDSD_HEIGHT      0x2
+#define DDSD_WIDTH       0x4
+#define DDSD_PIXELFORMAT 0x1000
+#define DDSD_MIPMAPCOUNT 0x20000
+#define DDSD_LINEARSIZE  0x80000
+#define DDPF_FOURCC      0x4
+#define DDSCAPS_COMPLEX  0x8
+#define DDSCAPS_TEXTURE  0x1000
+#define DDSCAPS_MIPMAP   0x400000
+
+#define DDS_DIMENSION_TEXTURE2D 3
+
+struct DdsPixelFormat
+{
+    u32 size;
+    u32 flags;
+    u32 fourCC;
+    u32 rgbBitCount;
+    u32 rBitMask;
+    u32 gBitMask;
+    u32 bBitMask;
+    u32 aBitMask;
+};
+
+struct DdsHeader
+{
+    u32            size;
+    u32            flags;
+    u32            height;
+    u32            width;
+    u32            pitchOrLinearSize;
+    u32            depth;
+    u32            mipMapCount;
+    u32            reserved1[11]; // magic, version, source timestamp (2), options
+    DdsPixelFormat pixelFormat;
+    u32            caps;
+    u32            caps2;
+    u32            caps3;
+    u32            caps4;
+    u32            reserved2;
+};
+
+struct DdsHeaderDX10
+{
+    u32 dxgiFormat;
+    u32 resourceDimension;
+    u32 miscFlag;
+    u32 arraySize;
+    u32 miscFlags2;
+};
+
+struct TextureFormat
+{
+    u32    dxgiFormat;
+    GLenum internalFormat;
+    u32    blockBytes;
+};
+
+static const TextureFormat TextureFormats[] =
+{
+    { 71, GL_COMPRESSED_RGB_S3TC_DXT1_EXT,       BC1_BLOCK_BYTES }, // BC1
+    { 77, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,      BC3_BLOCK_BYTES }, // BC3
+    { 80, GL_COMPRESSED_RED_RGTC1,               BC4_BLOCK_BYTES }, // BC4
+    { 83, GL_COMPRESSED_RG_RGTC2,                BC5_BLOCK_BYTES }, // BC5
+    { 95, GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT, 16 },              // BC6H
+    { 98, GL_COMPRESSED_RGBA_BPTC_UNORM,         16 },              // BC7
+};
+
+namespace TextureCache
+{
+    static const TextureFormat* FindFormat(u32 dxgiFormat, GLenum internalFormat)
+    {
+        for (const TextureFormat& format : TextureFormats)
+        {
+            if (format.dxgiFormat == dxgiFormat || format.internalFormat == internalFormat)
+                return &format;
+        }
+        return NULL;
+    }
+
+    std::string GetCachePath(const char* filename)
+    {
+        return std::string(filename) + TEXTURE_CACHE_EXTENSION;
+    }
+
+    u64 GetLevelSize(const CompressedImage& image, u32 level)
+    {
+        u64 width = glm::max(image.size.x >> level, 1);
+        u64 height = glm::max(image.size.y >> level, 1);
+        return ((width + 3) / 4) * ((height + 3) / 4) * image.blockBytes;
+    }
+
+    static u64 GetDataSize(const CompressedImage& image)
+    {
+        u64 dataSize = 0;
+        for (u32 level = 0; level < image.mipCount; ++level)
+        {
+            dataSize += GetLevelSize(image, level);
+        }
+        return dataSize;
+    }
+
+    CompressedImage Compress(const Image& image, TextureKind kind, std::vector<u8>& storage)
+    {
+        // Normal maps aren't colors, they are filtered as they are
+        MipChain chain;
+        Mipmaps::BuildChain(image, kind == TextureKind_Color, chain);
+
+        bool hasAlpha = false;
+        for (size_t i = 3; i < chain.levels[0].size() && !hasAlpha; i += 4)
+        {
+            hasAlpha = chain.levels[0][i] != 255;
+        }
+
+        u32 dxgiFormat = kind == TextureKind_Normal ? 83 : (hasAlpha ? 77 : 71);
+        const TextureFormat* format = FindFormat(dxgiFormat, 0);
+
+        CompressedImage compressed = {};
+        compressed.internalFormat = format->internalFormat;
+        compressed.blockBytes = format->blockBytes;
+        compressed.size = image.size;
+        compressed.mipCount = (u32)chain.levels.size();
+        compressed.dataSize = GetDataSize(compressed);
+        storage.assign(compressed.dataSize, 0);
+        compressed.data = storage.data();
+
+        u8* block = storage.data();
+        for (u32 mip = 0; mip < compressed.mipCount; ++mip)
+        {
+            const std::vector<u8>& level = chain.levels[mip];
+            const ivec2 levelSize = chain.sizes[mip];
+
+            for (i32 blockY = 0; blockY < levelSize.y; blockY += 4)
+            {
+                for (i32 blockX = 0; blockX < levelSize.x; blockX += 4)
+                {
+                    // Partial blocks repeat the edge texels
+                    u8 texels[16][4];
+                    for (u32 i = 0; i < 16; ++i)
+                    {
+                        i32 x = glm::min(blockX + (i32)(i % 4), levelSize.x - 1);
+                        i32 y = glm::min(blockY + (i32)(i / 4), levelSize.y - 1);
+                        memcpy(texels[i], &level[(y * levelSize.x + x) * 4], 4);
+                    }
+
+                    switch (dxgiFormat)
+                    {
+                    case 71: BlockCompression::EncodeBC1(texels, block); break;
+                    case 77: BlockCompression::EncodeBC3(texels, block); break;
+                    default: BlockCompression::EncodeBC5(texels, block); break;
+                    }
+                    block += compressed.blockBytes;
+                }
+            }
+        }
+
+        return compressed;
+    }
+
+    bool Write(const char* filename, TextureKind kind, bool flipVertically, const CompressedImage& image)
+    {
+        const TextureFormat* format = FindFormat(0, image.internalFormat);
+        if (!format)
+        {
+            ELOG("TextureCache: unsupported format 0x%x for %s", image.internalFormat, filename);
+            return false;
+        }
+
+        u64 sourceTimestamp = GetFileLastWriteTimestamp(filename);
+
+        DdsHeader header = {};
+        header.size = sizeof(DdsHeader);
+        header.flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE;
+        header.height = image.size.y;
+        header.width = image.size.x;
+        header.pitchOrLinearSize = (u32)GetLevelSize(image, 0);
+        header.mipMapCount = image.mipCount;
+        header.reserved1[0] = TEXTURE_CACHE_MAGIC;
+        header.reserved1[1] = TEXTURE_CACHE_VERSION;
+        header.reserved1[2] = (u32)sourceTimestamp;
+        header.reserved1[3] = (u32)(sourceTimestamp >> 32);
+        header.reserved1[4] = (u32)kind | (flipVertically ? 0x100 : 0);
+        header.pixelFormat.size = sizeof(DdsPixelFormat);
+        header.pixelFormat.flags = DDPF_FOURCC;
+        header.pixelFormat.fourCC = DDS_FOURCC_DX10;
+        header.caps = DDSCAPS_TEXTURE | DDSCAPS_COMPLEX | DDSCAPS_MIPMAP;
+
+        DdsHeaderDX10 headerDX10 = {};
+        headerDX10.dxgiFormat = format->dxgiFormat;
+        headerDX10.resourceDimension = DDS_DIMENSION_TEXTURE2D;
+        headerDX10.arraySize = 1;
+
+        std::string cachePath = GetCachePath(filename);
+        FILE* file = fopen(cachePath.c_str(), "wb");
+        if (!file)
+        {
+            ELOG("TextureCache: could not write %s", cachePath.c_str());
+            return false;
+        }
+
+        const u32 magic = DDS_MAGIC;
+        fwrite(&magic, sizeof(magic), 1, file);
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(&headerDX10, sizeof(headerDX10), 1, file);
+        fwrite(image.data, 1, image.dataSize, file);
+        fclose(file);
+
+        return true;
+    }
+
+    static bool MapCooked(const char* filename, TextureKind kind, bool flipVertically, CookedTexture& texture)
+    {
+        MappedFile file = MapFile(GetCachePath(filename).c_str());
+        if (!file.data) return false;
+
+        u64 dataOffset = sizeof(u32) + sizeof(DdsHeader);
+        const DdsHeader* header = (const DdsHeader*)(file.data + sizeof(u32));
+        bool valid = file.size >= dataOffset && *(const u32*)file.data == DDS_MAGIC;
+
+        // Ours must be newer than the image and cooked with the same options, files
+        // written by other tools are used as they are
+        if (valid && header->reserved1[0] == TEXTURE_CACHE_MAGIC)
+        {
+            u64 sourceTimestamp = (u64)header->reserved1[2] | ((u64)header->reserved1[3] << 32);
+            valid = header->reserved1[1] == TEXTURE_CACHE_VERSION &&
+                sourceTimestamp == GetFileLastWriteTimestamp(filename) &&
+                header->reserved1[4] == ((u32)kind | (flipVertically ? 0x100 : 0));
+        }
+
+        const TextureFormat* format = NULL;
+        if (valid)
+        {
+            u32 fourCC = header->pixelFormat.fourCC;
+            if (fourCC == DDS_FOURCC_DX10 && file.size >= dataOffset + sizeof(DdsHeaderDX10))
+            {
+                const DdsHeaderDX10* headerDX10 = (const DdsHeaderDX10*)(file.data + dataOffset);
+                dataOffset += sizeof(DdsHeaderDX10);
+                if (headerDX10->arraySize == 1)
+                    format = FindFormat(headerDX10->dxgiFormat, 0);
+            }
+            else if (fourCC == DDS_FOURCC_DXT1) format = FindFormat(71, 0);
+            else if (fourCC == DDS_FOURCC_DXT5) format = FindFormat(77, 0);
+
+            if (!format)
+            {
+                ELOG("TextureCache: %s has an unsupported format", GetCachePath(filename).c_str());
+            }
+        }
+
+        if (format)
+        {
+            CompressedImage& image = texture.image;
+            image.internalFormat = format->internalFormat;
+            image.blockBytes = format->blockBytes;
+            image.size = ivec2((i32)header->width, (i32)header->height);
+            image.mipCount = (header->flags & DDSD_MIPMAPCOUNT) ? glm::max(header->mipMapCount, 1u) : 1;
+            image.data = file.data + dataOffset;
+
+            // Checked before computing the level sizes, which shift the size by the level
+            valid = image.size.x > 0 && image.size.y > 0 && image.mipCount <= Mipmaps::GetLevelCount(image.size);
+            if (valid)
+            {
+                image.dataSize = GetDataSize(image);
+                valid = file.size >= dataOffset + image.dataSize;
+            }
+            else
+            {
+                ELOG("TextureCache: %s has an invalid size (%u x %u, %u mips)", GetCachePath(filename).c_str(),
+                    header->width, header->height, image.mipCount);
+            }
+        }
+
+        if (!valid || !format)
+        {
+            UnmapFile(file);
+            return false;
+        }
+
+        texture.file = file;
+        return true;
+    }
+
+    bool Load(const char* filename, TextureKind kind, bool flipVertically, CookedTexture& texture)
+    {
+        if (MapCooked(filename, kind, flipVertically, texture))
+            return true;
+
+        Image image = ModelLoader::LoadImage(filename, flipVertically);
+        if (!image.pixels)
+            return false;
+
+        texture.storage = std::make_shared<std::vector<u8>>();
+        texture.image = Compress(image, kind, *texture.storage);
+        ModelLoader::FreeImage(image);
+
+        Write(filename, kind, flipVertically, texture.image);
+        return true;
+    }
+
+    void Release(CookedTexture& texture)
+    {
+        if (texture.file.data) UnmapFile(texture.file);
+        texture.storage.reset();
+        texture.image.data = NULL;
+    }
+
+    void UploadLevels(GLenum target, const CompressedImage& image)
+    {
+        const u8* data = image.data;
+        for (u32 level = 0; level < image.mipCount; ++level)
+        {
+            u64 levelSize = GetLevelSize(image, level);
+            glCompressedTexImage2D(target, level, image.internalFormat,
+                glm::max(image.size.x >> level, 1), glm::max(image.size.y >> level, 1), 0, (GLsizei)levelSize, data);
+            data += levelSize;
+        }
+    }
+
+    GLuint CreateTexture2D(const CompressedImage& image)
+    {
+        GLuint texHandle;
+        glGenTextures(1, &texHandle);
+        glBindTexture(GL_TEXTURE_2D, texHandle);
+        UploadLevels(GL_TEXTURE_2D, image);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image.mipCount - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        return texHandle;
+    }
+
+    bool Cook(const char* filename, TextureKind kind, bool flipVertically)
+    {
+        Image image = ModelLoader::LoadImage(filename, flipVertically);
+        if (!image.pixels)
+            return false;
+
+        std::vector<u8> storage;
+        CompressedImage compressed = Compress(image, kind, storage);
+        ModelLoader::FreeImage(image);
+
+        bool written = Write(filename, kind, flipVertically, compressed);
+        if (written)
+        {
+            ILOG("Cooked %s into %s (%u levels, %llu bytes)", filename, GetCachePath(filename).c_str(), compressed.mipCount, compressed.dataSize);
+        }
+        return written;
+    }
+}
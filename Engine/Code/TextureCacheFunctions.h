@@ -0,0 +1,81 @@
+#ifndef TEXTURE_CACHE_FUNC
+#define TEXTURE_CACHE_FUNC
+
+#include "Globals.h"
+#include "platform.h"
+#include <memory>
+
+//
+// Cooked textures: block compressed images with their whole mip chain (see MipmapFunctions.h), stored next to
+// the source file as <image>.dds. Loading one maps the file and hands every level to
+// glCompressedTexImage2D, without decoding anything. The files use the DX10 header so
+// other tools open them, and BC7/BC6H files written by those tools (texconv...) load too.
+// Ours keep the source timestamp and the cook options in the reserved header words.
+//
+// Albedo becomes BC1, or BC3 when it has alpha, normal maps BC5 and the skybox faces BC1.
+//
+
+#define TEXTURE_CACHE_EXTENSION ".dds"
+#define TEXTURE_CACHE_MAGIC     0x4e474e45 // 'ENGN'
+#define TEXTURE_CACHE_VERSION   2
+
+// S3TC isn't part of core OpenGL, the enums come from EXT_texture_compression_s3tc
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT  0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+enum TextureKind
+{
+    TextureKind_Color,
+    TextureKind_Normal,
+};
+
+struct CompressedImage
+{
+    GLenum    internalFormat;
+    u32       blockBytes;
+    ivec2     size;
+    u32       mipCount;
+    const u8* data;     // every level, largest first
+    u64       dataSize;
+};
+
+// A compressed image either mapped from its .dds or encoded in memory
+struct CookedTexture
+{
+    CompressedImage                  image;
+    MappedFile                       file;
+    std::shared_ptr<std::vector<u8>> storage;
+};
+
+namespace TextureCache
+{
+    std::string GetCachePath(const char* filename);
+
+    // Bytes of a level, rounded up to whole 4x4 blocks
+    u64 GetLevelSize(const CompressedImage& image, u32 level);
+
+    // Encodes a decoded image and its mip chain into storage, the result points into it
+    CompressedImage Compress(const Image& image, TextureKind kind, std::vector<u8>& storage);
+
+    bool Write(const char* filename, TextureKind kind, bool flipVertically, const CompressedImage& image);
+
+    // Maps the cooked texture of an image, or decodes, compresses and writes it when there is none
+    // or it is older than the image. It doesn't touch OpenGL, so workers can call it.
+    bool Load(const char* filename, TextureKind kind, bool flipVertically, CookedTexture& texture);
+
+    void Release(CookedTexture& texture);
+
+    // Uploads every level to a target of the bound texture (GL_TEXTURE_2D, a cube map face...)
+    void UploadLevels(GLenum target, const CompressedImage& image);
+
+    GLuint CreateTexture2D(const CompressedImage& image);
+
+    // Offline cooking, doesn't need a GL context
+    bool Cook(const char* filename, TextureKind kind, bool flipVertically);
+}
+
+#endif // !TEXTURE_CACHE_FUNC
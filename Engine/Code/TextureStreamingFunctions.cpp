@@ -0,0 +1,229 @@
+#include "engine.h"
+#include "TextureStreamingFunctions.h"
+
+#include <algorithm>
+
+namespace TextureStreaming
+{
+    u64 GetBytesFromMip(const CompressedImage& image, u32 mip)
+    {
+        u64 bytes = 0;
+        for (u32 level = mip; level < image.mipCount; ++level)
+        {
+            bytes += TextureCache::GetLevelSize(image, level);
+        }
+        return bytes;
+    }
+
+    // The levels from a mip on, as an image of their own
+    static CompressedImage GetLevels(const CompressedImage& image, u32 mip, const u8* data)
+    {
+        CompressedImage levels = image;
+        levels.size = glm::max(ivec2(image.size.x >> mip, image.size.y >> mip), ivec2(1));
+        levels.mipCount = image.mipCount - mip;
+        levels.data = data;
+        levels.dataSize = GetBytesFromMip(image, mip);
+        return levels;
+    }
+
+    // Replaces the texture of the slot with one holding the given levels
+    static void SetResidentMip(App& app, StreamedTexture& streamed, u32 mip, const u8* data)
+    {
+        CompressedImage levels = GetLevels(streamed.source.image, mip, data);
+
+        Texture& texture = app.textures[streamed.textureIdx];
+        GLuint previous = texture.handle;
+        texture.handle = TextureCache::CreateTexture2D(levels);
+        texture.memoryBytes = levels.dataSize;
+        glDeleteTextures(1, &previous);
+
+        streamed.residentMip = mip;
+        streamed.framesUnneeded = 0;
+    }
+
+    static const u8* GetMipData(const CompressedImage& image, u32 mip)
+    {
+        return image.data + (image.dataSize - GetBytesFromMip(image, mip));
+    }
+
+    void Register(App& app, TextureStreamer& streamer, u32 textureIdx, const CookedTexture& source)
+    {
+        StreamedTexture streamed = {};
+        streamed.textureIdx = textureIdx;
+        streamed.source = source;
+
+        const CompressedImage& image = source.image;
+        while (streamed.startMip + 1 < image.mipCount &&
+            glm::max(image.size.x, image.size.y) >> streamed.startMip > TEXTURE_STREAMING_START_SIZE)
+        {
+            streamed.startMip++;
+        }
+        streamed.requestedMip = streamed.startMip;
+
+        // The slot still shows a placeholder, which isn't ours to delete
+        Texture& texture = app.textures[textureIdx];
+        CompressedImage levels = GetLevels(image, streamed.startMip, GetMipData(image, streamed.startMip));
+        texture.handle = TextureCache::CreateTexture2D(levels);
+        texture.memoryBytes = levels.dataSize;
+        streamed.residentMip = streamed.startMip;
+
+        streamer.textures.push_back(streamed);
+    }
+
+    // Largest screen diameter, in pixels, of the entities using each texture slot
+    static void ComputeFootprints(const App& app, std::vector<f32>& footprints)
+    {
+        footprints.assign(app.textures.size(), 0.0f);
+
+        glm::mat4 view = glm::lookAt(app.sceneCam.cameraPos, app.sceneCam.cameraPos + app.sceneCam.cameraFront, app.sceneCam.cameraUp);
+        Frustum frustum = Culling::ExtractFrustum(app.projection * view);
+        const f32 pixelsPerUnit = app.projection[1][1] * app.displaySize.y * 0.5f;
+
+        for (const Entity& entity : app.entities)
+        {
+            if (!entity.boundsValid || !Culling::IsAabbVisible(frustum, entity.worldAabbMin, entity.worldAabbMax))
+                continue;
+
+            vec3 center = (entity.worldAabbMin + entity.worldAabbMax) * 0.5f;
+            f32 radius = glm::length(entity.worldAabbMax - entity.worldAabbMin) * 0.5f;
+            f32 distance = glm::max(glm::length(center - app.sceneCam.cameraPos) - radius, CAMERA_Z_NEAR);
+            f32 footprint = 2.0f * radius * pixelsPerUnit / distance;
+
+            const Model& model = app.models[entity.modelIndex];
+            for (u32 materialIdx : model.materialIdx)
+            {
+                const Material& material = app.materials[materialIdx];
+                const u32 textureIndices[] = { material.albedoTextureIdx, material.emissiveTextureIdx, material.specularTextureIdx,
+                    material.normalsTextureIdx, material.bumpTextureIdx };
+                for (u32 textureIdx : textureIndices)
+                {
+                    if (textureIdx < footprints.size())
+                        footprints[textureIdx] = glm::max(footprints[textureIdx], footprint);
+                }
+            }
+        }
+    }
+
+    static void RequestLevels(App& app, TextureStreamer& streamer, u32 slot, u32 mip)
+    {
+        StreamedTexture& streamed = streamer.textures[slot];
+        streamed.loading = true;
+        streamer.loadingBytes += GetBytesFromMip(streamed.source.image, mip) - GetBytesFromMip(streamed.source.image, streamed.residentMip);
+
+        // Reading the levels may fault the pages of the mapping in, keep that off the main thread
+        JobSystem* jobs = &app.jobs;
+        const u8* data = GetMipData(streamed.source.image, mip);
+        u64 size = GetBytesFromMip(streamed.source.image, mip);
+        JobManager::Submit(app.jobs, [jobs, data, size, slot, mip]()
+        {
+            std::shared_ptr<std::vector<u8>> levels = std::make_shared<std::vector<u8>>(data, data + size);
+
+            JobManager::PushUpload(*jobs, [levels, slot, mip](App* app)
+            {
+                TextureStreamer& streamer = app->textureStreaming;
+                StreamedTexture& streamed = streamer.textures[slot];
+                streamer.loadingBytes -= GetBytesFromMip(streamed.source.image, mip) - GetBytesFromMip(streamed.source.image, streamed.residentMip);
+                streamed.loading = false;
+                SetResidentMip(*app, streamed, mip, levels->data());
+            });
+        });
+    }
+
+    void Update(App& app, TextureStreamer& streamer)
+    {
+        std::vector<f32> footprints;
+        ComputeFootprints(app, footprints);
+
+        // Requested levels, the finest mip is the one with about a texel per pixel
+        for (StreamedTexture& streamed : streamer.textures)
+        {
+            const CompressedImage& image = streamed.source.image;
+            f32 footprint = footprints[streamed.textureIdx];
+
+            u32 mip = streamed.startMip;
+            if (!streamer.enabled)
+            {
+                mip = 0;
+            }
+            else if (footprint > 0.0f)
+            {
+                f32 level = log2f(glm::max(image.size.x, image.size.y) / footprint) + streamer.mipBias;
+                mip = (u32)glm::clamp(floorf(level), 0.0f, (f32)streamed.startMip);
+            }
+            streamed.requestedMip = mip;
+        }
+
+        // Evictions, once the finer levels went unused for a while
+        for (StreamedTexture& streamed : streamer.textures)
+        {
+            if (streamed.loading) continue;
+
+            if (streamed.requestedMip <= streamed.residentMip)
+            {
+                streamed.framesUnneeded = 0;
+                continue;
+            }
+
+            if (++streamed.framesUnneeded >= (u32)streamer.evictFrames)
+                SetResidentMip(app, streamed, streamed.requestedMip, GetMipData(streamed.source.image, streamed.requestedMip));
+        }
+
+        // The budget is for everything the textures take on the GPU, the array layers the material
+        // table copies them to included
+        streamer.gpuBytes = app.GetTextureMemoryBytes();
+        streamer.residentBytes = 0;
+        streamer.requestedBytes = 0;
+        for (const StreamedTexture& streamed : streamer.textures)
+        {
+            streamer.residentBytes += GetBytesFromMip(streamed.source.image, streamed.residentMip);
+            streamer.requestedBytes += GetBytesFromMip(streamed.source.image, streamed.requestedMip);
+        }
+
+        // Loads, the textures missing the most levels first
+        std::vector<u32> pending;
+        for (u32 slot = 0; slot < streamer.textures.size(); ++slot)
+        {
+            const StreamedTexture& streamed = streamer.textures[slot];
+            if (!streamed.loading && streamed.requestedMip < streamed.residentMip)
+                pending.push_back(slot);
+        }
+        std::sort(pending.begin(), pending.end(), [&streamer](u32 a, u32 b)
+        {
+            const StreamedTexture& textureA = streamer.textures[a];
+            const StreamedTexture& textureB = streamer.textures[b];
+            return textureA.residentMip - textureA.requestedMip > textureB.residentMip - textureB.requestedMip;
+        });
+
+        for (u32 slot : pending)
+        {
+            StreamedTexture& streamed = streamer.textures[slot];
+            const CompressedImage& image = streamed.source.image;
+            const u64 residentBytes = GetBytesFromMip(image, streamed.residentMip);
+
+            // Over budget, the levels not needed anymore go first
+            u64 usedBytes = streamer.gpuBytes + streamer.loadingBytes;
+            u64 extraBytes = GetBytesFromMip(image, streamed.requestedMip) - residentBytes;
+            for (u32 i = 0; i < streamer.textures.size() && usedBytes + extraBytes > streamer.budgetBytes; ++i)
+            {
+                StreamedTexture& other = streamer.textures[i];
+                if (other.loading || other.requestedMip <= other.residentMip) continue;
+
+                u64 freedBytes = GetBytesFromMip(other.source.image, other.residentMip) - GetBytesFromMip(other.source.image, other.requestedMip);
+                SetResidentMip(app, other, other.requestedMip, GetMipData(other.source.image, other.requestedMip));
+                streamer.residentBytes -= freedBytes;
+                streamer.gpuBytes -= glm::min(freedBytes, streamer.gpuBytes);
+                usedBytes -= glm::min(freedBytes, usedBytes);
+            }
+
+            // Otherwise as many levels as fit
+            u32 mip = streamed.requestedMip;
+            while (mip < streamed.residentMip && usedBytes + GetBytesFromMip(image, mip) - residentBytes > streamer.budgetBytes)
+            {
+                mip++;
+            }
+
+            if (mip < streamed.residentMip)
+                RequestLevels(app, streamer, slot, mip);
+        }
+    }
+}
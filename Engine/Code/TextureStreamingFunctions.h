@@ -0,0 +1,62 @@
+#ifndef TEXTURE_STREAMING_FUNC
+#define TEXTURE_STREAMING_FUNC
+
+#include "Globals.h"
+#include "TextureCacheFunctions.h"
+
+//
+// Mip streaming of the cooked textures. A texture starts with the levels up to
+// TEXTURE_STREAMING_START_SIZE only, and every frame each one gets the level its largest
+// screen footprint needs: the bounding sphere of the entities using it, projected at their
+// distance, against the texture size (one texel per pixel when the UVs cover the object
+// once). Finer levels are read from the mapped .dds on a worker and the texture is
+// recreated with them, levels that stay unneeded for evictFrames frames are dropped the
+// same way. The GPU memory of all the textures (App::GetTextureMemoryBytes, the material
+// arrays included) is kept under budgetBytes.
+//
+
+// Largest side of the first level a streamed texture gets
+#define TEXTURE_STREAMING_START_SIZE 64
+
+struct StreamedTexture
+{
+    u32           textureIdx;
+    CookedTexture source;         // stays mapped, every level is read from it
+    u32           startMip;       // always resident
+    u32           residentMip;    // first level on the GPU
+    u32           requestedMip;   // for the footprint of this frame
+    u32           framesUnneeded; // frames the resident levels were finer than requested
+    bool          loading;
+};
+
+struct TextureStreamer
+{
+    bool                         enabled = true;
+    u64                          budgetBytes = 256ull * 1024 * 1024;
+    i32                          evictFrames = 120;
+    f32                          mipBias = 0.0f; // added to the requested level
+
+    std::vector<StreamedTexture> textures;
+
+    // Last frame
+    u64                          residentBytes;  // levels of the streamed textures
+    u64                          gpuBytes;       // App::GetTextureMemoryBytes
+    u64                          requestedBytes;
+    u64                          loadingBytes;
+};
+
+struct App;
+
+namespace TextureStreaming
+{
+    // Bytes of the levels from a mip to the smallest one
+    u64 GetBytesFromMip(const CompressedImage& image, u32 mip);
+
+    // Takes the cooked texture of a texture slot and uploads its start levels
+    void Register(App& app, TextureStreamer& streamer, u32 textureIdx, const CookedTexture& source);
+
+    // Requested levels from the entity bounds of this frame, then evictions and loads
+    void Update(App& app, TextureStreamer& streamer);
+}
+
+#endif // !TEXTURE_STREAMING_FUNC
@@ -0,0 +1,102 @@
+#include "VertexFormatFunctions.h"
+
+#include <glm/gtc/packing.hpp>
+
+namespace VertexFormat
+{
+    u32 GetAttributeSize(const VertexBufferAttribute& attribute)
+    {
+        return attribute.componentCount * (attribute.type == VertexAttributeType_Float ? sizeof(f32) : sizeof(u16));
+    }
+
+    GLenum GetComponentType(const VertexBufferAttribute& attribute)
+    {
+        switch (attribute.type)
+        {
+        case VertexAttributeType_UNorm16: return GL_UNSIGNED_SHORT;
+        case VertexAttributeType_SNorm16: return GL_SHORT;
+        case VertexAttributeType_Half:    return GL_HALF_FLOAT;
+        default:                          return GL_FLOAT;
+        }
+    }
+
+    GLboolean IsNormalized(const VertexBufferAttribute& attribute)
+    {
+        return attribute.type == VertexAttributeType_UNorm16 || attribute.type == VertexAttributeType_SNorm16 ? GL_TRUE : GL_FALSE;
+    }
+
+    VertexBufferLayout GetCompactLayout(bool hasTexCoords, bool hasTangentSpace)
+    {
+        VertexBufferLayout layout = {};
+        layout.attributes.push_back(VertexBufferAttribute{ 0, 4, 0, VertexAttributeType_UNorm16 });
+        layout.attributes.push_back(VertexBufferAttribute{ 1, 2, 8, VertexAttributeType_SNorm16 });
+        layout.stride = 12;
+        if (hasTexCoords)
+        {
+            layout.attributes.push_back(VertexBufferAttribute{ 2, 2, layout.stride, VertexAttributeType_Half });
+            layout.stride += 2 * sizeof(u16);
+        }
+        if (hasTangentSpace)
+        {
+            layout.attributes.push_back(VertexBufferAttribute{ 3, 4, layout.stride, VertexAttributeType_SNorm16 });
+            layout.stride += 4 * sizeof(u16);
+        }
+        return layout;
+    }
+
+    vec3 GetPositionScale(const vec3& aabbMin, const vec3& aabbMax)
+    {
+        return glm::max(aabbMax - aabbMin, vec3(1e-6f));
+    }
+
+    static f32 SignNotZero(f32 value)
+    {
+        return value >= 0.0f ? 1.0f : -1.0f;
+    }
+
+    vec2 OctahedronEncode(vec3 normal)
+    {
+        normal /= glm::max(fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z), 1e-6f);
+        if (normal.z >= 0.0f)
+            return vec2(normal.x, normal.y);
+        return vec2((1.0f - fabsf(normal.y)) * SignNotZero(normal.x), (1.0f - fabsf(normal.x)) * SignNotZero(normal.y));
+    }
+
+    static void PushShorts(std::vector<u8>& vertices, const u16* values, u32 count)
+    {
+        const u8* bytes = (const u8*)values;
+        vertices.insert(vertices.end(), bytes, bytes + count * sizeof(u16));
+    }
+
+    void PushCompactVertex(std::vector<u8>& vertices, const VertexBufferLayout& layout, const vec3& aabbMin, const vec3& aabbMax,
+        const vec3& position, const vec3& normal, const vec2& texCoord, const vec3& tangent, const vec3& bitangent)
+    {
+        const size_t start = vertices.size();
+
+        vec3 relative = glm::clamp((position - aabbMin) / GetPositionScale(aabbMin, aabbMax), vec3(0.0f), vec3(1.0f));
+        u16 quantizedPosition[4] = { glm::packUnorm1x16(relative.x), glm::packUnorm1x16(relative.y), glm::packUnorm1x16(relative.z), 0 };
+        PushShorts(vertices, quantizedPosition, 4);
+
+        vec2 encodedNormal = OctahedronEncode(normal);
+        u16 quantizedNormal[2] = { glm::packSnorm1x16(encodedNormal.x), glm::packSnorm1x16(encodedNormal.y) };
+        PushShorts(vertices, quantizedNormal, 2);
+
+        for (const VertexBufferAttribute& attribute : layout.attributes)
+        {
+            if (attribute.location == 2)
+            {
+                u16 halfTexCoord[2] = { glm::packHalf1x16(texCoord.x), glm::packHalf1x16(texCoord.y) };
+                PushShorts(vertices, halfTexCoord, 2);
+            }
+            else if (attribute.location == 3)
+            {
+                vec2 encodedTangent = OctahedronEncode(tangent);
+                f32 bitangentSign = glm::dot(glm::cross(normal, tangent), bitangent) < 0.0f ? -1.0f : 1.0f;
+                u16 quantizedTangent[4] = { glm::packSnorm1x16(encodedTangent.x), glm::packSnorm1x16(encodedTangent.y), glm::packSnorm1x16(bitangentSign), 0 };
+                PushShorts(vertices, quantizedTangent, 4);
+            }
+        }
+
+        ASSERT(vertices.size() - start == layout.stride, "The compact vertex doesn't match its layout");
+    }
+}
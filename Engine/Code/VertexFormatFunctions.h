@@ -0,0 +1,39 @@
+#ifndef VERTEX_FORMAT_FUNC
+#define VERTEX_FORMAT_FUNC
+
+#include "Globals.h"
+
+//
+// Compact vertex format of the imported meshes, 24 bytes instead of the 56 of the float
+// position, normal, UV, tangent and bitangent:
+//   location 0: position, UNORM16 x4, inside the submesh box (w unused)
+//   location 1: normal, SNORM16 x2, octahedron encoded
+//   location 2: UV, half x2
+//   location 3: tangent, SNORM16 x4, octahedron encoded in xy, bitangent sign in z
+// The shaders rebuild the object space position with the box of the draw (see GpuDrawParams)
+// and the bitangent as cross(normal, tangent) * sign.
+//
+
+namespace VertexFormat
+{
+    u32 GetAttributeSize(const VertexBufferAttribute& attribute);
+
+    GLenum GetComponentType(const VertexBufferAttribute& attribute);
+
+    GLboolean IsNormalized(const VertexBufferAttribute& attribute);
+
+    VertexBufferLayout GetCompactLayout(bool hasTexCoords, bool hasTangentSpace);
+
+    // Size of the box the positions are quantized in, flat boxes get a minimum size
+    vec3 GetPositionScale(const vec3& aabbMin, const vec3& aabbMax);
+
+    // Unit vector to [-1, 1]^2, through the octahedron |x| + |y| + |z| = 1 unfolded on a square
+    vec2 OctahedronEncode(vec3 normal);
+
+    // Appends a vertex in the compact layout. The texture coordinates and tangent space are only
+    // written if the layout has them.
+    void PushCompactVertex(std::vector<u8>& vertices, const VertexBufferLayout& layout, const vec3& aabbMin, const vec3& aabbMax,
+        const vec3& position, const vec3& normal, const vec2& texCoord, const vec3& tangent, const vec3& bitangent);
+}
+
+#endif // !VERTEX_FORMAT_FUNC
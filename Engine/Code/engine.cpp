@@ -6,6 +6,8 @@
 //
 
 #include "engine.h"
+#include <algorithm>
+#include <random>
 #include <imgui.h>
 #include <stb_image.h>
 #include <stb_image_write.h>
@@ -56,6 +58,66 @@ float skyboxVertices[] = {
    90.0f, -90.0f,  90.0f
 };
 
+// Compute programs have a single stage, guarded by #if defined(COMPUTE) like the VERTEX/FRAGMENT ones.
+// Loaded through LoadComputeProgram()
+GLuint CreateComputeProgramFromSource(String programSource, const char* shaderName)
+{
+    GLchar  infoLogBuffer[1024] = {};
+    GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
+    GLsizei infoLogSize;
+    GLint   success;
+
+    char versionString[] = GLSL_VERSION_STRING;
+    char shaderNameDefine[128];
+    sprintf(shaderNameDefine, "#define %s\n", shaderName);
+    char computeShaderDefine[] = "#define COMPUTE\n";
+
+    const GLchar* computeShaderSource[] = {
+        versionString,
+        shaderNameDefine,
+        computeShaderDefine,
+        programSource.str
+    };
+    const GLint computeShaderLengths[] = {
+        (GLint)strlen(versionString),
+        (GLint)strlen(shaderNameDefine),
+        (GLint)strlen(computeShaderDefine),
+        (GLint)programSource.len
+    };
+
+    GLuint cshader = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(cshader, ARRAY_COUNT(computeShaderSource), computeShaderSource, computeShaderLengths);
+    glCompileShader(cshader);
+    glGetShaderiv(cshader, GL_COMPILE_STATUS, &success);
+    if (!success)
+    {
+        glGetShaderInfoLog(cshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+        ELOG("glCompileShader() failed with compute shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+    }
+
+    GLuint programHandle = glCreateProgram();
+    glAttachShader(programHandle, cshader);
+    glProgramParameteri(programHandle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(programHandle);
+    glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        glGetProgramInfoLog(programHandle, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+        ELOG("glLinkProgram() failed with program %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+    }
+
+    glDetachShader(programHandle, cshader);
+    glDeleteShader(cshader);
+
+    if (!success)
+    {
+        glDeleteProgram(programHandle);
+        programHandle = 0;
+    }
+
+    return programHandle;
+}
+
 GLuint CreateProgramFromSource(String programSource, const char* shaderName)
 {
     GLchar  infoLogBuffer[1024] = {};
@@ -63,7 +125,7 @@ GLuint CreateProgramFromSource(String programSource, const char* shaderName)
     GLsizei infoLogSize;
     GLint   success;
 
-    char versionString[] = "#version 430\n";
+    char versionString[] = GLSL_VERSION_STRING;
     char shaderNameDefine[128];
     sprintf(shaderNameDefine, "#define %s\n", shaderName);
     char vertexShaderDefine[] = "#define VERTEX\n";
@@ -117,6 +179,7 @@ GLuint CreateProgramFromSource(String programSource, const char* shaderName)
     GLuint programHandle = glCreateProgram();
     glAttachShader(programHandle, vshader);
     glAttachShader(programHandle, fshader);
+    glProgramParameteri(programHandle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(programHandle);
     glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
     if (!success)
@@ -132,18 +195,55 @@ GLuint CreateProgramFromSource(String programSource, const char* shaderName)
     glDeleteShader(vshader);
     glDeleteShader(fshader);
 
+    if (!success)
+    {
+        glDeleteProgram(programHandle);
+        programHandle = 0;
+    }
+
     return programHandle;
 }
 
-u32 LoadProgram(App* app, const char* filepath, const char* programName)
-{
-    String programSource = ReadTextFile(filepath);
+static const char* UniformNames[] = {
+    "uTexture",
+    "viewMatrix",
+    "projectionMatrix",
+    "modelMatrix",
+    "reflectionTexture",
+    "refractionTexture",
+    "dudvMap",
+    "moveFactor",
+    "uAlbedo",
+    "uNormals",
+    "uPosition",
+    "uViewDir",
+    "projection",
+    "view",
+    "uFrustumPlanes",
+    "uInstanceCount",
+    "uCounterIndex",
+    "uMode",
+    "uSourceSize",
+    "uNearFar",
+    "uInverseProjection",
+    "uWorldViewProjection",
+    "uLightIndex",
+    "uViewportSize",
+    "uDepth",
+    "uInverseViewProjection",
+    "uCompactGBuffer",
+    "uMaterialArrays"
+};
+static_assert(ARRAY_COUNT(UniformNames) == Uniform_Count, "Missing uniform names");
 
-    Program program = {};
-    program.handle = CreateProgramFromSource(programSource, programName);
-    program.filepath = filepath;
-    program.programName = programName;
-    program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+void ReflectProgram(Program& program)
+{
+    program.shaderLayout.attributes.clear();
+    program.uniforms.clear();
+    for (u32 i = 0; i < Uniform_Count; ++i)
+    {
+        program.uniformLocations[i] = -1;
+    }
 
     GLint attributeCount = 0;
     glGetProgramiv(program.handle, GL_ACTIVE_ATTRIBUTES, &attributeCount);
@@ -165,63 +265,136 @@ u32 LoadProgram(App* app, const char* filepath, const char* programName)
         program.shaderLayout.attributes.push_back(VertexShaderAttribute{ location, (u8)size });
     }
 
-    app->programs.push_back(program);
+    GLint uniformCount = 0;
+    glGetProgramiv(program.handle, GL_ACTIVE_UNIFORMS, &uniformCount);
 
-    return app->programs.size() - 1;
+    for (GLuint i = 0; i < (GLuint)uniformCount; i++)
+    {
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type = 0;
+        GLchar name[256];
+        glGetActiveUniform(program.handle, i,
+            ARRAY_COUNT(name),
+            &length,
+            &size,
+            &type,
+            name);
+
+        // Uniforms inside uniform blocks have no location
+        GLint location = glGetUniformLocation(program.handle, name);
+        if (location == -1) continue;
+
+        // Arrays are reported as "name[0]"
+        std::string uniformName = name;
+        size_t bracket = uniformName.find('[');
+        if (bracket != std::string::npos) uniformName.resize(bracket);
+
+        program.uniforms.push_back(ShaderUniform{ uniformName, location, type, size });
+
+        for (u32 id = 0; id < Uniform_Count; ++id)
+        {
+            if (uniformName == UniformNames[id])
+            {
+                program.uniformLocations[id] = location;
+                break;
+            }
+        }
+    }
 }
 
-GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
+GLuint CreateProgram(App* app, String programSource, const char* programName, bool isCompute, bool* fromCache)
 {
-    GLuint ReturnValue = 0;
+    char preamble[256];
+    sprintf(preamble, "%s#define %s\n%s", GLSL_VERSION_STRING, programName, isCompute ? "#define COMPUTE\n" : "");
+    u64 key = ProgramCache::ComputeKey(programSource, preamble);
 
-    SubMesh& Submesh = mesh.submeshes[submeshIndex];
-    for (u32 i = 0; i < (u32)Submesh.vaos.size(); ++i)
+    if (app->useProgramCache)
     {
-        if (Submesh.vaos[i].programHandle == program.handle)
+        GLuint programHandle = ProgramCache::Load(programName, key);
+        if (programHandle != 0)
         {
-            ReturnValue = Submesh.vaos[i].handle;
-            break;
+            if (fromCache) *fromCache = true;
+            return programHandle;
         }
     }
 
-    if (ReturnValue == 0)
-    {
-        glGenVertexArrays(1, &ReturnValue);
-        glBindVertexArray(ReturnValue);
+    GLuint programHandle = isCompute ? CreateComputeProgramFromSource(programSource, programName) : CreateProgramFromSource(programSource, programName);
+    ProgramCache::Store(programHandle, programName, key);
+    if (fromCache) *fromCache = false;
+    return programHandle;
+}
 
-        glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
+static u32 LoadProgram(App* app, const char* filepath, const char* programName, bool isCompute)
+{
+    f64 startTime = glfwGetTime();
 
-        auto& ShaderLayout = program.shaderLayout.attributes;
-        for (auto ShaderIt = ShaderLayout.cbegin(); ShaderIt != ShaderLayout.cend(); ++ShaderIt)
-        {
-            bool attributeWasLinked = false;
-            auto SubmeshLayout = Submesh.vertexBufferLayout.attributes;
-            for (auto SubmeshIt = SubmeshLayout.cbegin(); SubmeshIt != SubmeshLayout.cend(); ++SubmeshIt)
-            {
-                if (ShaderIt->location == SubmeshIt->location)
-                {
-                    const u32 index = SubmeshIt->location;
-                    const u32 ncomp = SubmeshIt->componentCount;
-                    const u32 offset = SubmeshIt->offset + Submesh.vertexOffset;
-                    const u32 stride = Submesh.vertexBufferLayout.stride;
+    String programSource = ReadTextFile(filepath);
 
-                    glVertexAttribPointer(index, ncomp, GL_FLOAT, GL_FALSE, stride, (void*)(u64)(offset));
-                    glEnableVertexAttribArray(index);
+    Program program = {};
+    bool fromCache = false;
+    program.handle = CreateProgram(app, programSource, programName, isCompute, &fromCache);
+    program.filepath = filepath;
+    program.programName = programName;
+    program.isCompute = isCompute;
+    program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
 
-                    attributeWasLinked = true;
-                    break;
-                }
-            }
-            assert(attributeWasLinked);
-        }
-        glBindVertexArray(0);
+    ReflectProgram(program);
+
+    f64 loadMs = (glfwGetTime() - startTime) * 1000.0;
+    app->programLoadMs += loadMs;
+    ILOG("Program %s %s in %.2f ms", programName, fromCache ? "loaded from binary cache" : "compiled", loadMs);
+
+    app->programs.push_back(program);
+
+    return app->programs.size() - 1;
+}
+
+u32 LoadProgram(App* app, const char* filepath, const char* programName)
+{
+    return LoadProgram(app, filepath, programName, false);
+}
 
-        VAO vao = { ReturnValue, program.handle };
-        Submesh.vaos.push_back(vao);
+u32 LoadComputeProgram(App* app, const char* filepath, const char* programName)
+{
+    return LoadProgram(app, filepath, programName, true);
+}
+
+bool ReloadProgram(App* app, Program& program)
+{
+    String programSource = ReadTextFile(program.filepath.c_str());
+    if (!programSource.str) return false;
+
+    GLuint newHandle = CreateProgram(app, programSource, program.programName.c_str(), program.isCompute, NULL);
+    if (newHandle == 0)
+    {
+        // Keep using the last program that linked
+        ELOG("Hot reload of %s (%s) failed, keeping the previous version", program.programName.c_str(), program.filepath.c_str());
+        return false;
     }
 
-    return ReturnValue;
+    GLuint oldHandle = program.handle;
+    program.handle = newHandle;
+    ReflectProgram(program);
+
+    GeometryArenaManager::InvalidateProgramVAOs(app->geometryArena, oldHandle);
+    glDeleteProgram(oldHandle);
+
+    ILOG("Hot reloaded %s (%s)", program.programName.c_str(), program.filepath.c_str());
+    return true;
+}
+
+void HotReloadPrograms(App* app)
+{
+    for (Program& program : app->programs)
+    {
+        u64 timestamp = GetFileLastWriteTimestamp(program.filepath.c_str());
+        if (timestamp == 0 || timestamp == program.lastWriteTimestamp) continue;
+
+        // Store the timestamp even if the reload fails so a broken file isn't recompiled every poll
+        program.lastWriteTimestamp = timestamp;
+        ReloadProgram(app, program);
+    }
 }
 
 glm::mat4 TransformScale(const vec3& scaleFactors)
@@ -298,6 +471,29 @@ void Init(App* app)
 
    
 
+    JobManager::Init(app->jobs);
+    GeometryArenaManager::Init(app->geometryArena, MAX_DRAW_INSTANCES);
+
+    // Placeholders, shown until the textures loaded in the background arrive
+    app->whiteTexIdx = ModelLoader::LoadTexture2D(app, "color_white.png");
+    app->blackTexIdx = ModelLoader::LoadTexture2D(app, "color_black.png");
+    app->normalTexIdx = ModelLoader::LoadTexture2D(app, "color_normal.png");
+    app->magentaTexIdx = ModelLoader::LoadTexture2D(app, "color_magenta.png");
+
+    GLint extensionCount = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+    for (GLint i = 0; i < extensionCount; ++i)
+    {
+        const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+        if (strcmp(extension, "GL_EXT_texture_filter_anisotropic") == 0 || strcmp(extension, "GL_ARB_texture_filter_anisotropic") == 0)
+        {
+            glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY, &app->maxAnisotropy);
+            break;
+        }
+    }
+    app->ConfigureMaterialSampler();
+    MaterialTables::Init(app->materialTable);
+
     //load CubeMapTexture
     app->cubemapTexture = app->loadCubemapTextures(app->faces);
     
@@ -306,6 +502,8 @@ void Init(App* app)
     //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
     app->LoadWaterVAO();
 
+    ProgramCache::Init();
+
     app->renderToBackBufferShader = LoadProgram(app, "RENDER_TO_BB.glsl", "RENDER_TO_BB");
     app->renderToFrameBufferShader = LoadProgram(app, "RENDER_TO_FB.glsl", "RENDER_TO_FB");
     app->framebufferToQuadShader = LoadProgram(app, "FB_TO_BB.glsl", "FB_TO_BB");
@@ -318,19 +516,28 @@ void Init(App* app)
 
     app->waterShader = LoadProgram(app, "WATER_SHADER.glsl", "WATER_SHADER");
 
-    const Program& texturedMeshProgram = app->programs[app->renderToFrameBufferShader];
-    app->texturedMeshProgram_uTexture = glGetUniformLocation(texturedMeshProgram.handle, "uTexture");
+    app->gpuCullingShader = LoadComputeProgram(app, "GPU_CULLING.glsl", "GPU_CULLING");
+    GpuCulling::Init(app->gpuCulling, app->gpuCullingShader);
+
+    app->hiZShader = LoadComputeProgram(app, "HIZ.glsl", "HIZ");
+    HiZManager::Init(app->hiZ, app->hiZShader);
+
+    app->clusteredLightsShader = LoadComputeProgram(app, "CLUSTERED_LIGHTS.glsl", "CLUSTERED_LIGHTS");
+    ClusteredLighting::Init(app->lightClusters, app->clusteredLightsShader);
+
+    app->lightVolumeShader = LoadProgram(app, "LIGHT_VOLUME.glsl", "LIGHT_VOLUME");
 
-    u32 PatrickModelIndex = ModelLoader::LoadModel(app, "Patrick/Patrick.obj");
-    u32 GroundModelIndex = ModelLoader::LoadModel(app, "Patrick/Ground.obj");
-    u32 ShrekModelIndex = ModelLoader::LoadModel(app, "Patrick/Shrek.obj");
-    u32 LuffyModelIndex = ModelLoader::LoadModel(app, "Patrick/Luffy.obj");
-    u32 SceneBeach = ModelLoader::LoadModel(app, "Patrick/intentodosbosque.obj");
+    // Models are parsed on the job system workers and uploaded from Update()
+    u32 PatrickModelIndex = ModelLoader::LoadModelAsync(app, "Patrick/Patrick.obj");
+    u32 GroundModelIndex = ModelLoader::LoadModelAsync(app, "Patrick/Ground.obj");
+    u32 ShrekModelIndex = ModelLoader::LoadModelAsync(app, "Patrick/Shrek.obj");
+    u32 LuffyModelIndex = ModelLoader::LoadModelAsync(app, "Patrick/Luffy.obj");
+    u32 SceneBeach = ModelLoader::LoadModelAsync(app, "Patrick/intentodosbosque.obj");
 
-    app->CubeModelIndex = ModelLoader::LoadModel(app, "Patrick/cube.obj");
-    app->SphereModelIndex = ModelLoader::LoadModel(app, "Patrick/sphere.obj");
+    app->CubeModelIndex = ModelLoader::LoadModelAsync(app, "Patrick/cube.obj");
+    app->SphereModelIndex = ModelLoader::LoadModelAsync(app, "Patrick/sphere.obj");
 
-    app->dudvMap = ModelLoader::LoadTexture2D(app, "dudvMap.png");
+    app->dudvMap = ModelLoader::LoadTexture2DAsync(app, "dudvMap.png", app->whiteTexIdx);
 
     glDisable(GL_BLEND);
     glEnable(GL_DEPTH_TEST);
@@ -339,18 +546,23 @@ void Init(App* app)
 
     glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &app->maxUniformBufferSize);
     glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &app->uniformBlockAlignment);
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &app->storageBlockAlignment);
 
-    app->localUniformBuffer = CreateConstantBuffer(app->maxUniformBufferSize);
+    // Each frame writes the global params, lights and instance matrices once, plus a view block, a visible list, its draws
+    // and their indirect commands per pass
+    app->localUniformBuffer = CreateUniformRingBuffer(app->maxUniformBufferSize * 4 + MAX_INSTANCES * sizeof(glm::mat4) + MAX_DRAW_INSTANCES * 3 * 2 * sizeof(u32) +
+        MAX_DRAWS * 3 * (sizeof(GpuDrawParams) + sizeof(DrawElementsIndirectCommand)) + MAX_LIGHTS * sizeof(GpuLight));
 
-    app->entities.push_back({ TransformPositionScale(vec3(0.0, 0.0, 1.0), vec3(0.1, 0.1, 0.1)),PatrickModelIndex,0,0 });
-    app->entities.push_back({ TransformPositionScale(vec3(0.0, 0.0, 3.0), vec3(0.1, 0.1, 0.1)),PatrickModelIndex,0,0 });
-    app->entities.push_back({ TransformPositionScale(vec3(0.5, 0.4, -0.2), vec3(0.1, 0.1, 0.1)),PatrickModelIndex,0,0 });
+    app->entities.push_back({ TransformPositionScale(vec3(0.0, 0.0, 1.0), vec3(0.1, 0.1, 0.1)),PatrickModelIndex });
+    app->entities.push_back({ TransformPositionScale(vec3(0.0, 0.0, 3.0), vec3(0.1, 0.1, 0.1)),PatrickModelIndex });
+    app->entities.push_back({ TransformPositionScale(vec3(0.5, 0.4, -0.2), vec3(0.1, 0.1, 0.1)),PatrickModelIndex });
 
 
-    app->entities.push_back({ TransformPositionScale(vec3(-5.0, -1.8, -2.0), vec3(1.0, 1.0, 1.0)), ShrekModelIndex, 0, 0 });
-    app->entities.push_back({ TransformPositionScale(vec3(-1.0, -3.0, 3.0), vec3(0.01, 0.01, 0.01)), LuffyModelIndex, 0, 0 });
+    app->entities.push_back({ TransformPositionScale(vec3(-5.0, -1.8, -2.0), vec3(1.0, 1.0, 1.0)), ShrekModelIndex });
+    app->entities.push_back({ TransformPositionScale(vec3(-1.0, -3.0, 3.0), vec3(0.01, 0.01, 0.01)), LuffyModelIndex });
 
-    app->entities.push_back({ TransformPositionScale(vec3(0.0, 0.0, 0.0), vec3(2.0, 2.0, 2.0)), SceneBeach, 0, 0 });
+    app->entities.push_back({ TransformPositionScale(vec3(0.0, 0.0, 0.0), vec3(2.0, 2.0, 2.0)), SceneBeach });
+    app->sceneGeneration++;
 
     app->WaterWorldMatrix = TransformPositionScale(vec3(0.0, -0.5, 0.0), vec3(20.0, 20.0, 20.0));
     app->WaterWorldMatrix = glm::rotate(app->WaterWorldMatrix, glm::radians(180.0f), glm::vec3(1.0f, 0.0f, 0.0f));
@@ -363,29 +575,49 @@ void Init(App* app)
     app->CreatePointLight(vec3(0.0, 0.0, 1.0), vec3(1.0, 1.0, 1.0), vec3(4.0, -3.0, 6.0));
 
     //
-    app->ConfigureWaterBuffer(app->waterBuffers.fboReflection, app->waterBuffers.rtReflection, app->waterBuffers.rtReflectionDepth);
-    app->ConfigureWaterBuffer(app->waterBuffers.fboRefraction, app->waterBuffers.rtRefraction, app->waterBuffers.rtRefractionDepth);
+    app->ConfigureWaterBuffers();
     app->ConfigureFrameBuffer(app->deferredFrameBuffer);
+    LightVolumes::Init(*app, app->lightVolumes, app->lightVolumeShader);
     //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
     //hdr createCube
     //app->EquirrectangularToCubeMap();
     //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
     app->mode = Mode_Deferred;
-    
+
+    ProfilerManager::Init(app->profiler);
 }
 
 void App::CreateDirectLight(vec3 color, vec3 direction, vec3 position) 
 {
     lights.push_back({ LightType::LightType_Directional, color, direction, position });
 
-    entities.push_back({ TransformPositionScale(position, vec3(0.5)),CubeModelIndex,0,0 });
+    entities.push_back({ TransformPositionScale(position, vec3(0.5)),CubeModelIndex });
+    sceneGeneration++;
 }
 
 void App::CreatePointLight(vec3 color, vec3 direction, vec3 position) 
 {
     lights.push_back({ LightType::LightType_Point, color, direction, position });
 
-    entities.push_back({ TransformPositionScale(position, vec3(0.5)),SphereModelIndex,0,0 });
+    entities.push_back({ TransformPositionScale(position, vec3(0.5)),SphereModelIndex });
+    sceneGeneration++;
+}
+
+void App::CreateRandomPointLights(u32 count)
+{
+    // Seeded with the light count, so every run (and benchmark) gets the same lights
+    std::mt19937 random((u32)lights.size());
+    std::uniform_real_distribution<f32> horizontal(-20.0f, 20.0f);
+    std::uniform_real_distribution<f32> vertical(-3.0f, 1.0f);
+    std::uniform_real_distribution<f32> channel(0.2f, 1.0f);
+
+    for (u32 i = 0; i < count && lights.size() < MAX_LIGHTS; ++i)
+    {
+        Light light = { LightType::LightType_Point, vec3(channel(random), channel(random), channel(random)), vec3(1.0), vec3(horizontal(random), vertical(random), horizontal(random)) };
+        light.linear = 0.7f;
+        light.quadratic = 1.8f;
+        lights.push_back(light);
+    }
 }
 
 void Gui(App* app)
@@ -394,7 +626,150 @@ void Gui(App* app)
     ImGui::Text("FPS: %f", 1.0f / app->deltaTime);
     ImGui::Text("%s", app->openglDebugInfo.c_str());
 
-    const char* RenderModes[] = { "FORWARD", "DEFERRED" };
+    if (ImGui::CollapsingHeader("Profiler", ImGuiTreeNodeFlags_DefaultOpen))
+    {
+        PassStats frameStats;
+        ProfilerManager::GetFrameStats(app->profiler, frameStats);
+        ImGui::Text("CPU frame: avg %.2f ms  min %.2f ms  p99 %.2f ms (%u frames, %u dropped)",
+            frameStats.avgMs, frameStats.minMs, frameStats.p99Ms, frameStats.sampleCount, app->profiler.droppedFrames);
+        ImGui::Text("Draw calls: %u, redundant binds skipped: %u",
+            app->profiler.lastFrame.drawCalls, app->profiler.lastFrame.bindsSkipped);
+        ImGui::Text("Uniform ring buffer: %s, %u stalls, %u overflows",
+            app->localUniformBuffer.persistent ? "persistent" : "unsynchronized maps", app->localUniformBuffer.stalls, app->localUniformBuffer.overflows);
+
+        if (ImGui::BeginTable("PassTimings", 7, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+        {
+            ImGui::TableSetupColumn("Pass");
+            ImGui::TableSetupColumn("CPU avg");
+            ImGui::TableSetupColumn("GPU min");
+            ImGui::TableSetupColumn("GPU avg");
+            ImGui::TableSetupColumn("GPU p99");
+            ImGui::TableSetupColumn("Visible/culled");
+            ImGui::TableSetupColumn("Occluded");
+            ImGui::TableHeadersRow();
+
+            for (u32 i = 0; i < ProfilerPass_Count; ++i)
+            {
+                PassStats cpuStats, gpuStats;
+                ProfilerManager::GetPassStats(app->profiler, (ProfilerPass)i, cpuStats, gpuStats);
+                if (cpuStats.sampleCount == 0) continue;
+
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn(); ImGui::Text("%s", ProfilerManager::GetPassName((ProfilerPass)i));
+                ImGui::TableNextColumn(); ImGui::Text("%.3f", cpuStats.avgMs);
+                ImGui::TableNextColumn(); ImGui::Text("%.3f", gpuStats.minMs);
+                ImGui::TableNextColumn(); ImGui::Text("%.3f", gpuStats.avgMs);
+                ImGui::TableNextColumn(); ImGui::Text("%.3f", gpuStats.p99Ms);
+
+                const PassTiming& lastPass = app->profiler.lastFrame.passes[i];
+                ImGui::TableNextColumn();
+                if (lastPass.visibleInstances + lastPass.culledInstances > 0)
+                    ImGui::Text("%u/%u", lastPass.visibleInstances, lastPass.culledInstances);
+                ImGui::TableNextColumn();
+                if (lastPass.occludedInstances > 0)
+                    ImGui::Text("%u", lastPass.occludedInstances);
+            }
+            ImGui::EndTable();
+        }
+    }
+
+    ImGui::Checkbox("Multi-draw indirect", &app->useMultiDrawIndirect);
+    ImGui::Checkbox("Frustum culling", &app->useFrustumCulling);
+    if (app->useFrustumCulling)
+        ImGui::Checkbox("GPU culling (compute)", &app->useGpuCulling);
+    ImGui::Checkbox("Hi-Z occlusion culling (deferred)", &app->useOcclusionCulling);
+
+    ImGui::Text("Lights: %u (max %u per cluster, %u clusters over it)", (u32)app->lights.size(), CLUSTER_MAX_LIGHTS,
+        app->lightClusters.overflowClusters);
+    if (ImGui::Button("Add 1000 point lights"))
+        app->CreateRandomPointLights(1000);
+
+    ImGui::Text("Texture memory: %.2f MB (%s)", app->GetTextureMemoryBytes() / (1024.0 * 1024.0),
+        app->useTextureCache ? "block compressed" : "uncompressed");
+    ImGui::Text("Material arrays: %u of %u, %.2f MB of it", MaterialTables::GetArrayCount(app->materialTable),
+        app->materialTable.maxArrays, app->materialTable.memoryBytes / (1024.0 * 1024.0));
+    ImGui::Text("Vertex memory: %.2f MB (quantized, plus the position stream)", GeometryArenaManager::GetVertexBytes(app->geometryArena) / (1024.0 * 1024.0));
+
+    // Compare the G-buffer/Forward pass GPU times above to see the texture bandwidth difference
+    const char* TextureFilterings[] = { "Bilinear", "Trilinear", "Anisotropic" };
+    int filtering = app->textureFiltering;
+    bool samplerChanged = ImGui::Combo("Texture filtering", &filtering, TextureFilterings, ARRAY_COUNT(TextureFilterings));
+    app->textureFiltering = (TextureFiltering)filtering;
+    if (app->textureFiltering == TextureFiltering_Anisotropic)
+    {
+        if (app->maxAnisotropy > 1.0f)
+            samplerChanged |= ImGui::SliderInt("Anisotropy", &app->anisotropy, 1, (int)app->maxAnisotropy);
+        else
+            ImGui::Text("Anisotropic filtering not supported");
+    }
+    if (samplerChanged)
+        app->ConfigureMaterialSampler();
+
+    if (ImGui::CollapsingHeader("Texture streaming"))
+    {
+        TextureStreamer& streamer = app->textureStreaming;
+        ImGui::Checkbox("Enabled", &streamer.enabled);
+        int budgetMB = (int)(streamer.budgetBytes / (1024 * 1024));
+        if (ImGui::SliderInt("Budget (MB)", &budgetMB, 16, 2048))
+            streamer.budgetBytes = (u64)budgetMB * 1024 * 1024;
+        ImGui::SliderInt("Evict after (frames)", &streamer.evictFrames, 1, 600);
+        ImGui::SliderFloat("Mip bias", &streamer.mipBias, -2.0f, 4.0f);
+        ImGui::Text("Resident %.2f MB, requested %.2f MB, loading %.2f MB", streamer.residentBytes / (1024.0 * 1024.0),
+            streamer.requestedBytes / (1024.0 * 1024.0), streamer.loadingBytes / (1024.0 * 1024.0));
+        ImGui::Text("Charged to the budget: %.2f MB", streamer.gpuBytes / (1024.0 * 1024.0));
+
+        if (ImGui::BeginTable("Streamed textures", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollY, ImVec2(0.0f, 200.0f)))
+        {
+            ImGui::TableSetupColumn("Texture");
+            ImGui::TableSetupColumn("Size");
+            ImGui::TableSetupColumn("Mip (resident/requested)");
+            ImGui::TableSetupColumn("KB (resident/requested)");
+            ImGui::TableHeadersRow();
+            for (const StreamedTexture& streamed : streamer.textures)
+            {
+                const CompressedImage& image = streamed.source.image;
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::TextUnformatted(app->textures[streamed.textureIdx].filepath.c_str());
+                ImGui::TableNextColumn();
+                ImGui::Text("%dx%d", image.size.x, image.size.y);
+                ImGui::TableNextColumn();
+                ImGui::Text("%u / %u%s", streamed.residentMip, streamed.requestedMip, streamed.loading ? " (loading)" : "");
+                ImGui::TableNextColumn();
+                ImGui::Text("%llu / %llu", TextureStreaming::GetBytesFromMip(image, streamed.residentMip) / 1024,
+                    TextureStreaming::GetBytesFromMip(image, streamed.requestedMip) / 1024);
+            }
+            ImGui::EndTable();
+        }
+    }
+
+    if (ImGui::CollapsingHeader("Water"))
+    {
+        // The pass timings above show the savings: skipped refreshes leave Reflection/Refraction out of the frame
+        const char* WaterResolutions[] = { "Full", "Half", "Quarter" };
+        int resolution = app->waterResolutionDivisor == 4 ? 2 : (app->waterResolutionDivisor == 2 ? 1 : 0);
+        if (ImGui::Combo("Target resolution", &resolution, WaterResolutions, ARRAY_COUNT(WaterResolutions)))
+        {
+            app->waterResolutionDivisor = 1u << resolution;
+            app->ConfigureWaterBuffers();
+        }
+        ImGui::Text("Targets: %dx%d, %u frames since refresh", app->waterBuffers.size.x, app->waterBuffers.size.y, app->waterBuffers.framesSinceUpdate);
+
+        ImGui::SliderInt("Refresh every N frames", &app->waterUpdateInterval, 1, 16);
+        ImGui::Checkbox("Refresh only when moving", &app->waterUpdateOnMove);
+        if (app->waterUpdateOnMove)
+        {
+            ImGui::SliderFloat("Move threshold", &app->waterMoveThreshold, 0.0f, 2.0f);
+            ImGui::SliderFloat("Turn threshold (deg)", &app->waterTurnThreshold, 0.0f, 15.0f);
+        }
+        ImGui::SliderFloat("Cull distance", &app->waterCullDistance, 1.0f, CAMERA_Z_FAR, "%.1f", ImGuiSliderFlags_Logarithmic);
+
+        ImGui::Checkbox("Clip to water on screen", &app->waterClipToScreen);
+        const vec4& rect = app->waterBuffers.screenRect;
+        ImGui::Text("Rendered area: %.0f%% of the targets", (rect.z - rect.x) * (rect.w - rect.y) * 25.0f);
+    }
+
+    const char* RenderModes[] = { "FORWARD", "DEFERRED", "DEFERRED (LIGHT VOLUMES)" };
     if (ImGui::BeginCombo("Render Mode", RenderModes[app->mode]))
     {
         for (size_t i = 0; i < ARRAY_COUNT(RenderModes); i++)
@@ -430,12 +805,34 @@ void Gui(App* app)
         }
     }
 
-    if (app->mode == Mode::Mode_Deferred)
+    if (app->mode == Mode::Mode_DeferredLightVolumes)
+    {
+        ImGui::Text("Point light volumes: %u drawn, %u culled", app->lightVolumes.pointLightsDrawn, app->lightVolumes.pointLightsCulled);
+    }
+
+    if (app->mode == Mode::Mode_Deferred || app->mode == Mode::Mode_DeferredLightVolumes)
     {
+        if (ImGui::Checkbox("Compact G-buffer", &app->useCompactGBuffer))
+        {
+            app->ConfigureFrameBuffer(app->deferredFrameBuffer);
+        }
+        ImGui::Text("G-buffer: %u bytes per pixel", app->GetGBufferBytesPerPixel(app->useCompactGBuffer));
+
         for (size_t i = 0; i < app->deferredFrameBuffer.colorAttachment.size(); i++)
         {
             ImGui::Image((ImTextureID)app->deferredFrameBuffer.colorAttachment[i], ImVec2(250, 150), ImVec2(0, 1), ImVec2(1, 0));
         }
+
+        if (app->useOcclusionCulling)
+        {
+            ImGui::Checkbox("Show Hi-Z pyramid", &app->hiZ.showDebug);
+            if (app->hiZ.showDebug && app->hiZ.levelCount > 0)
+            {
+                ImGui::SliderInt("Hi-Z level", &app->hiZ.debugLevel, 0, app->hiZ.levelCount - 1);
+                if (app->hiZ.debugTexture != 0)
+                    ImGui::Image((ImTextureID)(intptr_t)app->hiZ.debugTexture, ImVec2(250, 150), ImVec2(0, 1), ImVec2(1, 0));
+            }
+        }
         ImGui::Text("Water Reflection FrameBuffer");
         
         if (app->waterBuffers.GetReflectionTexture() != 0)
@@ -463,169 +860,217 @@ void Gui(App* app)
 void Update(App* app)
 {
     // You can handle app->input keyboard/mouse here
+
+    JobManager::DrainUploads(app->jobs, app, UPLOAD_BUDGET_MS);
+
+    app->shaderWatchTimer += app->deltaTime;
+    if (app->shaderWatchTimer >= SHADER_WATCH_INTERVAL)
+    {
+        app->shaderWatchTimer = 0.0f;
+        HotReloadPrograms(app);
+    }
 }
 
 
 
 void Render(App* app)
 {
+    BufferManager::BeginRingFrame(app->localUniformBuffer);
+    app->UpdateSceneBuffer();
+    TextureStreaming::Update(*app, app->textureStreaming);
+    MaterialTables::Update(*app, app->materialTable);
+    ClusteredLighting::Build(*app, app->lightClusters, app->projection, app->localUniformBuffer.regionIndex);
+
     switch (app->mode)
     {
     case Mode_Forward:
     {
 
-        //app->UpdateEntityBuffer(true);
+        const Program& ForwardProgram = app->programs[app->renderToBackBufferShader];
 
-        /////////////////////////////////////////////////////////////////////////////////////////// Water Reflection FBO
+        // The water targets may keep the previous frames, have their own resolution and only cover the water on screen
+        if (app->NeedsWaterUpdate() && app->UpdateWaterScreenRect())
+        {
+            glViewport(0, 0, app->waterBuffers.size.x, app->waterBuffers.size.y);
 
-        glEnable(GL_CLIP_DISTANCE0);
+            /////////////////////////////////////////////////////////////////////////////////////////// Water Reflection FBO
 
-        glBindFramebuffer(GL_FRAMEBUFFER, app->waterBuffers.fboReflection.fbHandle);
-        GLuint reflectionBuffers[] = { app->waterBuffers.fboReflection.fbHandle };
-        glDrawBuffers(app->waterBuffers.fboReflection.colorAttachment.size(), reflectionBuffers);
+            ProfilerManager::BeginPass(app->profiler, ProfilerPass_Reflection);
+            glEnable(GL_CLIP_DISTANCE0);
 
-        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glBindFramebuffer(GL_FRAMEBUFFER, app->waterBuffers.fboReflection.fbHandle);
+            GLuint reflectionBuffers[] = { app->waterBuffers.fboReflection.fbHandle };
+            glDrawBuffers(app->waterBuffers.fboReflection.colorAttachment.size(), reflectionBuffers);
+            app->BeginWaterScissor(true);
 
-        // Mover cmara para reflexin
-        float distance = 2 * (app->sceneCam.cameraPos.y - app->GetHeight(app->WaterWorldMatrix));
-        app->sceneCam.cameraPos.y -= distance;
-        app->sceneCam.pitch = -app->sceneCam.pitch;
+            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        const Program& ForwardProgram = app->programs[app->renderToBackBufferShader];
-        glUseProgram(ForwardProgram.handle);
-        app->UpdateEntityBuffer(false);
-        app->RenderGeometry(ForwardProgram, vec4(0, 1, 0, -app->GetHeight(app->WaterWorldMatrix)));
+            // Mover cmara para reflexin
+            float distance = 2 * (app->sceneCam.cameraPos.y - app->GetHeight(app->WaterWorldMatrix));
+            app->sceneCam.cameraPos.y -= distance;
+            app->sceneCam.pitch = -app->sceneCam.pitch;
 
-        // Regresar cmara a posicin original
-        app->sceneCam.cameraPos.y += distance;
-        app->sceneCam.pitch = -app->sceneCam.pitch;
-        app->sceneCam.Update();
+            glUseProgram(ForwardProgram.handle);
+            app->PushViewParams(vec4(0, 1, 0, -app->GetHeight(app->WaterWorldMatrix)));
+            app->RenderGeometry(ForwardProgram, ProfilerPass_Reflection);
 
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glDisable(GL_CLIP_DISTANCE0); // Desactivar despus de usar
+            // Regresar cmara a posicin original
+            app->sceneCam.cameraPos.y += distance;
+            app->sceneCam.pitch = -app->sceneCam.pitch;
+            app->sceneCam.Update();
 
-        /////////////////////////////////////////////////////////////////////////////////////////// Water Refraction FBO
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            ProfilerManager::EndPass(app->profiler, ProfilerPass_Reflection);
+            glDisable(GL_CLIP_DISTANCE0); // Desactivar despus de usar
+            glDisable(GL_SCISSOR_TEST);
 
-        glEnable(GL_CLIP_DISTANCE0);
+            /////////////////////////////////////////////////////////////////////////////////////////// Water Refraction FBO
 
-        glBindFramebuffer(GL_FRAMEBUFFER, app->waterBuffers.fboRefraction.fbHandle);
-        GLuint refractionBuffers[] = { app->waterBuffers.fboRefraction.fbHandle };
-        glDrawBuffers(app->waterBuffers.fboRefraction.colorAttachment.size(), refractionBuffers);
+            ProfilerManager::BeginPass(app->profiler, ProfilerPass_Refraction);
+            glEnable(GL_CLIP_DISTANCE0);
 
-        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glBindFramebuffer(GL_FRAMEBUFFER, app->waterBuffers.fboRefraction.fbHandle);
+            GLuint refractionBuffers[] = { app->waterBuffers.fboRefraction.fbHandle };
+            glDrawBuffers(app->waterBuffers.fboRefraction.colorAttachment.size(), refractionBuffers);
+            app->BeginWaterScissor(false);
 
-        app->UpdateEntityBuffer(false);
-        app->RenderGeometry(ForwardProgram, vec4(0, -1, 0, app->GetHeight(app->WaterWorldMatrix)));
+            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glDisable(GL_CLIP_DISTANCE0); // Desactivar despus de usar
+            app->PushViewParams(vec4(0, -1, 0, app->GetHeight(app->WaterWorldMatrix)));
+            app->RenderGeometry(ForwardProgram, ProfilerPass_Refraction);
+
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            ProfilerManager::EndPass(app->profiler, ProfilerPass_Refraction);
+            glDisable(GL_CLIP_DISTANCE0); // Desactivar despus de usar
+            glDisable(GL_SCISSOR_TEST);
+        }
 
         /////////////////////////////////////////////////////////////////////////////////////////// Forward
 
+        ProfilerManager::BeginPass(app->profiler, ProfilerPass_Forward);
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
         glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         glViewport(0, 0, app->displaySize.x, app->displaySize.y);
-        app->UpdateEntityBuffer(true);
-        app->RenderGeometry(ForwardProgram, vec4(0, -1, 0, 15));
+        app->PushViewParams(vec4(0, -1, 0, 15));
+        app->RenderGeometry(ForwardProgram, ProfilerPass_Forward);
         glUseProgram(0);
+        ProfilerManager::EndPass(app->profiler, ProfilerPass_Forward);
 
+        ProfilerManager::BeginPass(app->profiler, ProfilerPass_Water);
         const Program& FwClipp = app->programs[app->waterShader];
         glUseProgram(FwClipp.handle);
-        app->UpdateEntityBuffer(false);
         app->RenderWater(FwClipp);
+        ProfilerManager::EndPass(app->profiler, ProfilerPass_Water);
 
         glUseProgram(FwClipp.handle);
     }
     break;
     case Mode_Deferred:
+    case Mode_DeferredLightVolumes:
     {
         // Limpieza inicial de buffers
         glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         glViewport(0, 0, app->displaySize.x, app->displaySize.y);
 
-        /////////////////////////////////////////////////////////////////////////////////////////// Water Reflection FBO
+        const Program& DeferredProgram = app->programs[app->renderToFrameBufferShader];
+        const Program& SFStoVS = app->programs[app->skyboxFragmentShaderToVertexShader];
+        GLint projectionLoc = SFStoVS.uniformLocations[Uniform_Projection];
+        GLint viewLoc = SFStoVS.uniformLocations[Uniform_View];
 
-        glEnable(GL_CLIP_DISTANCE0);
+        // The water targets may keep the previous frames, have their own resolution and only cover the water on screen
+        if (app->NeedsWaterUpdate() && app->UpdateWaterScreenRect())
+        {
+            glViewport(0, 0, app->waterBuffers.size.x, app->waterBuffers.size.y);
 
-        glBindFramebuffer(GL_FRAMEBUFFER, app->waterBuffers.fboReflection.fbHandle);
-        GLuint reflectionBuffers[] = { app->waterBuffers.fboReflection.fbHandle };
-        glDrawBuffers(app->waterBuffers.fboReflection.colorAttachment.size(), reflectionBuffers);
+            /////////////////////////////////////////////////////////////////////////////////////////// Water Reflection FBO
 
-        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            ProfilerManager::BeginPass(app->profiler, ProfilerPass_Reflection);
+            glEnable(GL_CLIP_DISTANCE0);
 
-        // Mover cmara para reflexin
-        float distance = 2 * (app->sceneCam.cameraPos.y - app->GetHeight(app->WaterWorldMatrix));
-        app->sceneCam.cameraPos.y -= distance;
-        app->sceneCam.pitch = -app->sceneCam.pitch;
-        //app->sceneCam.Update();
+            glBindFramebuffer(GL_FRAMEBUFFER, app->waterBuffers.fboReflection.fbHandle);
+            GLuint reflectionBuffers[] = { app->waterBuffers.fboReflection.fbHandle };
+            glDrawBuffers(app->waterBuffers.fboReflection.colorAttachment.size(), reflectionBuffers);
+            app->BeginWaterScissor(true);
 
-        const Program& DeferredProgram = app->programs[app->renderToFrameBufferShader];
-        glUseProgram(DeferredProgram.handle);
-        app->UpdateEntityBuffer(true);
-        app->RenderGeometry(DeferredProgram, vec4(0, 1, 0, -app->GetHeight(app->WaterWorldMatrix)));
+            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+            // Mover cmara para reflexin
+            float distance = 2 * (app->sceneCam.cameraPos.y - app->GetHeight(app->WaterWorldMatrix));
+            app->sceneCam.cameraPos.y -= distance;
+            app->sceneCam.pitch = -app->sceneCam.pitch;
+            //app->sceneCam.Update();
 
-        //skybox
-        const Program& SFStoVS = app->programs[app->skyboxFragmentShaderToVertexShader];
-        glUseProgram(SFStoVS.handle);
+            glUseProgram(DeferredProgram.handle);
+            app->PushViewParams(vec4(0, 1, 0, -app->GetHeight(app->WaterWorldMatrix)));
+            app->RenderGeometry(DeferredProgram, ProfilerPass_Reflection);
 
-        GLint projectionLoc = glGetUniformLocation(SFStoVS.handle, "projection");
-        GLint viewLoc = glGetUniformLocation(SFStoVS.handle, "view");
 
+            //skybox
+            glUseProgram(SFStoVS.handle);
 
-        glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(app->projection));
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(app->view));
-        glBindVertexArray(app->vaoSkybox);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, app->cubemapTexture);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-        glDepthMask(GL_TRUE);
+            glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(app->projection));
+            glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(app->view));
+            glBindVertexArray(app->vaoSkybox);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, app->cubemapTexture);
+            glDrawArrays(GL_TRIANGLES, 0, 36);
+            glDepthMask(GL_TRUE);
 
-        // Regresar cmara a posicin original
-        app->sceneCam.cameraPos.y += distance;
-        app->sceneCam.pitch = -app->sceneCam.pitch;
+            // Regresar cmara a posicin original
+            app->sceneCam.cameraPos.y += distance;
+            app->sceneCam.pitch = -app->sceneCam.pitch;
 
-        glUseProgram(0);
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glDisable(GL_CLIP_DISTANCE0); // Desactivar despus de usar
+            glUseProgram(0);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            ProfilerManager::EndPass(app->profiler, ProfilerPass_Reflection);
+            glDisable(GL_CLIP_DISTANCE0); // Desactivar despus de usar
+            glDisable(GL_SCISSOR_TEST);
 
-        /////////////////////////////////////////////////////////////////////////////////////////// Water Refraction FBO
+            /////////////////////////////////////////////////////////////////////////////////////////// Water Refraction FBO
 
-        glEnable(GL_CLIP_DISTANCE0);
+            ProfilerManager::BeginPass(app->profiler, ProfilerPass_Refraction);
+            glEnable(GL_CLIP_DISTANCE0);
 
-        glBindFramebuffer(GL_FRAMEBUFFER, app->waterBuffers.fboRefraction.fbHandle);
-        GLuint refractionBuffers[] = { app->waterBuffers.fboRefraction.fbHandle };
-        glDrawBuffers(app->waterBuffers.fboRefraction.colorAttachment.size(), refractionBuffers);
+            glBindFramebuffer(GL_FRAMEBUFFER, app->waterBuffers.fboRefraction.fbHandle);
+            GLuint refractionBuffers[] = { app->waterBuffers.fboRefraction.fbHandle };
+            glDrawBuffers(app->waterBuffers.fboRefraction.colorAttachment.size(), refractionBuffers);
+            app->BeginWaterScissor(false);
 
-        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        glUseProgram(DeferredProgram.handle);
-        app->UpdateEntityBuffer(false);
-        app->RenderGeometry(DeferredProgram, vec4(0, -1, 0, app->GetHeight(app->WaterWorldMatrix)));
+            glUseProgram(DeferredProgram.handle);
+            app->PushViewParams(vec4(0, -1, 0, app->GetHeight(app->WaterWorldMatrix)));
+            app->RenderGeometry(DeferredProgram, ProfilerPass_Refraction);
 
-        //skybox
-        glUseProgram(SFStoVS.handle);
+            //skybox
+            glUseProgram(SFStoVS.handle);
 
 
-        glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(app->projection));
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(app->view));
-        glBindVertexArray(app->vaoSkybox);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, app->cubemapTexture);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-        glDepthMask(GL_TRUE);
+            glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(app->projection));
+            glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(app->view));
+            glBindVertexArray(app->vaoSkybox);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, app->cubemapTexture);
+            glDrawArrays(GL_TRIANGLES, 0, 36);
+            glDepthMask(GL_TRUE);
 
-        glUseProgram(0);
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glDisable(GL_CLIP_DISTANCE0); // Desactivar despus de usar
+            glUseProgram(0);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            ProfilerManager::EndPass(app->profiler, ProfilerPass_Refraction);
+            glDisable(GL_CLIP_DISTANCE0); // Desactivar despus de usar
+            glDisable(GL_SCISSOR_TEST);
+
+            glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+        }
 
         /////////////////////////////////////////////////////////////////////////////////////////// Deferred FBO
 
+        ProfilerManager::BeginPass(app->profiler, ProfilerPass_GBuffer);
         glBindFramebuffer(GL_FRAMEBUFFER, app->deferredFrameBuffer.fbHandle);
 
         GLuint drawBuffers[] = { app->deferredFrameBuffer.fbHandle };
@@ -635,10 +1080,21 @@ void Render(App* app)
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         glUseProgram(DeferredProgram.handle);
-        app->UpdateEntityBuffer(true);
-        app->RenderGeometry(DeferredProgram, vec4(0, -1, 0, 3));
+        glUniform1i(DeferredProgram.uniformLocations[Uniform_CompactGBuffer], app->useCompactGBuffer ? 1 : 0);
+        app->PushViewParams(vec4(0, -1, 0, 3));
+        app->RenderGeometry(DeferredProgram, ProfilerPass_GBuffer);
+        ProfilerManager::EndPass(app->profiler, ProfilerPass_GBuffer);
+
+        // The next frames test the G-buffer instances against this depth
+        if (app->useOcclusionCulling)
+        {
+            ProfilerManager::BeginPass(app->profiler, ProfilerPass_HiZ);
+            HiZManager::Build(*app, app->hiZ, app->deferredFrameBuffer.depthHandle, app->displaySize, app->projection * app->view);
+            ProfilerManager::EndPass(app->profiler, ProfilerPass_HiZ);
+        }
 
         //skybox
+        ProfilerManager::BeginPass(app->profiler, ProfilerPass_Skybox);
         glUseProgram(SFStoVS.handle);
 
         glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(app->projection));
@@ -647,14 +1103,16 @@ void Render(App* app)
         glBindTexture(GL_TEXTURE_CUBE_MAP, app->cubemapTexture);
         glDrawArrays(GL_TRIANGLES, 0, 36);
         glDepthMask(GL_TRUE);
+        ProfilerManager::EndPass(app->profiler, ProfilerPass_Skybox);
 
         glUseProgram(0);
+        ProfilerManager::BeginPass(app->profiler, ProfilerPass_Water);
         const Program& FwClipp = app->programs[app->waterShader];
         glUseProgram(FwClipp.handle);
-        app->UpdateEntityBuffer(false);
         app->RenderWater(FwClipp);
 
         glUseProgram(0);
+        ProfilerManager::EndPass(app->profiler, ProfilerPass_Water);
         /////////////////////////////////////////////////////////////////////////////////////////// 
         /////////////////////////////////////////////////////////////////////////////////////////// 
         //HDR
@@ -675,117 +1133,188 @@ void Render(App* app)
 
         ///////////////////////////////////////////////////////////////////////////////////////////
 
+        ProfilerManager::BeginPass(app->profiler, ProfilerPass_Lighting);
         glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         glViewport(0, 0, app->displaySize.x, app->displaySize.y);
 
-        const Program& FBToBB = app->programs[app->framebufferToQuadShader];
-        glUseProgram(FBToBB.handle);
-
-        glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->localUniformBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
-
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, app->deferredFrameBuffer.colorAttachment[0]);
-        glUniform1i(glGetUniformLocation(FBToBB.handle, "uAlbedo"), 0);
-
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, app->deferredFrameBuffer.colorAttachment[1]);
-        glUniform1i(glGetUniformLocation(FBToBB.handle, "uNormals"), 1);
+        if (app->mode == Mode_DeferredLightVolumes)
+        {
+            LightVolumes::Render(*app, app->lightVolumes);
+        }
+        else
+        {
+            const Program& FBToBB = app->programs[app->framebufferToQuadShader];
+            glUseProgram(FBToBB.handle);
 
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, app->deferredFrameBuffer.colorAttachment[2]);
-        glUniform1i(glGetUniformLocation(FBToBB.handle, "uPosition"), 2);
+            glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->localUniformBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+            ClusteredLighting::Bind(*app, app->lightClusters);
 
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, app->deferredFrameBuffer.colorAttachment[3]);
-        glUniform1i(glGetUniformLocation(FBToBB.handle, "uViewDir"), 3);
+            app->BindGBuffer(FBToBB);
 
-        glBindVertexArray(app->vao);
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+            glBindVertexArray(app->vao);
+            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
 
-        glBindVertexArray(0);
-        glUseProgram(0);
+            glBindVertexArray(0);
+            glUseProgram(0);
+        }
+        ProfilerManager::EndPass(app->profiler, ProfilerPass_Lighting);
     }
     break;
 
 
     default:;
     }
+
+    BufferManager::EndRingFrame(app->localUniformBuffer);
 }
 
-void App::UpdateEntityBuffer(bool mouse)
+void App::UpdateSceneBuffer()
 {
 
     float aspectRatio = (float)displaySize.x / (float)displaySize.y;
-    float znear = 0.1f;
-    float zfar = 1000.0f;
-    projection = glm::perspective(glm::radians(60.0f), aspectRatio, znear, zfar);
+    projection = glm::perspective(glm::radians(60.0f), aspectRatio, CAMERA_Z_NEAR, CAMERA_Z_FAR);
 
-    if(mouse) processInput(glfwGetCurrentContext());
+    processInput(glfwGetCurrentContext());
 
     sceneCam.Update();
 
-    view = glm::lookAt(sceneCam.cameraPos, sceneCam.cameraPos + sceneCam.cameraFront, sceneCam.cameraUp);
-
-    u32 cont = 0;
-
     BufferManager::MapBuffer(localUniformBuffer, GL_WRITE_ONLY);
 
-    //Push lights global params
+    //Push lights global params, the clusters are built from the main camera
+    ASSERT(lights.size() <= MAX_LIGHTS, "Too many lights for the light buffer");
+    glm::mat4 clusterView = glm::lookAt(sceneCam.cameraPos, sceneCam.cameraPos + sceneCam.cameraFront, sceneCam.cameraUp);
+
+    BufferManager::AlignHead(localUniformBuffer, uniformBlockAlignment);
     globalParamsOffset = localUniformBuffer.head;
     PushVec3(localUniformBuffer, sceneCam.cameraPos);
     PushUInt(localUniformBuffer, lights.size());
+    ClusteredLighting::PushClusterParams(localUniformBuffer, clusterView, projection);
+    globalParamsSize = localUniformBuffer.head - globalParamsOffset;
+
+    BufferManager::AlignHead(localUniformBuffer, storageBlockAlignment);
+    lightsOffset = localUniformBuffer.head;
+    ClusteredLighting::PushLights(localUniformBuffer, lights);
+    lightsSize = glm::max(localUniformBuffer.head - lightsOffset, (u32)sizeof(GpuLight));
 
-    for (size_t i = 0; i < lights.size(); ++i)
+
+    // Entities sharing a model become one batch. All the world matrices are stored contiguously in
+    // batch order. Each pass culls them and the shaders fetch the matrix through the visible list of the
+    // pass with baseInstance + gl_InstanceID (see INSTANCE_INDEX_LOCATION), then build WVP with its viewProjection
+
+    // With GPU culling the instances live in their own buffers, they are only rebuilt when the scene changes
+    bool gpuCullingActive = useFrustumCulling && useGpuCulling;
+    if (gpuCullingActive && !GpuCulling::NeedsUpload(*this, gpuCulling))
     {
-        BufferManager::AlignHead(localUniformBuffer, sizeof(vec4));
-
-        Light& light = lights[i];
-        PushUInt(localUniformBuffer, light.type);
-        PushVec3(localUniformBuffer, light.color);
-        //light.direction.y = sin(deltaTime + 100.0) * 1000.0;
-        PushVec3(localUniformBuffer, light.direction);
-        PushVec3(localUniformBuffer, light.position);
+        BufferManager::UnmapBuffer(localUniformBuffer);
+        return;
     }
-    globalParamsSize = localUniformBuffer.head - globalParamsOffset;
 
+    instanceOrder.resize(entities.size());
+    for (u32 i = 0; i < instanceOrder.size(); ++i)
+    {
+        instanceOrder[i] = i;
+    }
+    std::stable_sort(instanceOrder.begin(), instanceOrder.end(), [this](u32 a, u32 b)
+    {
+        return entities[a].modelIndex < entities[b].modelIndex;
+    });
 
-    for (auto it = entities.begin(); it != entities.end(); ++it)
+    // The ring region only has room for MAX_INSTANCES matrices
+    if (instanceOrder.size() > MAX_INSTANCES)
     {
+        if (!instanceLimitWarned)
+        {
+            ELOG("%u entities, only the first %u are drawn (MAX_INSTANCES)", (u32)instanceOrder.size(), MAX_INSTANCES);
+            instanceLimitWarned = true;
+        }
+        instanceOrder.resize(MAX_INSTANCES);
+    }
 
-        glm::mat4 world = it->worldMatrix;
-        glm::mat4 WVP = projection * view * world;
+    BufferManager::AlignHead(localUniformBuffer, storageBlockAlignment);
+    instanceParamsOffset = localUniformBuffer.head;
 
-        Buffer& localBuffer = localUniformBuffer;
-        BufferManager::AlignHead(localBuffer, uniformBlockAlignment);
-        it->localParamsOffset = localBuffer.head;
-        PushMat4(localBuffer, world);
-        PushMat4(localBuffer, WVP);
-        it->localParamsSize = localBuffer.head - it->localParamsOffset;
-        ++cont;
+    instanceBatches.clear();
+    Culling::ResizeBounds(cullingBounds, (u32)instanceOrder.size());
+    for (u32 i = 0; i < instanceOrder.size(); ++i)
+    {
+        Entity& entity = entities[instanceOrder[i]];
+        if (instanceBatches.empty() || instanceBatches.back().modelIndex != entity.modelIndex)
+        {
+            InstanceBatch batch = {};
+            batch.modelIndex = entity.modelIndex;
+            batch.firstInstance = i;
+            instanceBatches.push_back(batch);
+        }
+
+        PushMat4(localUniformBuffer, entity.worldMatrix);
+        instanceBatches.back().instanceCount++;
+
+        // Models still loading have no bounds yet, they keep the empty box of ResizeBounds and are skipped by the passes
+        const Mesh& mesh = meshes[models[entity.modelIndex].meshIdx];
+        if (!mesh.submeshes.empty() && (!entity.boundsValid || entity.boundsMatrix != entity.worldMatrix))
+        {
+            Culling::TransformAabb(entity.worldMatrix, mesh.aabbMin, mesh.aabbMax, entity.worldAabbMin, entity.worldAabbMax);
+            entity.boundsMatrix = entity.worldMatrix;
+            entity.boundsValid = true;
+        }
+
+        if (entity.boundsValid)
+            Culling::SetBounds(cullingBounds, i, entity.worldAabbMin, entity.worldAabbMax);
     }
+    instanceParamsSize = glm::max(localUniformBuffer.head - instanceParamsOffset, (u32)sizeof(glm::mat4));
 
     BufferManager::UnmapBuffer(localUniformBuffer);
+
+    if (gpuCullingActive)
+    {
+        GpuCulling::Upload(*this, gpuCulling);
+    }
+}
+
+void App::PushViewParams(vec4 clippingPlane)
+{
+    sceneCam.Update();
+
+    view = glm::lookAt(sceneCam.cameraPos, sceneCam.cameraPos + sceneCam.cameraFront, sceneCam.cameraUp);
+    glm::mat4 viewProjection = projection * view;
+    viewFrustum = Culling::ExtractFrustum(viewProjection);
+    viewClippingPlane = clippingPlane;
+
+    BufferManager::MapBuffer(localUniformBuffer, GL_WRITE_ONLY);
+
+    BufferManager::AlignHead(localUniformBuffer, uniformBlockAlignment);
+    viewParamsOffset = localUniformBuffer.head;
+    PushMat4(localUniformBuffer, view);
+    PushMat4(localUniformBuffer, projection);
+    PushMat4(localUniformBuffer, viewProjection);
+    PushVec4(localUniformBuffer, clippingPlane);
+    PushVec3(localUniformBuffer, sceneCam.cameraPos);
+    viewParamsSize = localUniformBuffer.head - viewParamsOffset;
+
+    BufferManager::UnmapBuffer(localUniformBuffer);
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(2), localUniformBuffer.handle, viewParamsOffset, viewParamsSize);
 }
 
 void App::RenderWater(const Program& aBindedProgram)
 {   
     
     // Obtn las ubicaciones de las variables uniformes en el shader
-    GLuint viewLoc = glGetUniformLocation(aBindedProgram.handle, "viewMatrix");
-    GLuint projLoc = glGetUniformLocation(aBindedProgram.handle, "projectionMatrix");
-    GLuint modelLoc = glGetUniformLocation(aBindedProgram.handle, "modelMatrix");
+    GLint viewLoc = aBindedProgram.uniformLocations[Uniform_ViewMatrix];
+    GLint projLoc = aBindedProgram.uniformLocations[Uniform_ProjectionMatrix];
+    GLint modelLoc = aBindedProgram.uniformLocations[Uniform_ModelMatrix];
 
     // Enva las matrices al shader
     glUniformMatrix4fv(viewLoc, 1, GL_FALSE, &view[0][0]);
     glUniformMatrix4fv(projLoc, 1, GL_FALSE, &projection[0][0]);
     glUniformMatrix4fv(modelLoc, 1, GL_FALSE, &WaterWorldMatrix[0][0]);
 
-    GLuint reflectTexLoc = glGetUniformLocation(aBindedProgram.handle, "reflectionTexture");
-    GLuint refractTexLoc = glGetUniformLocation(aBindedProgram.handle, "refractionTexture");
-    GLuint dudvMapLoc = glGetUniformLocation(aBindedProgram.handle, "dudvMap");
+    GLint reflectTexLoc = aBindedProgram.uniformLocations[Uniform_ReflectionTexture];
+    GLint refractTexLoc = aBindedProgram.uniformLocations[Uniform_RefractionTexture];
+    GLint dudvMapLoc = aBindedProgram.uniformLocations[Uniform_DudvMap];
 
-    GLuint moveFactorLoc = glGetUniformLocation(aBindedProgram.handle, "moveFactor");
+    GLint moveFactorLoc = aBindedProgram.uniformLocations[Uniform_MoveFactor];
 
     if (moveFactor < 1)
     {
@@ -823,14 +1352,32 @@ void App::ConfigureFrameBuffer(FrameBuffer& aConfigFB)
 {
     aConfigFB.Clear();
 
-    aConfigFB.colorAttachment.push_back(CreateTexture());
-    aConfigFB.colorAttachment.push_back(CreateTexture(true));
-    aConfigFB.colorAttachment.push_back(CreateTexture(true));
-    aConfigFB.colorAttachment.push_back(CreateTexture(true));
+    if (useCompactGBuffer)
+    {
+        // Albedo and octahedron encoded normals, mapped to [0, 1]
+        aConfigFB.colorAttachment.push_back(CreateTexture());
+        GLuint normals;
+        glGenTextures(1, &normals);
+        glBindTexture(GL_TEXTURE_2D, normals);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16, displaySize.x, displaySize.y, 0, GL_RG, GL_UNSIGNED_SHORT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        aConfigFB.colorAttachment.push_back(normals);
+    }
+    else
+    {
+        aConfigFB.colorAttachment.push_back(CreateTexture());
+        aConfigFB.colorAttachment.push_back(CreateTexture(true));
+        aConfigFB.colorAttachment.push_back(CreateTexture(true));
+        aConfigFB.colorAttachment.push_back(CreateTexture(true));
+    }
 
     glGenTextures(1, &aConfigFB.depthHandle);
     glBindTexture(GL_TEXTURE_2D, aConfigFB.depthHandle);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, displaySize.x, displaySize.y, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    // With stencil for the light volumes, sampling it still returns the depth
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, displaySize.x, displaySize.y, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
@@ -849,7 +1396,7 @@ void App::ConfigureFrameBuffer(FrameBuffer& aConfigFB)
         drawBuffers.push_back(position);
     }
 
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, aConfigFB.depthHandle, 0);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, aConfigFB.depthHandle, 0);
 
     glDrawBuffers(drawBuffers.size(), drawBuffers.data());
 
@@ -862,17 +1409,79 @@ void App::ConfigureFrameBuffer(FrameBuffer& aConfigFB)
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
+void App::BindGBuffer(const Program& aBindedProgram)
+{
+    const UniformId targetUniforms[] = { Uniform_Albedo, Uniform_Normals, Uniform_Position, Uniform_ViewDir };
+    for (u32 i = 0; i < deferredFrameBuffer.colorAttachment.size(); ++i)
+    {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, deferredFrameBuffer.colorAttachment[i]);
+        glUniform1i(aBindedProgram.uniformLocations[targetUniforms[i]], i);
+    }
+
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_2D, deferredFrameBuffer.depthHandle);
+    glUniform1i(aBindedProgram.uniformLocations[Uniform_Depth], 4);
+    glActiveTexture(GL_TEXTURE0);
+
+    glUniform1i(aBindedProgram.uniformLocations[Uniform_CompactGBuffer], useCompactGBuffer ? 1 : 0);
+    glm::mat4 inverseViewProjection = glm::inverse(projection * view);
+    glUniformMatrix4fv(aBindedProgram.uniformLocations[Uniform_InverseViewProjection], 1, GL_FALSE, glm::value_ptr(inverseViewProjection));
+}
+
+void App::ConfigureMaterialSampler()
+{
+    if (materialSampler == 0)
+        glGenSamplers(1, &materialSampler);
+
+    // Same wrapping the textures are created with
+    GLenum minFilter = textureFiltering == TextureFiltering_Bilinear ? GL_LINEAR_MIPMAP_NEAREST : GL_LINEAR_MIPMAP_LINEAR;
+    glSamplerParameteri(materialSampler, GL_TEXTURE_MIN_FILTER, minFilter);
+    glSamplerParameteri(materialSampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glSamplerParameteri(materialSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glSamplerParameteri(materialSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    if (maxAnisotropy > 1.0f)
+    {
+        f32 samples = textureFiltering == TextureFiltering_Anisotropic ? glm::min((f32)anisotropy, maxAnisotropy) : 1.0f;
+        glSamplerParameterf(materialSampler, GL_TEXTURE_MAX_ANISOTROPY, samples);
+    }
+}
+
+u64 App::GetTextureMemoryBytes() const
+{
+    u64 memoryBytes = cubemapMemoryBytes + materialTable.memoryBytes;
+    for (const Texture& texture : textures)
+    {
+        memoryBytes += texture.memoryBytes;
+    }
+    return memoryBytes;
+}
+
+u32 App::GetGBufferBytesPerPixel(bool compact) const
+{
+    // Depth-stencil (DEPTH24_STENCIL8) and albedo (RGBA8), plus RG16 normals or RGBA16F normals, position and viewDir
+    const u32 depthAndAlbedo = 4 + 4;
+    return compact ? depthAndAlbedo + 4 : depthAndAlbedo + 3 * 8;
+}
+
 void App::ConfigureWaterBuffer(FrameBuffer& aConfigFB, GLuint& colorAttach, GLuint& depth)
 {
     aConfigFB.Clear();
 
-    colorAttach = CreateTexture();
+    colorAttach = CreateTexture(waterBuffers.size, false);
+
+    // Scaled down targets are magnified over the water, filter them
+    glBindTexture(GL_TEXTURE_2D, colorAttach);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, 0);
 
     aConfigFB.colorAttachment.push_back(colorAttach);
 
     glGenTextures(1, &aConfigFB.depthHandle);
     glBindTexture(GL_TEXTURE_2D, aConfigFB.depthHandle);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, displaySize.x, displaySize.y, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, waterBuffers.size.x, waterBuffers.size.y, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
@@ -906,43 +1515,306 @@ void App::ConfigureWaterBuffer(FrameBuffer& aConfigFB, GLuint& colorAttach, GLui
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
-void App::RenderGeometry(const Program& aBindedProgram, vec4 clippingPlane)
+void App::ConfigureWaterBuffers()
+{
+    waterBuffers.size = glm::max(displaySize / (i32)waterResolutionDivisor, ivec2(1));
+    ConfigureWaterBuffer(waterBuffers.fboReflection, waterBuffers.rtReflection, waterBuffers.rtReflectionDepth);
+    ConfigureWaterBuffer(waterBuffers.fboRefraction, waterBuffers.rtRefraction, waterBuffers.rtRefractionDepth);
+    waterBuffers.valid = false;
+}
+
+bool App::NeedsWaterUpdate()
+{
+    WaterBuffer& water = waterBuffers;
+    water.framesSinceUpdate++;
+
+    bool update = !water.valid || water.framesSinceUpdate >= (u32)waterUpdateInterval;
+    if (update && water.valid && waterUpdateOnMove)
+    {
+        f32 turnCos = glm::dot(glm::normalize(sceneCam.cameraFront), water.updateCameraFront);
+        update = glm::distance(sceneCam.cameraPos, water.updateCameraPos) > waterMoveThreshold ||
+            turnCos < cosf(glm::radians(waterTurnThreshold)) ||
+            WaterWorldMatrix != water.updateWaterMatrix;
+    }
+
+    if (update)
+    {
+        water.valid = true;
+        water.framesSinceUpdate = 0;
+        water.updateCameraPos = sceneCam.cameraPos;
+        water.updateCameraFront = glm::normalize(sceneCam.cameraFront);
+        water.updateWaterMatrix = WaterWorldMatrix;
+    }
+    return update;
+}
+
+bool App::UpdateWaterScreenRect()
+{
+    WaterBuffer& water = waterBuffers;
+    water.screenRect = vec4(-1.0f, -1.0f, 1.0f, 1.0f);
+    if (!waterClipToScreen) return true;
+
+    // Same quad as LoadWaterVAO()
+    const vec4 corners[] = {
+        vec4(-0.5f, 0.0f, -0.5f, 1.0f),
+        vec4( 0.5f, 0.0f, -0.5f, 1.0f),
+        vec4( 0.5f, 0.0f,  0.5f, 1.0f),
+        vec4(-0.5f, 0.0f,  0.5f, 1.0f)
+    };
+
+    sceneCam.Update();
+    glm::mat4 mainView = glm::lookAt(sceneCam.cameraPos, sceneCam.cameraPos + sceneCam.cameraFront, sceneCam.cameraUp);
+    glm::mat4 worldViewProjection = projection * mainView * WaterWorldMatrix;
+
+    vec4 clip[4];
+    for (u32 i = 0; i < 4; ++i)
+    {
+        clip[i] = worldViewProjection * corners[i];
+    }
+
+    // Clipped against the near plane first (w is the view depth), the points behind the camera have no projection
+    vec2 ndcMin = vec2(FLT_MAX);
+    vec2 ndcMax = vec2(-FLT_MAX);
+    u32 pointCount = 0;
+    for (u32 i = 0; i < 4; ++i)
+    {
+        const vec4& a = clip[i];
+        const vec4& b = clip[(i + 1) % 4];
+        bool aInside = a.w >= CAMERA_Z_NEAR;
+        bool bInside = b.w >= CAMERA_Z_NEAR;
+
+        vec4 points[2];
+        u32 count = 0;
+        if (aInside) points[count++] = a;
+        if (aInside != bInside) points[count++] = glm::mix(a, b, (CAMERA_Z_NEAR - a.w) / (b.w - a.w));
+
+        for (u32 p = 0; p < count; ++p)
+        {
+            vec2 ndc = vec2(points[p]) / points[p].w;
+            ndcMin = glm::min(ndcMin, ndc);
+            ndcMax = glm::max(ndcMax, ndc);
+            pointCount++;
+        }
+    }
+
+    if (pointCount > 0)
+    {
+        ndcMin = glm::max(ndcMin - vec2(WATER_DISTORTION_MARGIN), vec2(-1.0f));
+        ndcMax = glm::min(ndcMax + vec2(WATER_DISTORTION_MARGIN), vec2(1.0f));
+    }
+
+    if (pointCount == 0 || ndcMin.x >= ndcMax.x || ndcMin.y >= ndcMax.y)
+    {
+        // Refreshed as soon as it comes back into view
+        water.valid = false;
+        return false;
+    }
+
+    water.screenRect = vec4(ndcMin, ndcMax);
+    return true;
+}
+
+vec4 App::GetWaterPassRect(bool reflection) const
+{
+    // WATER_SHADER samples the reflection at (x, 1 - y)
+    const vec4& rect = waterBuffers.screenRect;
+    if (reflection) return vec4(rect.x, -rect.w, rect.z, -rect.y);
+    return rect;
+}
+
+void App::BeginWaterScissor(bool reflection)
+{
+    vec4 rect = GetWaterPassRect(reflection) * 0.5f + 0.5f;
+    vec2 size = vec2(waterBuffers.size);
+    ivec2 scissorMin = ivec2(glm::floor(vec2(rect.x, rect.y) * size));
+    ivec2 scissorMax = ivec2(glm::ceil(vec2(rect.z, rect.w) * size));
+
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(scissorMin.x, scissorMin.y, scissorMax.x - scissorMin.x, scissorMax.y - scissorMin.y);
+}
+
+void App::RenderGeometry(const Program& aBindedProgram, ProfilerPass pass)
 {
     glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), localUniformBuffer.handle, globalParamsOffset, globalParamsSize);
 
-    GLuint planeLoc = glGetUniformLocation(aBindedProgram.handle, "plane");
-    glUniform4f(planeLoc, clippingPlane.x, clippingPlane.y, clippingPlane.z, clippingPlane.w);
+    // The water passes can skip the distant entities, the ones entirely on the clipped side of
+    // the water plane (gl_ClipDistance would discard them after the vertex shader) and the ones
+    // outside the part of the target the water samples
+    Frustum frustum = viewFrustum;
+    if (pass == ProfilerPass_Reflection || pass == ProfilerPass_Refraction)
+    {
+        Culling::LimitDistance(frustum, sceneCam.cameraPos, sceneCam.cameraFront, waterCullDistance);
+        Culling::ReplaceNearPlane(frustum, viewClippingPlane);
+        Culling::ClipToRect(frustum, projection * view, GetWaterPassRect(pass == ProfilerPass_Reflection));
+    }
 
-    for (auto it = entities.begin(); it != entities.end(); ++it)
+    if (useFrustumCulling && useGpuCulling)
     {
+        CullingView view = CullingView_Main;
+        if (pass == ProfilerPass_Reflection) view = CullingView_Reflection;
+        if (pass == ProfilerPass_Refraction) view = CullingView_Refraction;
+
+        // The visible count is read back a few frames late to avoid stalling
+        GpuCulling::Cull(*this, gpuCulling, view, frustum, localUniformBuffer.regionIndex);
+        ClusteredLighting::Bind(*this, lightClusters);
+        u32 drawCalls = GpuCulling::Draw(*this, gpuCulling, view, aBindedProgram);
+        MaterialTables::Unbind();
+
+        u32 instanceCount = (u32)gpuCulling.instances.size();
+        u32 visibleCount = glm::min(gpuCulling.visibleCounts[view], instanceCount);
+        ProfilerManager::AddCullStats(profiler, pass, visibleCount, instanceCount - visibleCount);
+        ProfilerManager::AddDrawStats(profiler, drawCalls, 0);
+        return;
+    }
 
-        glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), localUniformBuffer.handle, it->localParamsOffset, it->localParamsSize);
+    ClusteredLighting::Bind(*this, lightClusters);
 
-        Model& model = models[it->modelIndex];
-        Mesh& mesh = meshes[model.meshIdx];
+    // The frustum comes from the view-projection of this pass, so the mirrored reflection camera culls on its own
+    u32 visibleCount = (u32)instanceOrder.size();
+    if (useFrustumCulling)
+        visibleCount = Culling::CullAabbs(frustum, cullingBounds, instanceVisibility);
+    else
+        instanceVisibility.assign(instanceOrder.size(), 1);
 
-        //glUniformMatrix4fv(glGetUniformLocation(texturedMeshProgram.handle, "WVP"), 1, GL_FALSE, &WVP[0][0]);
+    // Entities whose model is still loading have nothing to draw yet
+    u32 loadingCount = 0;
+    for (u32 i = 0; i < instanceOrder.size(); ++i)
+    {
+        if (!entities[instanceOrder[i]].boundsValid)
+        {
+            loadingCount++;
+            visibleCount -= instanceVisibility[i];
+            instanceVisibility[i] = 0;
+        }
+    }
+    u32 culledCount = (u32)instanceOrder.size() - loadingCount - visibleCount;
 
-        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    // Only the G-buffer pass is rendered from the same camera as the depth pyramid
+    if (pass == ProfilerPass_GBuffer && useOcclusionCulling && hiZ.depthValid)
+    {
+        u32 occludedCount = 0;
+        for (u32 i = 0; i < instanceOrder.size(); ++i)
         {
-            GLuint vao = FindVAO(mesh, i, aBindedProgram);
-            glBindVertexArray(vao);
+            const Entity& entity = entities[instanceOrder[i]];
+            if (!instanceVisibility[i] || !entity.boundsValid) continue;
 
-            u32 subMeshmaterialIdx = model.materialIdx[i];
-            Material& subMeshMaterial = materials[subMeshmaterialIdx];
+            if (HiZManager::IsOccluded(hiZ, entity.worldAabbMin, entity.worldAabbMax))
+            {
+                instanceVisibility[i] = 0;
+                occludedCount++;
+            }
+        }
+        visibleCount -= occludedCount;
+        ProfilerManager::AddOcclusionStats(profiler, pass, occludedCount);
+    }
+    ProfilerManager::AddCullStats(profiler, pass, visibleCount, culledCount);
 
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, textures[subMeshMaterial.albedoTextureIdx].handle);
-            glUniform1i(texturedMeshProgram_uTexture, 0);
+    // Compact the visible instances batch by batch, the shaders read their world matrix through this list
+    visibleInstances.clear();
+    batchVisibleFirst.resize(instanceBatches.size());
+    batchVisibleCount.resize(instanceBatches.size());
+    for (u32 b = 0; b < instanceBatches.size(); ++b)
+    {
+        const InstanceBatch& batch = instanceBatches[b];
+        batchVisibleFirst[b] = (u32)visibleInstances.size();
+        for (u32 i = batch.firstInstance; i < batch.firstInstance + batch.instanceCount; ++i)
+        {
+            if (instanceVisibility[i]) visibleInstances.push_back(i);
+        }
+        batchVisibleCount[b] = (u32)visibleInstances.size() - batchVisibleFirst[b];
+    }
 
-            SubMesh& submesh = mesh.submeshes[i];
-            glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
+    RenderQueueManager::Clear(renderQueue);
+    drawInstances.clear();
+    drawIndices.clear();
+    drawParams.clear();
+
+    for (u32 b = 0; b < instanceBatches.size(); ++b)
+    {
+        const InstanceBatch& batch = instanceBatches[b];
+        if (batchVisibleCount[b] == 0) continue;
+
+        Model& model = models[batch.modelIndex];
+        Mesh& mesh = meshes[model.meshIdx];
+
+        // Batches are ordered by their closest visible instance
+        f32 depth = CAMERA_Z_FAR;
+        for (u32 i = 0; i < batchVisibleCount[b]; ++i)
+        {
+            const Entity& entity = entities[instanceOrder[visibleInstances[batchVisibleFirst[b] + i]]];
+            depth = glm::min(depth, glm::length(vec3(entity.worldMatrix[3]) - sceneCam.cameraPos));
         }
 
+        // Each submesh gets its own copy of the visible instances, so the shaders find its material and box through it
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        {
+            SubMesh& submesh = mesh.submeshes[i];
+
+            // The ring region only has room for MAX_DRAW_INSTANCES draw instances, and MAX_DRAWS draw params and indirect commands, per pass
+            if (drawInstances.size() + batchVisibleCount[b] > MAX_DRAW_INSTANCES || drawParams.size() >= MAX_DRAWS)
+            {
+                if (!drawLimitWarned)
+                {
+                    ELOG("Too many draws, the submeshes past %u draw instances or %u draws are left out", MAX_DRAW_INSTANCES, MAX_DRAWS);
+                    drawLimitWarned = true;
+                }
+                break;
+            }
+
+            DrawCommand command = {};
+            command.vao = GeometryArenaManager::FindVAO(geometryArena, submesh.vertexArenaIdx, aBindedProgram);
+            command.indexCount = submesh.indexCount;
+            command.firstIndex = submesh.firstIndex;
+            command.baseVertex = submesh.baseVertex;
+            command.instanceCount = batchVisibleCount[b];
+            command.baseInstance = (u32)drawInstances.size();
+            command.key = RenderQueueManager::MakeDrawKey(aBindedProgram.handle, command.vao, depth, CAMERA_Z_FAR);
+            RenderQueueManager::Push(renderQueue, command);
+
+            drawInstances.insert(drawInstances.end(), visibleInstances.begin() + batchVisibleFirst[b],
+                visibleInstances.begin() + batchVisibleFirst[b] + batchVisibleCount[b]);
+            drawIndices.insert(drawIndices.end(), batchVisibleCount[b], (u32)drawParams.size());
+            drawParams.push_back(RenderQueueManager::MakeDrawParams(submesh, model.materialIdx[i]));
+        }
     }
+    BufferManager::MapBuffer(localUniformBuffer, GL_WRITE_ONLY);
+    BufferManager::AlignHead(localUniformBuffer, storageBlockAlignment);
+    u32 drawInstancesOffset = localUniformBuffer.head;
+    PushData(localUniformBuffer, drawInstances.data(), drawInstances.size() * sizeof(u32));
+    u32 drawInstancesSize = glm::max(localUniformBuffer.head - drawInstancesOffset, (u32)sizeof(u32));
+    BufferManager::AlignHead(localUniformBuffer, storageBlockAlignment);
+    u32 drawIndicesOffset = localUniformBuffer.head;
+    PushData(localUniformBuffer, drawIndices.data(), drawIndices.size() * sizeof(u32));
+    u32 drawIndicesSize = glm::max(localUniformBuffer.head - drawIndicesOffset, (u32)sizeof(u32));
+    BufferManager::AlignHead(localUniformBuffer, storageBlockAlignment);
+    u32 drawParamsOffset = localUniformBuffer.head;
+    PushData(localUniformBuffer, drawParams.data(), drawParams.size() * sizeof(GpuDrawParams));
+    u32 drawParamsSize = glm::max(localUniformBuffer.head - drawParamsOffset, (u32)sizeof(GpuDrawParams));
+    BufferManager::UnmapBuffer(localUniformBuffer);
+
+    RenderQueueManager::Sort(renderQueue);
+
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, BINDING(1), localUniformBuffer.handle, instanceParamsOffset, instanceParamsSize);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, BINDING(3), localUniformBuffer.handle, drawInstancesOffset, drawInstancesSize);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, BINDING(7), localUniformBuffer.handle, drawIndicesOffset, drawIndicesSize);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, BINDING(9), localUniformBuffer.handle, drawParamsOffset, drawParamsSize);
+    MaterialTables::Bind(*this, materialTable, aBindedProgram);
+
+    if (useMultiDrawIndirect)
+        RenderQueueManager::ExecuteIndirect(renderQueue, localUniformBuffer);
+    else
+        RenderQueueManager::Execute(renderQueue);
+
+    MaterialTables::Unbind();
+    ProfilerManager::AddDrawStats(profiler, renderQueue.drawCalls, renderQueue.bindsSkipped);
 }
 
 const GLuint App::CreateTexture(const bool isFloatingPoint)
+{
+    return CreateTexture(displaySize, isFloatingPoint);
+}
+
+GLuint App::CreateTexture(ivec2 size, const bool isFloatingPoint)
 {
     GLuint textureHandle;
 
@@ -952,7 +1824,7 @@ const GLuint App::CreateTexture(const bool isFloatingPoint)
 
     glGenTextures(1, &textureHandle);
     glBindTexture(GL_TEXTURE_2D, textureHandle);
-    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, displaySize.x, displaySize.y, 0, format, dataType, NULL);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, size.x, size.y, 0, format, dataType, NULL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
@@ -1027,22 +1899,47 @@ unsigned int App::loadCubemapTextures(std::vector<std::string> faces)
     glGenTextures(1, &textureID);
     glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
-    int width, height, nrChannels;
+    // The faces are decoded (or their cooked BC1 mapped) on the workers and uploaded one by one as they arrive
+    JobSystem* jobSystem = &jobs;
+    bool useCache = useTextureCache;
     for (unsigned int i = 0; i < faces.size(); i++)
     {
-        unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-        if (data)
-        {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
-                0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data
-            );
-            stbi_image_free(data);
-        }
-        else
+        std::string face = faces[i];
+        JobManager::Submit(jobs, [jobSystem, face, textureID, i, useCache]()
         {
-            //  cout << "Cubemap tex failed to load at path: " << faces[i] << std::endl;
-            stbi_image_free(data);
-        }
+            if (useCache)
+            {
+                CookedTexture cooked = {};
+                if (!TextureCache::Load(face.c_str(), TextureKind_Color, false, cooked)) return;
+
+                JobManager::PushUpload(*jobSystem, [cooked, textureID, i](App* app) mutable
+                {
+                    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+                    TextureCache::UploadLevels(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, cooked.image);
+                    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, cooked.image.mipCount - 1);
+                    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+                    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+                    app->cubemapMemoryBytes += cooked.image.dataSize;
+                    TextureCache::Release(cooked);
+                });
+                return;
+            }
+
+            Image image = ModelLoader::LoadImage(face.c_str(), false);
+            if (!image.pixels) return;
+
+            JobManager::PushUpload(*jobSystem, [image, textureID, i](App* app)
+            {
+                GLenum dataFormat = image.nchannels == 4 ? GL_RGBA : GL_RGB;
+                glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
+                    0, GL_RGB, image.size.x, image.size.y, 0, dataFormat, GL_UNSIGNED_BYTE, image.pixels
+                );
+                glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+                app->cubemapMemoryBytes += (u64)image.size.x * image.size.y * 4;
+                ModelLoader::FreeImage(image);
+            });
+        });
     }
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
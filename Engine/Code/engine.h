@@ -7,6 +7,18 @@
 #include "platform.h"
 #include "BufferSuppFunctions.h"
 #include "ModelLoadingFunctions.h"
+#include "ProfilerFunctions.h"
+#include "ProgramCacheFunctions.h"
+#include "JobSystemFunctions.h"
+#include "RenderQueueFunctions.h"
+#include "GeometryArenaFunctions.h"
+#include "CullingFunctions.h"
+#include "GpuCullingFunctions.h"
+#include "HiZFunctions.h"
+#include "ClusteredLightingFunctions.h"
+#include "LightVolumeFunctions.h"
+#include "TextureStreamingFunctions.h"
+#include "MaterialTableFunctions.h"
 #include "Globals.h"
 
 const VertexV3V2 vertices[] = {
@@ -22,6 +34,36 @@ const u16 indices[] =
     0,2,3
 };
 
+#define GLSL_VERSION_STRING "#version 430\n"
+
+// Seconds between checks of the shader files timestamps
+#define SHADER_WATCH_INTERVAL 0.5f
+
+#define CAMERA_Z_NEAR 0.1f
+#define CAMERA_Z_FAR  1000.0f
+
+// World matrices the instance buffer holds per frame
+#define MAX_INSTANCES 16384
+
+// Entries of the per draw visible lists, every submesh of a visible instance takes one. The
+// draws that don't fit are left out (and logged once).
+#define MAX_DRAW_INSTANCES (4 * MAX_INSTANCES)
+
+// Draws (submeshes of the visible batches) per pass, same as MAX_DRAW_INSTANCES past it
+#define MAX_DRAWS MAX_INSTANCES
+
+// Lights the light buffer holds per frame
+#define MAX_LIGHTS 4096
+
+// EXT/ARB_texture_filter_anisotropic, only core since OpenGL 4.6
+#ifndef GL_TEXTURE_MAX_ANISOTROPY
+#define GL_TEXTURE_MAX_ANISOTROPY     0x84FE
+#define GL_MAX_TEXTURE_MAX_ANISOTROPY 0x84FF
+#endif
+
+// NDC margin around the water on screen, the WATER_SHADER distortion moves the lookups up to 0.04 in texture space
+#define WATER_DISTORTION_MARGIN 0.08f
+
 enum WaterScenePart
 {
     REFLECTION,
@@ -34,7 +76,11 @@ struct App
 
     void LoadWaterVAO();
 
-    void UpdateEntityBuffer(bool mouse);
+    // Per frame: lights and entity world matrices, written once
+    void UpdateSceneBuffer();
+
+    // Per pass: camera matrices and clipping plane, bound to BINDING(2)
+    void PushViewParams(vec4 clippingPlane);
 
     //void UpdateWatterBuffer();
 
@@ -42,8 +88,21 @@ struct App
 
     //void PassWaterScene(Camera camera, GLenum colorAttachment, WaterScenePart part);
 
+    // G-buffer targets for the current display size and layout (useCompactGBuffer)
     void ConfigureFrameBuffer(FrameBuffer& aConfigFB);
 
+    // Creates materialSampler on first use and applies textureFiltering and anisotropy to it
+    void ConfigureMaterialSampler();
+
+    // Material textures not moved to the material arrays yet, the arrays and the skybox
+    u64 GetTextureMemoryBytes() const;
+
+    // Size of a G-buffer pixel with its depth-stencil, per layout
+    u32 GetGBufferBytesPerPixel(bool compact) const;
+
+    // Binds the G-buffer targets (texture units 0 to 4) and its layout uniforms for a lighting program
+    void BindGBuffer(const Program& aBindedProgram);
+
     FrameBuffer CreateFrameBuffer();
 
     GLuint CreateTextureAttachment(int width, int height);
@@ -54,15 +113,36 @@ struct App
     
     void ConfigureWaterBuffer(FrameBuffer& aConfigFB, GLuint& colorAttach, GLuint& depth);
 
+    // Both water targets at displaySize / waterResolutionDivisor, they are refreshed on the next frame
+    void ConfigureWaterBuffers();
+
+    // Whether the water targets are re-rendered this frame (waterUpdateInterval, waterUpdateOnMove)
+    bool NeedsWaterUpdate();
+
+    // NDC extent of the water quad in the main view, kept in waterBuffers.screenRect. Returns false
+    // (and invalidates the targets) when the water is not on screen, the passes are then skipped.
+    bool UpdateWaterScreenRect();
+
+    // The part of the target a water pass needs, the reflection is sampled upside down
+    vec4 GetWaterPassRect(bool reflection) const;
+
+    // Scissor to GetWaterPassRect() in the water target pixels
+    void BeginWaterScissor(bool reflection);
+
     float GetHeight(glm::mat4 transformMat);
 
-    void RenderGeometry(const Program& aBindedProgram, vec4 clippingPlane);
+    // Culls the instances against the frustum of the last PushViewParams() and draws the visible ones
+    void RenderGeometry(const Program& aBindedProgram, ProfilerPass pass);
 
     void CreateDirectLight(vec3 color, vec3 direction, vec3 position);
 
     void CreatePointLight(vec3 color, vec3 direction, vec3 position);
 
+    // Small point lights scattered over the scene (no marker entity), to stress the light culling
+    void CreateRandomPointLights(u32 count);
+
     const GLuint CreateTexture(const bool isFloatingPoint = false);
+    GLuint CreateTexture(ivec2 size, const bool isFloatingPoint);
 
 
     
@@ -123,6 +203,12 @@ struct App
     // Input
     Input input;
 
+    // Per-pass CPU/GPU timings
+    Profiler profiler;
+
+    // Asset loading workers and the GL upload queue
+    JobSystem jobs;
+
     // Graphics
     char gpuName[64];
     char openGlVersion[64];
@@ -137,14 +223,38 @@ struct App
 
     // program indices
     u32 texturedGeometryProgramIdx = 0;
+
+    f32 shaderWatchTimer = 0.0f;
+
+    // Load programs from ProgramCache/ when the source didn't change
+    bool useProgramCache = true;
+    f64  programLoadMs = 0.0;
+
+    // Block compressed textures from their .dds next to the image, cooked on the first load (see TextureCacheFunctions.h)
+    bool useTextureCache = true;
+    u64  cubemapMemoryBytes = 0;
+
+    // Mip residency of the cooked material textures, updated every frame after the scene buffer
+    TextureStreamer textureStreaming;
+
+    // Material texture arrays, bound once by the geometry passes for every material
+    MaterialTable materialTable;
+
+    // The material texture arrays are sampled through this sampler object by the geometry passes
+    GLuint           materialSampler = 0;
+    TextureFiltering textureFiltering = TextureFiltering_Anisotropic;
+    i32              anisotropy = 8;
+    f32              maxAnisotropy = 1.0f; // 1 without anisotropic filtering support
     
     GLuint renderToBackBufferShader;
     GLuint renderToFrameBufferShader;
     GLuint framebufferToQuadShader;
     GLuint waterShader;
+    GLuint gpuCullingShader;
+    GLuint hiZShader;
+    GLuint clusteredLightsShader;
+    GLuint lightVolumeShader;
 
-    GLuint texturedMeshProgram_uTexture;
-    
     //program Skybox and hdr
     GLuint skyboxFragmentShaderToVertexShader;
    // GLuint equirrectangularToCubeMap;
@@ -175,8 +285,69 @@ struct App
 
     GLint maxUniformBufferSize;
     GLint uniformBlockAlignment; //Alignment between uniform BLOCKS!!!!
+    GLint storageBlockAlignment;
     Buffer localUniformBuffer;
+    RenderQueue renderQueue;
+    GeometryArena geometryArena;
+
+    // Draw the geometry passes with glMultiDrawElementsIndirect instead of a draw per command
+    bool useMultiDrawIndirect = true;
+    bool useFrustumCulling = true;
+
+    // Cull and build the indirect commands in a compute shader (see GpuCullingFunctions.h)
+    bool useGpuCulling = false;
+    GpuCullingScene gpuCulling;
+
+    // Test the G-buffer pass instances against the depth pyramid of previous frames
+    bool useOcclusionCulling = true;
+    HiZPyramid hiZ;
+
+    // Lights per cluster of the main view, built every frame (see ClusteredLightingFunctions.h)
+    LightClusters lightClusters;
+
+    // G-buffer with albedo and octahedron encoded normals only, the lighting rebuilds the
+    // position from the depth and the view direction from the camera position
+    bool useCompactGBuffer = false;
+
+    // Water reflection and refraction passes: target resolution (1, 2 or 4), refresh at most every
+    // waterUpdateInterval frames and, with waterUpdateOnMove, only once the camera or the water moved
+    // more than the thresholds. Entities further than waterCullDistance are skipped by these passes.
+    u32 waterResolutionDivisor = 1;
+    i32 waterUpdateInterval = 1;
+    bool waterUpdateOnMove = false;
+    f32 waterMoveThreshold = 0.1f;
+    f32 waterTurnThreshold = 1.0f; // degrees
+    f32 waterCullDistance = CAMERA_Z_FAR;
+
+    // Water passes limited to the screen extent of the water quad: frustum side planes and scissor
+    bool waterClipToScreen = true;
+
+    // Lighting of Mode_DeferredLightVolumes
+    LightVolumeRenderer lightVolumes;
     std::vector<Entity> entities;
+    // Bumped whenever entities are added or moved, or a model finishes loading
+    u32 sceneGeneration;
+
+    // Rebuilt every frame by UpdateSceneBuffer(), entity indices grouped by model. Past
+    // MAX_INSTANCES entities the rest are left out (and logged once).
+    std::vector<u32> instanceOrder;
+    std::vector<InstanceBatch> instanceBatches;
+    bool instanceLimitWarned;
+    GLuint instanceParamsOffset;
+    GLuint instanceParamsSize;
+
+    // World space boxes in instanceOrder, tested against viewFrustum by each pass
+    CullingBounds cullingBounds;
+    Frustum viewFrustum;
+    vec4 viewClippingPlane;
+    std::vector<u8> instanceVisibility;
+    std::vector<u32> visibleInstances;
+    std::vector<u32> batchVisibleFirst;
+    std::vector<u32> batchVisibleCount;
+    std::vector<u32> drawInstances; // visible instances of each draw, indexed with baseInstance + gl_InstanceID
+    std::vector<u32> drawIndices;   // draw of each drawInstances entry, into drawParams
+    std::vector<GpuDrawParams> drawParams;
+    bool drawLimitWarned;
     std::vector<Light> lights;
 
     //Entity water;
@@ -184,6 +355,10 @@ struct App
 
     GLuint globalParamsOffset;
     GLuint globalParamsSize;
+    GLuint lightsOffset;
+    GLuint lightsSize;
+    GLuint viewParamsOffset;
+    GLuint viewParamsSize;
 
     GLuint framebufferHandle;
     GLuint colorAttachmentHandle;
@@ -9,14 +9,21 @@
 #define WIN32_LEAN_AND_MEAN
 #define _CRT_SECURE_NO_WARNINGS
 #include <Windows.h>
+#include <direct.h>
 #else
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 #endif
 
 #include "engine.h"
+#include "BenchmarkFunctions.h"
+#include "MeshCacheFunctions.h"
+#include "TextureCacheFunctions.h"
 #include <stdio.h>
+#include <errno.h>
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
@@ -131,10 +138,9 @@ void OnGlfwResizeFramebuffer(GLFWwindow* window, int width, int height)
     App* app = (App*)glfwGetWindowUserPointer(window);
     app->displaySize = vec2(width, height);
 
-    app->ConfigureWaterBuffer(app->waterBuffers.fboReflection, app->waterBuffers.rtReflection, app->waterBuffers.rtReflectionDepth);
-    app->ConfigureWaterBuffer(app->waterBuffers.fboRefraction, app->waterBuffers.rtRefraction, app->waterBuffers.rtRefractionDepth);
+    app->ConfigureWaterBuffers();
     app->ConfigureFrameBuffer(app->deferredFrameBuffer);
-
+    LightVolumes::Configure(*app, app->lightVolumes);
 }
 
 void OnGlfwCloseWindow(GLFWwindow* window)
@@ -143,18 +149,150 @@ void OnGlfwCloseWindow(GLFWwindow* window)
     app->isRunning = false;
 }
 
-int main()
+GLFWwindow* CreateHeadlessWindow()
+{
+    // Invisible window, preferring an OSMesa/llvmpipe or EGL context so no GPU is needed.
+    // GLFW 3.3 has no null platform, glfwInit() still needs a display server (Xvfb on a CI box).
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+    glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+    GLFWwindow* window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
+    if (window) return window;
+
+    glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+    window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
+    if (window) return window;
+
+    glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_NATIVE_CONTEXT_API);
+    return glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
+}
+
+int RunHeadless(App& app, GLFWwindow* window, const BenchmarkConfig& config)
+{
+    BenchmarkRun run = {};
+    run.config = config;
+
+    app.useProgramCache = config.useProgramCache;
+    app.useGpuCulling = config.useGpuCulling;
+    app.useCompactGBuffer = config.useCompactGBuffer;
+    app.waterResolutionDivisor = config.waterResolutionDivisor;
+    app.waterUpdateInterval = (i32)config.waterUpdateInterval;
+    app.useTextureCache = config.useTextureCache;
+    app.textureStreaming.enabled = config.useTextureStreaming;
+    app.textureFiltering = config.textureFiltering;
+    app.materialTable.maxArrays = config.materialArrays;
+
+    f64 initBegin = glfwGetTime();
+    Init(&app);
+    app.CreateRandomPointLights(config.extraLights);
+    if (config.useLightVolumes)
+        app.mode = Mode_DeferredLightVolumes;
+    // Measure the frames with every asset in place
+    JobManager::Flush(app.jobs, &app);
+    glFinish();
+    run.initMs = (glfwGetTime() - initBegin) * 1000.0;
+    run.programLoadMs = app.programLoadMs;
+    run.gBufferBytesPerPixel = app.GetGBufferBytesPerPixel(config.useCompactGBuffer);
+    run.gBufferFullBytesPerPixel = app.GetGBufferBytesPerPixel(false);
+
+    u32 totalFrames = config.warmupFrames + config.frameCount;
+    for (u32 frame = 0; frame < totalFrames && app.isRunning; ++frame)
+    {
+        // Fixed time step so that every run renders exactly the same frames
+        app.deltaTime = 1.0f / 60.0f;
+
+        Benchmark::ApplyCameraPath(&app, frame, totalFrames);
+
+        ProfilerManager::BeginFrame(app.profiler);
+
+        Update(&app);
+        Render(&app);
+
+        glFinish();
+        ProfilerManager::EndFrame(app.profiler);
+        ProfilerManager::Flush(app.profiler);
+
+        if (frame >= config.warmupFrames)
+            Benchmark::RecordFrame(run, app.profiler);
+
+        glfwSwapBuffers(window);
+
+        // Reset frame allocator
+        GlobalFrameArenaHead = 0;
+    }
+
+    // The buffers still hold the culling of the last frame, the GPU is idle after the glFinish()
+    if (config.validateCulling && app.useGpuCulling)
+    {
+        run.cullingValidated = true;
+        for (u32 view = 0; view < CullingView_Count; ++view)
+        {
+            // The water views are skipped while off-screen or throttled, and none are culled without frustum culling
+            if (!app.gpuCulling.culled[view]) continue;
+            run.cullingMismatches += GpuCulling::Validate(app.gpuCulling, (CullingView)view);
+        }
+    }
+
+    // Every texture is in the material arrays by now
+    run.textureMemoryBytes = app.GetTextureMemoryBytes();
+    if (config.validateMaterials)
+    {
+        run.materialsValidated = true;
+        run.materialReport = MaterialTables::Validate(app, app.materialTable);
+        if (run.materialReport.errors > 0)
+            ELOG("Material table: %u texture slots with an invalid layer", run.materialReport.errors);
+    }
+
+    JobManager::Shutdown(app.jobs);
+
+    bool reportWritten = Benchmark::WriteReport(run);
+    return reportWritten && run.materialReport.errors == 0 && run.cullingMismatches == 0 ? 0 : -1;
+}
+
+int main(int argc, char** argv)
 {
     App app         = {};
     app.deltaTime   = 1.0f/60.0f;
     app.displaySize = ivec2(WINDOW_WIDTH, WINDOW_HEIGHT);
     app.isRunning   = true;
 
+    // Offline cooking: Engine.exe --cook-meshes Patrick/Shrek.obj Patrick/Luffy.obj ...
+    if (argc > 1 && strcmp(argv[1], "--cook-meshes") == 0)
+    {
+        int failed = 0;
+        for (int i = 2; i < argc; ++i)
+        {
+            if (!MeshCache::Cook(argv[i])) failed++;
+        }
+        return failed == 0 ? 0 : -1;
+    }
+
+    // Offline cooking: Engine.exe --cook-textures Patrick/Luffy1.png Patrick/Flowers.png --no-flip SkyboxTextures/posx.jpg ...
+    // --normal, --color and --no-flip apply to the files after them, material textures are flipped like LoadTexture2DAsync() does.
+    if (argc > 1 && strcmp(argv[1], "--cook-textures") == 0)
+    {
+        int failed = 0;
+        TextureKind kind = TextureKind_Color;
+        bool flipVertically = true;
+        for (int i = 2; i < argc; ++i)
+        {
+            if (strcmp(argv[i], "--normal") == 0) kind = TextureKind_Normal;
+            else if (strcmp(argv[i], "--color") == 0) kind = TextureKind_Color;
+            else if (strcmp(argv[i], "--no-flip") == 0) flipVertically = false;
+            else if (!TextureCache::Cook(argv[i], kind, flipVertically)) failed++;
+        }
+        return failed == 0 ? 0 : -1;
+    }
+
+    BenchmarkConfig benchmark = Benchmark::ParseCommandLine(argc, argv);
+
 		glfwSetErrorCallback(OnGlfwError);
 
     if (!glfwInit())
     {
         ELOG("glfwInit() failed\n");
+        if (benchmark.headless)
+            ELOG("--headless still needs a display server, run it under Xvfb (xvfb-run) on machines without one\n");
         return -1;
     }
 
@@ -163,7 +301,9 @@ int main()
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
-    GLFWwindow* window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
+    GLFWwindow* window = benchmark.headless
+        ? CreateHeadlessWindow()
+        : glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
     if (!window)
     {
         ELOG("glfwCreateWindow() failed\n");
@@ -189,6 +329,18 @@ int main()
         return -1;
     }
 
+    if (benchmark.headless)
+    {
+        GlobalFrameArenaMemory = (u8*)malloc(GLOBAL_FRAME_ARENA_SIZE);
+
+        int result = RunHeadless(app, window, benchmark);
+
+        free(GlobalFrameArenaMemory);
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        return result;
+    }
+
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
 
@@ -232,6 +384,8 @@ int main()
 
     while (app.isRunning)
     {
+        ProfilerManager::BeginFrame(app.profiler);
+
         // Tell GLFW to call platform callbacks
         glfwPollEvents();
 
@@ -279,6 +433,8 @@ int main()
             glfwMakeContextCurrent(backup_current_context);
         }
 
+        ProfilerManager::EndFrame(app.profiler);
+
         // Present image on screen
         glfwSwapBuffers(window);
 
@@ -291,6 +447,8 @@ int main()
         GlobalFrameArenaHead = 0;
     }
 
+    JobManager::Shutdown(app.jobs);
+
     free(GlobalFrameArenaMemory);
 
     ImGui_ImplOpenGL3_Shutdown();
@@ -428,6 +586,76 @@ u64 GetFileLastWriteTimestamp(const char* filepath)
     return 0;
 }
 
+MappedFile MapFile(const char* filepath)
+{
+    MappedFile mappedFile = {};
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return mappedFile;
+
+    LARGE_INTEGER size;
+    HANDLE mapping = NULL;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+    {
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    }
+    if (!mapping)
+    {
+        CloseHandle(file);
+        return mappedFile;
+    }
+
+    mappedFile.data = (const u8*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    mappedFile.size = (u64)size.QuadPart;
+    mappedFile.fileHandle = file;
+    mappedFile.mappingHandle = mapping;
+
+    if (!mappedFile.data) UnmapFile(mappedFile);
+#else
+    int file = open(filepath, O_RDONLY);
+    if (file < 0) return mappedFile;
+
+    struct stat attrib;
+    if (fstat(file, &attrib) == 0 && attrib.st_size > 0)
+    {
+        void* data = mmap(NULL, attrib.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (data != MAP_FAILED)
+        {
+            mappedFile.data = (const u8*)data;
+            mappedFile.size = (u64)attrib.st_size;
+        }
+    }
+    close(file);
+#endif
+
+    return mappedFile;
+}
+
+void UnmapFile(MappedFile& mappedFile)
+{
+#ifdef _WIN32
+    if (mappedFile.data) UnmapViewOfFile(mappedFile.data);
+    if (mappedFile.mappingHandle) CloseHandle((HANDLE)mappedFile.mappingHandle);
+    if (mappedFile.fileHandle) CloseHandle((HANDLE)mappedFile.fileHandle);
+#else
+    if (mappedFile.data) munmap((void*)mappedFile.data, mappedFile.size);
+#endif
+
+    mappedFile = MappedFile{};
+}
+
+bool MakeDirectory(const char* path)
+{
+#ifdef _WIN32
+    if (_mkdir(path) == 0) return true;
+#else
+    if (mkdir(path, 0755) == 0) return true;
+#endif
+
+    return errno == EEXIST;
+}
+
 void LogString(const char* str)
 {
 #ifdef _WIN32
@@ -33,6 +33,27 @@ String ReadTextFile(const char *filepath);
  */
 u64 GetFileLastWriteTimestamp(const char *filepath);
 
+struct MappedFile
+{
+    const u8* data;
+    u64       size;
+    void*     fileHandle;
+    void*     mappingHandle;
+};
+
+/**
+ * Maps a whole file read-only in memory. data is NULL if the file couldn't be mapped.
+ */
+MappedFile MapFile(const char *filepath);
+
+void UnmapFile(MappedFile& file);
+
+/**
+ * Creates a directory relative to the working directory. Returns true if it
+ * was created or it already existed.
+ */
+bool MakeDirectory(const char *path);
+
 /**
  * It logs a string to whichever outputs are configured in the platform layer.
  * By default, the string is printed in the output console of VisualStudio.
@@ -0,0 +1,118 @@
+#ifdef CLUSTERED_LIGHTS
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+// One invocation per cluster, see ClusteredLightingFunctions.h
+
+layout(local_size_x = 64) in;
+
+struct Light
+{
+	vec4 position;    // w: radius
+	vec4 color;
+	vec4 direction;
+	vec3 attenuation; // constant, linear, quadratic
+	uint type;
+};
+
+layout(binding = 0, std140) uniform GlobalParams
+{
+	vec3 uCameraPosition;
+	uint uLightCount;
+	mat4 uClusterViewMatrix;
+	mat4 uClusterViewProjection;
+	uvec4 uClusterGrid;  // clusters in x, y, z and max lights per cluster
+	vec4 uClusterDepth;  // near, far, slice scale, slice bias
+};
+
+layout(binding = 4, std430) readonly buffer Lights
+{
+	Light uLight[];
+};
+
+layout(binding = 5, std430) writeonly buffer ClusterLightCounts
+{
+	uint uClusterLightCount[];
+};
+
+layout(binding = 6, std430) writeonly buffer ClusterLightIndices
+{
+	uint uClusterLightIndex[];
+};
+
+// Clusters reached by more than uClusterGrid.w lights, one counter per frame in flight
+layout(binding = 7, std430) buffer OverflowCounters
+{
+	uint uOverflowCount[];
+};
+
+uniform mat4 uInverseProjection;
+uniform uint uCounterIndex;
+
+// View space point where the ray through an NDC position crosses the plane at a depth
+vec3 ViewPointAtDepth(vec2 ndc, float depth)
+{
+	vec4 nearPoint = uInverseProjection * vec4(ndc, -1.0, 1.0);
+	nearPoint /= nearPoint.w;
+	return nearPoint.xyz * (depth / -nearPoint.z);
+}
+
+void main()
+{
+	uint clusterIdx = gl_GlobalInvocationID.x;
+	if (clusterIdx >= uClusterGrid.x * uClusterGrid.y * uClusterGrid.z) return;
+
+	uvec3 cluster = uvec3(clusterIdx % uClusterGrid.x, (clusterIdx / uClusterGrid.x) % uClusterGrid.y, clusterIdx / (uClusterGrid.x * uClusterGrid.y));
+
+	vec2 ndcMin = vec2(cluster.xy) / vec2(uClusterGrid.xy) * 2.0 - 1.0;
+	vec2 ndcMax = vec2(cluster.xy + 1) / vec2(uClusterGrid.xy) * 2.0 - 1.0;
+	float depthRatio = uClusterDepth.y / uClusterDepth.x;
+	float sliceNear = uClusterDepth.x * pow(depthRatio, float(cluster.z) / float(uClusterGrid.z));
+	float sliceFar = uClusterDepth.x * pow(depthRatio, float(cluster.z + 1) / float(uClusterGrid.z));
+
+	// View space box of the cluster corners
+	vec3 aabbMin = vec3(1e30);
+	vec3 aabbMax = vec3(-1e30);
+	for (int i = 0; i < 8; ++i)
+	{
+		vec2 ndc = vec2((i & 1) != 0 ? ndcMax.x : ndcMin.x, (i & 2) != 0 ? ndcMax.y : ndcMin.y);
+		vec3 corner = ViewPointAtDepth(ndc, (i & 4) != 0 ? sliceFar : sliceNear);
+		aabbMin = min(aabbMin, corner);
+		aabbMax = max(aabbMax, corner);
+	}
+
+	uint count = 0;
+	bool overflow = false;
+	for (uint i = 0; i < uLightCount; ++i)
+	{
+		// Directional lights reach every cluster
+		bool reaches = uLight[i].type == 0;
+		if (!reaches)
+		{
+			vec3 center = (uClusterViewMatrix * vec4(uLight[i].position.xyz, 1.0)).xyz;
+			vec3 offset = clamp(center, aabbMin, aabbMax) - center;
+			float radius = uLight[i].position.w;
+			reaches = dot(offset, offset) <= radius * radius;
+		}
+
+		if (reaches)
+		{
+			if (count == uClusterGrid.w)
+			{
+				overflow = true;
+				break;
+			}
+			uClusterLightIndex[clusterIdx * uClusterGrid.w + count] = i;
+			count++;
+		}
+	}
+	uClusterLightCount[clusterIdx] = count;
+
+	if (overflow)
+	{
+		atomicAdd(uOverflowCount[uCounterIndex], 1);
+	}
+}
+
+#endif
+#endif
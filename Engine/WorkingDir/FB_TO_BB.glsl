@@ -20,19 +20,53 @@ void main()
 
 struct Light
 {
+	vec4 position;    // w: radius
+	vec4 color;
+	vec4 direction;
+	vec3 attenuation; // constant, linear, quadratic
 	uint type;
-	vec3 color;
-	vec3 direction;
-	vec3 position;
 };
 
 layout(binding = 0, std140) uniform GlobalParams
 {
 	vec3 uCameraPosition;
 	uint uLightCount;
-	Light uLight[16];
+	mat4 uClusterViewMatrix;
+	mat4 uClusterViewProjection;
+	uvec4 uClusterGrid;  // clusters in x, y, z and max lights per cluster
+	vec4 uClusterDepth;  // near, far, slice scale, slice bias
 };
 
+layout(binding = 4, std430) readonly buffer Lights
+{
+	Light uLight[];
+};
+
+layout(binding = 5, std430) readonly buffer ClusterLightCounts
+{
+	uint uClusterLightCount[];
+};
+
+layout(binding = 6, std430) readonly buffer ClusterLightIndices
+{
+	uint uClusterLightIndex[];
+};
+
+// Cluster of the main view holding a world position, -1 outside of its frustum
+int FindCluster(vec3 worldPosition)
+{
+	vec4 clip = uClusterViewProjection * vec4(worldPosition, 1.0);
+	float depth = clip.w;
+	if (depth < uClusterDepth.x || depth > uClusterDepth.y) return -1;
+
+	vec2 ndc = clip.xy / clip.w;
+	if (any(greaterThan(abs(ndc), vec2(1.0)))) return -1;
+
+	uvec2 tile = uvec2(min((ndc * 0.5 + 0.5) * vec2(uClusterGrid.xy), vec2(uClusterGrid.xy) - 1.0));
+	uint slice = uint(clamp(log(depth) * uClusterDepth.z - uClusterDepth.w, 0.0, float(uClusterGrid.z - 1)));
+	return int(tile.x + tile.y * uClusterGrid.x + slice * uClusterGrid.x * uClusterGrid.y);
+}
+
 
 in vec2 vTexCoord;
 
@@ -41,34 +75,79 @@ uniform sampler2D uNormals;
 uniform sampler2D uPosition;
 uniform sampler2D uViewDir;
 
+// Layout of the G-buffer, see App::ConfigureFrameBuffer
+uniform bool uCompactGBuffer;
+uniform sampler2D uDepth;
+uniform mat4 uInverseViewProjection;
+
 layout(location = 0) out vec4 oColor;
 
-void CalculateBlitVars(in Light light ,out vec3 ambient, out vec3 diffuse, out vec3 specular)
+vec2 SignNotZero(vec2 v)
+{
+	return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec3 OctahedronDecode(vec2 encoded)
+{
+	encoded = encoded * 2.0 - 1.0;
+	vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+	if (normal.z < 0.0) normal.xy = (1.0 - abs(normal.yx)) * SignNotZero(normal.xy);
+	return normalize(normal);
+}
+
+vec3 GBufferNormal(vec2 texCoord)
+{
+	if (!uCompactGBuffer) return texture(uNormals, texCoord).xyz;
+	return OctahedronDecode(texture(uNormals, texCoord).xy);
+}
+
+// The compact layout rebuilds the world position from the depth
+vec3 GBufferPosition(vec2 texCoord)
 {
-			vec3 vNormal = texture(uNormals, vTexCoord).xyz;
-			vec3 vViewDir = texture(uViewDir, vTexCoord).xyz; 
+	if (!uCompactGBuffer) return texture(uPosition, texCoord).xyz;
+	float depth = texture(uDepth, texCoord).r;
+	vec4 position = uInverseViewProjection * vec4(vec3(texCoord, depth) * 2.0 - 1.0, 1.0);
+	return position.xyz / position.w;
+}
+
+vec3 GBufferViewDir(vec2 texCoord, vec3 position)
+{
+	if (!uCompactGBuffer) return texture(uViewDir, texCoord).xyz;
+	return uCameraPosition - position;
+}
 
-			vec3 lightDir = normalize(light.direction);
+void CalculateBlitVars(in Light light, in vec3 vNormal, in vec3 vViewDir, out vec3 ambient, out vec3 diffuse, out vec3 specular)
+{
+			vec3 lightDir = normalize(light.direction.xyz);
 
 			float ambientStrenght = 0.2;
-			ambient = ambientStrenght * light.color;
+			ambient = ambientStrenght * light.color.rgb;
 
 			float diff = max(dot(vNormal, lightDir), 0.0f);
-			diffuse = diff * light.color;
+			diffuse = diff * light.color.rgb;
 
 			float specularStrength = 0.1f;
 			vec3 reflectDir = reflect(-lightDir, vNormal);
 			vec3 normalViewDir = normalize(vViewDir);
 			float spec = pow(max(dot(normalViewDir, reflectDir), 0.0f), 32);
-			specular = specularStrength * spec * light.color;
+			specular = specularStrength * spec * light.color.rgb;
 }
 
 void main()
 {
 	vec4 textureColor = texture(uAlbedo, vTexCoord);
+	vec3 position = GBufferPosition(vTexCoord);
+	vec3 normal = GBufferNormal(vTexCoord);
+	vec3 viewDir = GBufferViewDir(vTexCoord, position);
 	vec4 finalColor = vec4(0.0);
-	for(int i = 0; i < uLightCount; ++i)
+
+	// Outside of the clusters every light is visited
+	int cluster = FindCluster(position);
+	uint lightCount = cluster >= 0 ? uClusterLightCount[cluster] : uLightCount;
+	for(uint i = 0; i < lightCount; ++i)
 	{
+		uint lightIdx = cluster >= 0 ? uClusterLightIndex[uint(cluster) * uClusterGrid.w + i] : i;
+		Light light = uLight[lightIdx];
 		
 		vec3 lightResult = vec3(0.0f);
 
@@ -76,11 +155,9 @@ void main()
 		vec3 diffuse = vec3(0.0);
 		vec3 specular = vec3(0.0);
 
-		if(uLight[i].type == 0)
+		if(light.type == 0)
 		{
-			Light light = uLight[i];
-
-			CalculateBlitVars(light, ambient, diffuse, specular);
+			CalculateBlitVars(light, normal, viewDir, ambient, diffuse, specular);
 
 			lightResult = ambient + diffuse + specular;
 			finalColor += vec4(lightResult, 1.0) * textureColor;
@@ -88,15 +165,11 @@ void main()
 		}
 		else
 		{
-			Light light = uLight[i];
-
-			float constant = 1.0f;
-			float linear = 0.09f;
-			float quadratic = 0.032f;
-			float distance = length(light.position - texture(uPosition,vTexCoord).xyz);
-			float attenuation = 1.0f / (constant + linear * distance + quadratic * (distance * distance));
+			float distance = length(light.position.xyz - position);
+			if (distance > light.position.w) continue;
+			float attenuation = 1.0f / (light.attenuation.x + light.attenuation.y * distance + light.attenuation.z * (distance * distance));
 
-			CalculateBlitVars(light, ambient, diffuse, specular);
+			CalculateBlitVars(light, normal, viewDir, ambient, diffuse, specular);
 
 			lightResult = (ambient * attenuation) + (diffuse * attenuation) + (specular * attenuation);
 			finalColor += vec4(lightResult, 1.0) * textureColor;
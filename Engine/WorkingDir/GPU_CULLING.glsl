@@ -0,0 +1,106 @@
+#ifdef GPU_CULLING
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+// Layouts shared with GpuCullingFunctions.h
+
+layout(local_size_x = 64) in;
+
+struct CullInstance
+{
+	vec4 aabbMin;
+	vec4 aabbMax;
+	uvec4 batchIdx;
+};
+
+struct CullBatch
+{
+	uint firstCommandIdx;
+	uint commandCount;
+	uvec2 padding;
+};
+
+struct DrawCommand
+{
+	uint count;
+	uint instanceCount;
+	uint firstIndex;
+	uint baseVertex;
+	uint baseInstance;
+};
+
+layout(binding = 0, std430) readonly buffer InstanceMatrices
+{
+	mat4 uWorldMatrix[];
+};
+
+layout(binding = 1, std430) readonly buffer Instances
+{
+	CullInstance uInstance[];
+};
+
+layout(binding = 2, std430) readonly buffer Batches
+{
+	CullBatch uBatch[];
+};
+
+layout(binding = 3, std430) readonly buffer BatchCommands
+{
+	uint uBatchCommand[];
+};
+
+layout(binding = 4, std430) buffer Commands
+{
+	DrawCommand uCommand[];
+};
+
+layout(binding = 5, std430) writeonly buffer VisibleInstances
+{
+	uint uVisibleInstance[];
+};
+
+layout(binding = 6, std430) buffer Counters
+{
+	uint uVisibleCount[];
+};
+
+uniform vec4 uFrustumPlanes[6];
+uniform uint uInstanceCount;
+uniform uint uCounterIndex;
+
+void main()
+{
+	uint instanceIdx = gl_GlobalInvocationID.x;
+	if (instanceIdx >= uInstanceCount) return;
+
+	CullInstance instance = uInstance[instanceIdx];
+	mat4 worldMatrix = uWorldMatrix[instanceIdx];
+
+	// World space box of the transformed object box
+	vec3 center = (instance.aabbMin.xyz + instance.aabbMax.xyz) * 0.5;
+	vec3 extents = (instance.aabbMax.xyz - instance.aabbMin.xyz) * 0.5;
+	vec3 worldCenter = (worldMatrix * vec4(center, 1.0)).xyz;
+	vec3 worldExtents = abs(worldMatrix[0].xyz) * extents.x + abs(worldMatrix[1].xyz) * extents.y + abs(worldMatrix[2].xyz) * extents.z;
+
+	for (int i = 0; i < 6; ++i)
+	{
+		vec4 plane = uFrustumPlanes[i];
+		if (dot(plane.xyz, worldCenter) + plane.w + dot(abs(plane.xyz), worldExtents) < 0.0) return;
+	}
+
+	CullBatch batch = uBatch[instance.batchIdx.x];
+	if (batch.commandCount == 0) return;
+
+	atomicAdd(uVisibleCount[uCounterIndex], 1);
+
+	// Every command of the batch gets the instance in its own range of the visible list
+	for (uint i = 0; i < batch.commandCount; ++i)
+	{
+		uint commandIdx = uBatchCommand[batch.firstCommandIdx + i];
+		uint slot = atomicAdd(uCommand[commandIdx].instanceCount, 1);
+		uVisibleInstance[uCommand[commandIdx].baseInstance + slot] = instanceIdx;
+	}
+}
+
+#endif
+#endif
@@ -0,0 +1,70 @@
+#ifdef HIZ
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+// Modes match HiZMode in HiZFunctions.cpp
+#define MODE_COPY_DEPTH 0
+#define MODE_REDUCE     1
+#define MODE_DEBUG      2
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(binding = 0) uniform sampler2D uDepth;
+
+layout(binding = 0, rg32f) readonly uniform image2D uSource;
+layout(binding = 1, rg32f) writeonly uniform image2D uDestination;
+layout(binding = 2, rgba8) writeonly uniform image2D uDebug;
+
+uniform int uMode;
+uniform ivec2 uSourceSize;
+uniform vec2 uNearFar;
+
+void main()
+{
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+
+	if (uMode == MODE_COPY_DEPTH)
+	{
+		if (any(greaterThanEqual(texel, uSourceSize))) return;
+
+		float depth = texelFetch(uDepth, texel, 0).r;
+		imageStore(uDestination, texel, vec4(depth, depth, 0.0, 0.0));
+	}
+	else if (uMode == MODE_REDUCE)
+	{
+		ivec2 destinationSize = max(uSourceSize / 2, ivec2(1));
+		if (any(greaterThanEqual(texel, destinationSize))) return;
+
+		// With an odd source size the last texel also covers the extra row/column
+		ivec2 count = ivec2(2);
+		if ((uSourceSize.x & 1) != 0 && texel.x == destinationSize.x - 1) count.x = 3;
+		if ((uSourceSize.y & 1) != 0 && texel.y == destinationSize.y - 1) count.y = 3;
+
+		vec2 minMax = vec2(1.0, 0.0);
+		for (int y = 0; y < count.y; ++y)
+		{
+			for (int x = 0; x < count.x; ++x)
+			{
+				ivec2 source = min(texel * 2 + ivec2(x, y), uSourceSize - 1);
+				vec2 value = imageLoad(uSource, source).rg;
+				minMax = vec2(min(minMax.x, value.x), max(minMax.y, value.y));
+			}
+		}
+		imageStore(uDestination, texel, vec4(minMax, 0.0, 0.0));
+	}
+	else if (uMode == MODE_DEBUG)
+	{
+		if (any(greaterThanEqual(texel, uSourceSize))) return;
+
+		// Linear depth of the farthest texel, with a curve so the near range is readable
+		float ndcDepth = imageLoad(uSource, texel).g * 2.0 - 1.0;
+		float zNear = uNearFar.x;
+		float zFar = uNearFar.y;
+		float linearDepth = (2.0 * zNear * zFar) / (zFar + zNear - ndcDepth * (zFar - zNear));
+		float value = sqrt(clamp((linearDepth - zNear) / (zFar - zNear), 0.0, 1.0));
+		imageStore(uDebug, texel, vec4(vec3(value), 1.0));
+	}
+}
+
+#endif
+#endif
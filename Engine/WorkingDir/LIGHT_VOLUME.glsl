@@ -0,0 +1,133 @@
+#ifdef LIGHT_VOLUME
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location = 0) in vec3 aPosition;
+
+// Identity for the full screen quad
+uniform mat4 uWorldViewProjection;
+
+void main()
+{
+	gl_Position = uWorldViewProjection * vec4(aPosition, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+struct Light
+{
+	vec4 position;    // w: radius
+	vec4 color;
+	vec4 direction;
+	vec3 attenuation; // constant, linear, quadratic
+	uint type;
+};
+
+layout(binding = 0, std140) uniform GlobalParams
+{
+	vec3 uCameraPosition;
+	uint uLightCount;
+	mat4 uClusterViewMatrix;
+	mat4 uClusterViewProjection;
+	uvec4 uClusterGrid;
+	vec4 uClusterDepth;
+};
+
+layout(binding = 4, std430) readonly buffer Lights
+{
+	Light uLight[];
+};
+
+uniform uint uLightIndex;
+uniform vec2 uViewportSize;
+
+uniform sampler2D uAlbedo;
+uniform sampler2D uNormals;
+uniform sampler2D uPosition;
+uniform sampler2D uViewDir;
+
+// Layout of the G-buffer, see App::ConfigureFrameBuffer
+uniform bool uCompactGBuffer;
+uniform sampler2D uDepth;
+uniform mat4 uInverseViewProjection;
+
+layout(location = 0) out vec4 oColor;
+
+vec2 SignNotZero(vec2 v)
+{
+	return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec3 OctahedronDecode(vec2 encoded)
+{
+	encoded = encoded * 2.0 - 1.0;
+	vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+	if (normal.z < 0.0) normal.xy = (1.0 - abs(normal.yx)) * SignNotZero(normal.xy);
+	return normalize(normal);
+}
+
+vec3 GBufferNormal(vec2 texCoord)
+{
+	if (!uCompactGBuffer) return texture(uNormals, texCoord).xyz;
+	return OctahedronDecode(texture(uNormals, texCoord).xy);
+}
+
+// The compact layout rebuilds the world position from the depth
+vec3 GBufferPosition(vec2 texCoord)
+{
+	if (!uCompactGBuffer) return texture(uPosition, texCoord).xyz;
+	float depth = texture(uDepth, texCoord).r;
+	vec4 position = uInverseViewProjection * vec4(vec3(texCoord, depth) * 2.0 - 1.0, 1.0);
+	return position.xyz / position.w;
+}
+
+vec3 GBufferViewDir(vec2 texCoord, vec3 position)
+{
+	if (!uCompactGBuffer) return texture(uViewDir, texCoord).xyz;
+	return uCameraPosition - position;
+}
+
+void CalculateBlitVars(in Light light, in vec3 vNormal, in vec3 vViewDir, out vec3 ambient, out vec3 diffuse, out vec3 specular)
+{
+			vec3 lightDir = normalize(light.direction.xyz);
+
+			float ambientStrenght = 0.2;
+			ambient = ambientStrenght * light.color.rgb;
+
+			float diff = max(dot(vNormal, lightDir), 0.0f);
+			diffuse = diff * light.color.rgb;
+
+			float specularStrength = 0.1f;
+			vec3 reflectDir = reflect(-lightDir, vNormal);
+			vec3 normalViewDir = normalize(vViewDir);
+			float spec = pow(max(dot(normalViewDir, reflectDir), 0.0f), 32);
+			specular = specularStrength * spec * light.color.rgb;
+}
+
+// Same shading as FB_TO_BB for a single light, the blending adds up the lights
+void main()
+{
+	vec2 texCoord = gl_FragCoord.xy / uViewportSize;
+	vec4 textureColor = texture(uAlbedo, texCoord);
+	Light light = uLight[uLightIndex];
+	vec3 position = GBufferPosition(texCoord);
+
+	vec3 ambient = vec3(0.0);
+	vec3 diffuse = vec3(0.0);
+	vec3 specular = vec3(0.0);
+	CalculateBlitVars(light, GBufferNormal(texCoord), GBufferViewDir(texCoord, position), ambient, diffuse, specular);
+
+	vec3 lightResult = ambient + diffuse + specular;
+	if (light.type != 0)
+	{
+		float distance = length(light.position.xyz - position);
+		if (distance > light.position.w) discard;
+		float attenuation = 1.0f / (light.attenuation.x + light.attenuation.y * distance + light.attenuation.z * (distance * distance));
+		lightResult *= attenuation;
+	}
+
+	oColor = vec4(lightResult, 1.0) * textureColor;
+}
+
+#endif
+#endif
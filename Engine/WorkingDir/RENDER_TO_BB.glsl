@@ -2,106 +2,210 @@
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
-layout(location = 0) in vec3 aPosition;
-layout(location = 1) in vec3 aNormal;
+layout(location = 0) in vec3 aPosition; // in [0, 1] inside the submesh box
+layout(location = 1) in vec2 aNormal;   // octahedron encoded
 layout(location = 2) in vec2 aTexCoord;
-//layout(location = 3) in vec3 aTangent;
-//layout(location = 4) in vec3 aBitangent;
-
-struct Light
-{
-	uint type;
-	vec3 color;
-	vec3 direction;
-	vec3 position;
-};
+//layout(location = 3) in vec4 aTangent; // octahedron encoded in xy, bitangent sign in z
+layout(location = 5) in uint aInstanceIndex; // baseInstance + gl_InstanceID
 
 layout(binding = 0, std140) uniform GlobalParams
 {
 	vec3 uCameraPosition;
 	uint uLightCount;
-	Light uLight[16];
+	mat4 uClusterViewMatrix;
+	mat4 uClusterViewProjection;
+	uvec4 uClusterGrid;  // clusters in x, y, z and max lights per cluster
+	vec4 uClusterDepth;  // near, far, slice scale, slice bias
 };
 
-uniform vec4 plane;
-
 out vec2 vTexCoord;
+flat out uint vMaterial;
 out vec3 vPosition; // in worldspace
 out vec3 vNormal;  // in worldspace
 out vec3 vViewDir;
 
-layout(binding = 1, std140) uniform LocalParams
+// World matrices of every instance drawn this frame
+layout(binding = 1, std430) readonly buffer InstanceParams
+{
+	mat4 uInstanceWorldMatrix[];
+};
+
+// Instances that passed the frustum test in this pass, indexed with baseInstance + gl_InstanceID
+layout(binding = 3, std430) readonly buffer VisibleInstances
+{
+	uint uVisibleInstance[];
+};
+
+// Draw of each visible list entry
+layout(binding = 7, std430) readonly buffer DrawIndices
+{
+	uint uDrawIndex[];
+};
+
+struct DrawParams
 {
-	mat4 uWorldMatrix;
-	mat4 uWorldViewProjectionMatrix;
+	vec4 positionOffset; // submesh box the positions are quantized in
+	vec4 positionScale;
+	uint materialIdx;
 };
 
+layout(binding = 9, std430) readonly buffer Draws
+{
+	DrawParams uDraw[];
+};
+
+layout(binding = 2, std140) uniform ViewParams
+{
+	mat4 uViewMatrix;
+	mat4 uProjectionMatrix;
+	mat4 uViewProjectionMatrix;
+	vec4 uClipPlane;
+	vec3 uViewPosition;
+};
+
+vec3 OctahedronDecode(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return normalize(n);
+}
+
 void main()
 {
+	mat4 worldMatrix = uInstanceWorldMatrix[uVisibleInstance[aInstanceIndex]];
+	DrawParams draw = uDraw[uDrawIndex[aInstanceIndex]];
+
 	vTexCoord = aTexCoord;
+	vMaterial = draw.materialIdx;
 
-	vec4 worldPosition = uWorldMatrix * vec4(aPosition,1.0);
+	vec3 position = draw.positionOffset.xyz + aPosition * draw.positionScale.xyz;
+	vec4 worldPosition = worldMatrix * vec4(position,1.0);
 
-	vPosition = vec3(uWorldMatrix * vec4(aPosition,1.0));
-	vNormal = normalize(vec3(uWorldMatrix * vec4(aNormal,0.0)));
-	vViewDir = uCameraPosition - vPosition;
+	vPosition = vec3(worldPosition);
+	vNormal = normalize(vec3(worldMatrix * vec4(OctahedronDecode(aNormal),0.0)));
+	vViewDir = uViewPosition - vPosition;
 	float clippingScale = 1.0;
 
-	gl_ClipDistance[0] = dot(worldPosition, plane);
+	gl_ClipDistance[0] = dot(worldPosition, uClipPlane);
 
-	gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, clippingScale);
+	gl_Position = uViewProjectionMatrix * (worldMatrix * vec4(position, clippingScale));
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
 
 struct Light
 {
+	vec4 position;    // w: radius
+	vec4 color;
+	vec4 direction;
+	vec3 attenuation; // constant, linear, quadratic
 	uint type;
-	vec3 color;
-	vec3 direction;
-	vec3 position;
 };
 
 layout(binding = 0, std140) uniform GlobalParams
 {
 	vec3 uCameraPosition;
 	uint uLightCount;
-	Light uLight[16];
+	mat4 uClusterViewMatrix;
+	mat4 uClusterViewProjection;
+	uvec4 uClusterGrid;  // clusters in x, y, z and max lights per cluster
+	vec4 uClusterDepth;  // near, far, slice scale, slice bias
 };
 
+layout(binding = 4, std430) readonly buffer Lights
+{
+	Light uLight[];
+};
+
+layout(binding = 5, std430) readonly buffer ClusterLightCounts
+{
+	uint uClusterLightCount[];
+};
+
+layout(binding = 6, std430) readonly buffer ClusterLightIndices
+{
+	uint uClusterLightIndex[];
+};
+
+// Cluster of the main view holding a world position, -1 outside of its frustum
+int FindCluster(vec3 worldPosition)
+{
+	vec4 clip = uClusterViewProjection * vec4(worldPosition, 1.0);
+	float depth = clip.w;
+	if (depth < uClusterDepth.x || depth > uClusterDepth.y) return -1;
+
+	vec2 ndc = clip.xy / clip.w;
+	if (any(greaterThan(abs(ndc), vec2(1.0)))) return -1;
+
+	uvec2 tile = uvec2(min((ndc * 0.5 + 0.5) * vec2(uClusterGrid.xy), vec2(uClusterGrid.xy) - 1.0));
+	uint slice = uint(clamp(log(depth) * uClusterDepth.z - uClusterDepth.w, 0.0, float(uClusterGrid.z - 1)));
+	return int(tile.x + tile.y * uClusterGrid.x + slice * uClusterGrid.x * uClusterGrid.y);
+}
+
 
 in vec2 vTexCoord;
+flat in uint vMaterial;
 in vec3 vPosition; // in worldspace
 in vec3 vNormal;  // in worldspace
 in vec3 vViewDir;
 
-uniform sampler2D uTexture;
+// Layouts shared with MaterialTableFunctions.h: array and layer of each texture, x < 0 when not placed
+struct Material
+{
+	ivec2 albedo;
+	ivec2 emissive;
+	ivec2 specular;
+	ivec2 normals;
+	ivec2 bump;
+};
+
+layout(binding = 8, std430) readonly buffer Materials
+{
+	Material uMaterial[];
+};
+
+// MATERIAL_TABLE_MAX_ARRAYS, the index is the same for a whole draw
+uniform sampler2DArray uMaterialArrays[16];
+
+vec4 SampleMaterialTexture(ivec2 slot, vec2 texCoord, vec4 fallback)
+{
+	if (slot.x < 0) return fallback;
+	return texture(uMaterialArrays[slot.x], vec3(texCoord, float(slot.y)));
+}
 layout(location = 0) out vec4 oColor;
 
 void CalculateBlitVars(in Light light ,out vec3 ambient, out vec3 diffuse, out vec3 specular)
 {
 			
-			vec3 lightDir = normalize(light.direction);
+			vec3 lightDir = normalize(light.direction.xyz);
 
 			float ambientStrenght = 0.2;
-			ambient = ambientStrenght * light.color;
+			ambient = ambientStrenght * light.color.rgb;
 
 			float diff = max(dot(vNormal, lightDir), 0.0f);
-			diffuse = diff * light.color;
+			diffuse = diff * light.color.rgb;
 
 			float specularStrength = 0.1f;
 			vec3 reflectDir = reflect(-lightDir, vNormal);
 			vec3 normalViewDir = normalize(vViewDir);
 			float spec = pow(max(dot(normalViewDir, reflectDir), 0.0f), 32);
-			specular = specularStrength * spec * light.color;
+			specular = specularStrength * spec * light.color.rgb;
 }
 
 void main()
 {
-	vec4 textureColor = texture(uTexture, vTexCoord);
+	vec4 textureColor = SampleMaterialTexture(uMaterial[vMaterial].albedo, vTexCoord, vec4(1.0));
+	vec3 position = vPosition;
 	vec4 finalColor = vec4(0.0);
-	for(int i = 0; i < uLightCount; ++i)
+
+	// Outside of the clusters every light is visited
+	int cluster = FindCluster(position);
+	uint lightCount = cluster >= 0 ? uClusterLightCount[cluster] : uLightCount;
+	for(uint i = 0; i < lightCount; ++i)
 	{
+		uint lightIdx = cluster >= 0 ? uClusterLightIndex[uint(cluster) * uClusterGrid.w + i] : i;
+		Light light = uLight[lightIdx];
 		
 		vec3 lightResult = vec3(0.0f);
 
@@ -109,10 +213,8 @@ void main()
 		vec3 diffuse = vec3(0.0);
 		vec3 specular = vec3(0.0);
 
-		if(uLight[i].type == 0)
+		if(light.type == 0)
 		{
-			Light light = uLight[i];
-
 			CalculateBlitVars(light, ambient, diffuse, specular);
 
 			lightResult = ambient + diffuse + specular;
@@ -121,13 +223,9 @@ void main()
 		}
 		else
 		{
-			Light light = uLight[i];
-
-			float constant = 1.0f;
-			float linear = 0.09f;
-			float quadratic = 0.032f;
-			float distance = length(light.position - vPosition);
-			float attenuation = 1.0f / (constant + linear * distance + quadratic * (distance * distance));
+			float distance = length(light.position.xyz - position);
+			if (distance > light.position.w) continue;
+			float attenuation = 1.0f / (light.attenuation.x + light.attenuation.y * distance + light.attenuation.z * (distance * distance));
 
 			CalculateBlitVars(light, ambient, diffuse, specular);
 
@@ -2,89 +2,168 @@
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
-layout(location = 0) in vec3 aPosition;
-layout(location = 1) in vec3 aNormal;
+layout(location = 0) in vec3 aPosition; // in [0, 1] inside the submesh box
+layout(location = 1) in vec2 aNormal;   // octahedron encoded
 layout(location = 2) in vec2 aTexCoord;
-//layout(location = 3) in vec3 aTangent;
-//layout(location = 4) in vec3 aBitangent;
-
-struct Light
-{
-	uint type;
-	vec3 color;
-	vec3 direction;
-	vec3 position;
-};
+//layout(location = 3) in vec4 aTangent; // octahedron encoded in xy, bitangent sign in z
+layout(location = 5) in uint aInstanceIndex; // baseInstance + gl_InstanceID
 
 layout(binding = 0, std140) uniform GlobalParams
 {
 	vec3 uCameraPosition;
 	uint uLightCount;
-	Light uLight[16];
+	mat4 uClusterViewMatrix;
+	mat4 uClusterViewProjection;
+	uvec4 uClusterGrid;  // clusters in x, y, z and max lights per cluster
+	vec4 uClusterDepth;  // near, far, slice scale, slice bias
 };
 
 out vec2 vTexCoord;
+flat out uint vMaterial;
 out vec3 vPosition; // in worldspace
 out vec3 vNormal;  // in worldspace
 out vec3 vViewDir;
 
-layout(binding = 1, std140) uniform LocalParams
+// World matrices of every instance drawn this frame
+layout(binding = 1, std430) readonly buffer InstanceParams
+{
+	mat4 uInstanceWorldMatrix[];
+};
+
+// Instances that passed the frustum test in this pass, indexed with baseInstance + gl_InstanceID
+layout(binding = 3, std430) readonly buffer VisibleInstances
+{
+	uint uVisibleInstance[];
+};
+
+// Draw of each visible list entry
+layout(binding = 7, std430) readonly buffer DrawIndices
+{
+	uint uDrawIndex[];
+};
+
+struct DrawParams
+{
+	vec4 positionOffset; // submesh box the positions are quantized in
+	vec4 positionScale;
+	uint materialIdx;
+};
+
+layout(binding = 9, std430) readonly buffer Draws
 {
-	mat4 uWorldMatrix;
-	mat4 uWorldViewProjectionMatrix;
+	DrawParams uDraw[];
 };
 
-uniform vec4 plane;
+layout(binding = 2, std140) uniform ViewParams
+{
+	mat4 uViewMatrix;
+	mat4 uProjectionMatrix;
+	mat4 uViewProjectionMatrix;
+	vec4 uClipPlane;
+	vec3 uViewPosition;
+};
+
+vec3 OctahedronDecode(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return normalize(n);
+}
 
 void main()
 {
+	mat4 worldMatrix = uInstanceWorldMatrix[uVisibleInstance[aInstanceIndex]];
+	DrawParams draw = uDraw[uDrawIndex[aInstanceIndex]];
+
 	vTexCoord = aTexCoord;
+	vMaterial = draw.materialIdx;
 
-	vec4 worldPosition = uWorldMatrix * vec4(aPosition,1.0);
+	vec3 position = draw.positionOffset.xyz + aPosition * draw.positionScale.xyz;
+	vec4 worldPosition = worldMatrix * vec4(position,1.0);
 
-	vPosition = vec3(uWorldMatrix * vec4(aPosition,1.0));
-	vNormal = normalize(vec3(uWorldMatrix * vec4(aNormal,0.0)));
-	vViewDir = uCameraPosition - vPosition;
+	vPosition = vec3(worldPosition);
+	vNormal = normalize(vec3(worldMatrix * vec4(OctahedronDecode(aNormal),0.0)));
+	vViewDir = uViewPosition - vPosition;
 	float clippingScale = 1.0;
 
-	gl_ClipDistance[0] = dot(worldPosition, plane);
+	gl_ClipDistance[0] = dot(worldPosition, uClipPlane);
 
-	gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, clippingScale);
+	gl_Position = uViewProjectionMatrix * (worldMatrix * vec4(position, clippingScale));
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
 
-struct Light
-{
-	uint type;
-	vec3 color;
-	vec3 direction;
-	vec3 position;
-};
-
 layout(binding = 0, std140) uniform GlobalParams
 {
 	vec3 uCameraPosition;
 	uint uLightCount;
-	Light uLight[16];
+	mat4 uClusterViewMatrix;
+	mat4 uClusterViewProjection;
+	uvec4 uClusterGrid;  // clusters in x, y, z and max lights per cluster
+	vec4 uClusterDepth;  // near, far, slice scale, slice bias
 };
 
 
 in vec2 vTexCoord;
+flat in uint vMaterial;
 in vec3 vPosition; // in worldspace
 in vec3 vNormal;  // in worldspace
 in vec3 vViewDir;
 
-uniform sampler2D uTexture;
+// Layouts shared with MaterialTableFunctions.h: array and layer of each texture, x < 0 when not placed
+struct Material
+{
+	ivec2 albedo;
+	ivec2 emissive;
+	ivec2 specular;
+	ivec2 normals;
+	ivec2 bump;
+};
+
+layout(binding = 8, std430) readonly buffer Materials
+{
+	Material uMaterial[];
+};
+
+// MATERIAL_TABLE_MAX_ARRAYS, the index is the same for a whole draw
+uniform sampler2DArray uMaterialArrays[16];
+
+vec4 SampleMaterialTexture(ivec2 slot, vec2 texCoord, vec4 fallback)
+{
+	if (slot.x < 0) return fallback;
+	return texture(uMaterialArrays[slot.x], vec3(texCoord, float(slot.y)));
+}
 
 layout(location = 0) out vec4 oAlbedo;
 layout(location = 1) out vec4 oNormals;
 layout(location = 2) out vec4 oPosition;
 layout(location = 3) out vec4 oViewDir;
 
+// Only albedo and octahedron encoded normals, see App::ConfigureFrameBuffer
+uniform bool uCompactGBuffer;
+
+vec2 SignNotZero(vec2 v)
+{
+	return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+// Unit vector to [0, 1]^2, through the octahedron |x| + |y| + |z| = 1 unfolded on a square
+vec2 OctahedronEncode(vec3 normal)
+{
+	normal /= abs(normal.x) + abs(normal.y) + abs(normal.z);
+	vec2 encoded = normal.z >= 0.0 ? normal.xy : (1.0 - abs(normal.yx)) * SignNotZero(normal.xy);
+	return encoded * 0.5 + 0.5;
+}
+
 void main()
 {
-	oAlbedo = texture(uTexture, vTexCoord);
+	oAlbedo = SampleMaterialTexture(uMaterial[vMaterial].albedo, vTexCoord, vec4(1.0));
+	if (uCompactGBuffer)
+	{
+		oNormals = vec4(OctahedronEncode(normalize(vNormal)), 0.0, 0.0);
+		return;
+	}
 	oNormals = vec4(vNormal, 1.0);
 	oPosition = vec4(vPosition, 1.0);
 	oViewDir = vec4(vViewDir,1.0);